@@ -0,0 +1,171 @@
+#ifndef __BASELINE_CACHE_H__
+#define __BASELINE_CACHE_H__
+
+#include "proxy_common.h"
+
+/*
+ * 溢出路径重写之前的Cache/DiskCache, 作为基准测试的参照后端
+ * 原样保留, 仅做以下改动:
+ *   - 放入baseline名字空间, 与现行实现共存
+ *   - 溢出文件由benchTmpfile()创建, 见baseline_disk_cache.cpp
+ *   - 修正一处printf格式的类型警告
+ * 宿主回调为bool(const void *, size_t), 只能整条取走或不取; 溢出记录经stdio读写, 每次取一条
+ */
+
+NAMESPACE_BEG(baseline)
+
+class DiskCache
+{
+  public:
+    DiskCache()
+            :mpFile(NULL)
+    {}
+
+    virtual ~DiskCache();
+
+    ssize_t write(const void *data, size_t datalen);
+    ssize_t read(void *data, size_t datalen);
+    size_t peeksize();
+
+    void rollback(size_t n);
+
+    void clear();
+
+  private:
+    bool _createFile();
+
+  private:
+    FILE *mpFile;
+};
+
+template <class T, int MAX_LEN_CACHE_IN_MEM = 256*1024>
+class Cache
+{
+    typedef bool (T::*FuncType)(const void *, size_t);
+  public:
+    Cache(T *host, FuncType func)
+            :mHost(host)
+            ,mFunc(func)
+            ,mCachedList()
+            ,mDiskCache()
+            ,mLenCacheInMem(0)
+            ,mLenCacheInFile(0)
+    {}
+
+    virtual ~Cache()
+    {
+        typename DataList::iterator it = this->mCachedList.begin();
+        for (; it != this->mCachedList.end(); ++it)
+        {
+            free((*it).data);
+        }
+        this->mCachedList.clear();
+    }
+
+    bool empty() const
+    {
+        return 0 == mLenCacheInMem && 0 == mLenCacheInFile;
+    }
+
+    void cache(const void *data, size_t len)
+    {
+        assert(len > 0 && "cache() && len>0");
+
+        // cache in file
+        if (mLenCacheInMem+len > MAX_LEN_CACHE_IN_MEM || mLenCacheInFile > 0)
+        {
+            int ret = mDiskCache.write(data, len);
+            if (ret == (int)len)
+            {
+                mLenCacheInFile += len;
+                return;
+            }
+
+            ErrorPrint("Cache::cache() write to file failed! return code:%d", ret);
+        }
+
+        // cache in mem
+        Data d;
+        mLenCacheInMem += len;
+        d.len = len;
+        d.data = (char *)malloc(len);
+        assert(d.data != NULL && "cache() malloc failed");
+        memcpy(d.data, data, len);
+        this->mCachedList.push_back(d);
+    }
+
+    void clear()
+    {
+        typename DataList::iterator it = this->mCachedList.begin();
+        for (; it != this->mCachedList.end(); ++it)
+        {
+            free((*it).data);
+        }
+        this->mCachedList.clear();
+
+        mDiskCache.clear();
+    }
+
+    bool flushAll()
+    {
+        typename DataList::iterator it = this->mCachedList.begin();
+        for (; it != this->mCachedList.end(); )
+        {
+            if ((mHost->*mFunc)((*it).data, (*it).len))
+            {
+                mLenCacheInMem -= (*it).len;
+                free((*it).data);
+                mCachedList.erase(it++);
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        for (ssize_t sz = mDiskCache.peeksize(); sz > 0; sz = mDiskCache.peeksize())
+        {
+            char *ptr = (char *)malloc(sz);
+            if (NULL == ptr)
+            {
+                ErrorPrint("malloc failed size=%lld", (long long)sz);
+                assert(false);
+            }
+            assert(mDiskCache.read(ptr, sz) == sz);
+
+            if ((mHost->*mFunc)(ptr, sz))
+            {
+                mLenCacheInFile -= sz;
+                free(ptr);
+            }
+            else
+            {
+                free(ptr);
+                mDiskCache.rollback(sz);
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+  private:
+    struct Data
+    {
+        size_t len;
+        char *data;
+    };
+
+    typedef std::list<Data> DataList;
+
+    T *mHost;
+    FuncType mFunc;
+    DataList mCachedList;
+    DiskCache mDiskCache;
+    size_t mLenCacheInMem;
+    size_t mLenCacheInFile;
+};
+
+NAMESPACE_END // namespace baseline
+
+#endif // __BASELINE_CACHE_H__
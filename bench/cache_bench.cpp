@@ -0,0 +1,595 @@
+#include "proxy_common.h"
+#include "cache.h"
+#include "select_poller.h"
+#include "baseline_cache.h"
+
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+using namespace proxy;
+
+/*
+ * Cache/DiskCache的微基准与压力测试, 用于比较溢出路径的不同实现
+ *
+ * 场景:
+ *   mem      数据只缓存在内存中
+ *   spill    超出内存上限后溢出到磁盘, 依次测试各SPILL后端
+ *   partial  宿主随机只取走一部分或暂不可写, 检查断点续传
+ *   mixed    大小记录混合, 同时有溢出
+ *   consume  直接驱动溢出后端的front()/consume(), 读写交替, 宿主随机只取走一部分
+ * 每个场景输出吞吐(MB/s), 每MB的内存分配次数和系统调用次数, 并按顺序校验全部数据
+ * 每个场景都附带baseline一行, 即重写之前的Cache/DiskCache(见baseline_cache.h),
+ * 其宿主只能整条取走, partial时未全部接受即视为本次不可写
+ *
+ * 编译: 先在根目录make生成lib/下的库, 再make -C bench
+ * 用法: cache_bench.out [-s total_mb] [-a] [scenario ...]
+ *   -s 每个场景写入的数据量(MB), 默认256
+ *   -a 启动I/O线程(gSpillIo), 否则溢出文件在当前线程同步读写
+ */
+
+#define BENCH_DEFAULT_MB  256
+#define BENCH_PATTERN_LEN (4*1024*1024 - 4093) // 数据流的内容以此为周期, 不与块/记录大小对齐
+#define BENCH_MAX_RECORD  (1024*1024)
+#define BENCH_MEM_LIMIT   (16*1024*1024) // mem场景的内存上限, 每轮积压不超过它
+#define BENCH_MEM_ROUND   (8*1024*1024)
+#define BENCH_SPILL_ROUND (32*1024*1024) // 模拟上游建立前的积压量
+#define BENCH_PARTIAL_ROUND (1024*1024)  // partial场景每轮积压较少, 内存和磁盘两段都频繁续传
+#define BENCH_MAX_SPINS   10000000       // 排空时最多调用flushAll()的次数
+
+//--------------------------------------------------------------------------
+// 计数: 替换malloc系列及溢出路径用到的系统调用, I/O线程中的调用也计入
+
+static volatile long gAllocs = 0;
+static volatile long gSyscalls = 0;
+
+#ifdef __GLIBC__
+extern "C"
+{
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+    __sync_fetch_and_add(&gAllocs, 1);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    __sync_fetch_and_add(&gAllocs, 1);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    __sync_fetch_and_add(&gAllocs, 1);
+    return __libc_realloc(ptr, size);
+}
+}
+# define BENCH_COUNT_ALLOCS 1
+#else
+# define BENCH_COUNT_ALLOCS 0
+#endif
+
+#define BENCH_WRAP_SYSCALL(ret, name, params, args, spec) \
+    extern "C" ret name params spec \
+    { \
+        typedef ret (*RealFunc) params; \
+        static RealFunc real = NULL; \
+        if (NULL == real) \
+            real = (RealFunc)dlsym(RTLD_NEXT, #name); \
+        __sync_fetch_and_add(&gSyscalls, 1); \
+        return real args; \
+    }
+
+BENCH_WRAP_SYSCALL(ssize_t, read, (int fd, void *buf, size_t n), (fd, buf, n), )
+BENCH_WRAP_SYSCALL(ssize_t, write, (int fd, const void *buf, size_t n), (fd, buf, n), )
+BENCH_WRAP_SYSCALL(ssize_t, pread, (int fd, void *buf, size_t n, off_t off), (fd, buf, n, off), )
+BENCH_WRAP_SYSCALL(ssize_t, pwrite, (int fd, const void *buf, size_t n, off_t off), (fd, buf, n, off), )
+BENCH_WRAP_SYSCALL(ssize_t, preadv, (int fd, const struct iovec *iov, int cnt, off_t off), (fd, iov, cnt, off), )
+BENCH_WRAP_SYSCALL(ssize_t, pwritev, (int fd, const struct iovec *iov, int cnt, off_t off), (fd, iov, cnt, off), )
+BENCH_WRAP_SYSCALL(int, close, (int fd), (fd), )
+BENCH_WRAP_SYSCALL(off_t, lseek, (int fd, off_t off, int whence), (fd, off, whence), throw())
+BENCH_WRAP_SYSCALL(off64_t, lseek64, (int fd, off64_t off, int whence), (fd, off, whence), throw())
+BENCH_WRAP_SYSCALL(int, ftruncate, (int fd, off_t len), (fd, len), throw())
+BENCH_WRAP_SYSCALL(int, posix_fallocate, (int fd, off_t off, off_t len), (fd, off, len), )
+BENCH_WRAP_SYSCALL(void *, mmap, (void *addr, size_t len, int prot, int flags, int fd, off_t off),
+                   (addr, len, prot, flags, fd, off), throw())
+BENCH_WRAP_SYSCALL(int, munmap, (void *addr, size_t len), (addr, len), throw())
+#ifdef __linux__
+BENCH_WRAP_SYSCALL(int, fallocate, (int fd, int mode, off_t off, off_t len), (fd, mode, off, len), )
+BENCH_WRAP_SYSCALL(ssize_t, readahead, (int fd, off64_t off, size_t n), (fd, off, n), throw())
+#endif
+
+struct BenchCounters
+{
+    uint64 usec;
+    long allocs;
+    long syscalls;
+};
+
+static uint64 nowUsec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static BenchCounters snapshot()
+{
+    BenchCounters c;
+    c.usec = nowUsec();
+    c.allocs = gAllocs;
+    c.syscalls = gSyscalls;
+    return c;
+}
+
+//--------------------------------------------------------------------------
+// 数据: 流中每个字节的内容只由其位置决定, 接收方按位置直接比较, 校验开销很小
+
+// 末尾重复开头的内容, 跨周期的数据也能连续取出
+#define BENCH_PATTERN_CAP (BENCH_PATTERN_LEN + 2*BENCH_MAX_RECORD)
+
+static char *gPattern = NULL;
+
+static const char *streamAt(uint64 off)
+{
+    return gPattern + off % BENCH_PATTERN_LEN;
+}
+
+typedef size_t (*RecordSizeFunc)();
+
+// 典型的单次recv大小
+static size_t recvSize()
+{
+    return 4096;
+}
+
+// 多数为小包, 夹杂少量大块
+static size_t mixedSize()
+{
+    int r = rand() % 100;
+    if (r < 70)
+        return 16 + rand() % 497;
+    if (r < 95)
+        return 1024 + rand() % (15*1024);
+    return 64*1024 + rand() % (BENCH_MAX_RECORD - 64*1024);
+}
+
+//--------------------------------------------------------------------------
+// 宿主: 模拟代理连接, 按顺序校验收到的数据; partial时随机只取走一部分
+
+class BenchHost
+{
+  public:
+    BenchHost(bool partial)
+            :mbPartial(partial)
+            ,mbCorrupt(false)
+            ,mBytes(0)
+            ,mFileBuf(NULL)
+    {
+        mFileBuf = (char *)malloc(BENCH_MAX_RECORD);
+        assert(mFileBuf && "BenchHost malloc failed");
+    }
+
+    ~BenchHost()
+    {
+        free(mFileBuf);
+    }
+
+    ssize_t onData(const void *data, size_t len)
+    {
+        size_t n = accept(len);
+        check(data, n);
+        return n;
+    }
+
+    ssize_t onDatav(const struct iovec *iov, int iovcnt)
+    {
+        size_t total = 0;
+        for (int i = 0; i < iovcnt; ++i)
+        {
+            total += iov[i].iov_len;
+        }
+
+        size_t left = accept(total);
+        size_t n = left;
+        for (int i = 0; i < iovcnt && left > 0; ++i)
+        {
+            size_t len = min(left, iov[i].iov_len);
+            check(iov[i].iov_base, len);
+            left -= len;
+        }
+        return n;
+    }
+
+    // baseline::Cache的回调: 只能整条取走
+    bool onRecord(const void *data, size_t len)
+    {
+        if (accept(len) < len)
+            return false;
+
+        check(data, len);
+        return true;
+    }
+
+    // 代替sendfile: 读出后校验, 系统调用次数相同
+    ssize_t onFile(int fd, off_t off, size_t len)
+    {
+        size_t n = min(accept(len), (size_t)BENCH_MAX_RECORD);
+        if (0 == n)
+            return 0;
+
+        if (pread(fd, mFileBuf, n, off) != (ssize_t)n)
+            return -1;
+
+        check(mFileBuf, n);
+        return n;
+    }
+
+    // 收到的数据与写入的完全一致
+    inline bool verify(uint64 total) const
+    {
+        return !mbCorrupt && mBytes == total;
+    }
+
+  private:
+    void check(const void *data, size_t len)
+    {
+        if (len > 0 && memcmp(data, streamAt(mBytes), len) != 0)
+            mbCorrupt = true;
+        mBytes += len;
+    }
+
+    size_t accept(size_t len)
+    {
+        if (!mbPartial)
+            return len;
+
+        int r = rand() % 4;
+        if (0 == r)
+            return 0;
+        if (1 == r)
+            return 1 + rand() % len;
+        return len;
+    }
+
+  private:
+    bool mbPartial;
+    bool mbCorrupt;
+    uint64 mBytes;
+    char *mFileBuf;
+};
+
+//--------------------------------------------------------------------------
+
+static EventPoller *gPoller = NULL;
+
+static void report(const char *scenario, const char *backend, size_t bytes,
+                   const BenchCounters &beg, const BenchCounters &end, bool ok)
+{
+    double mb = (double)bytes / (1024*1024);
+    double sec = (double)(end.usec - beg.usec) / 1000000;
+    if (sec <= 0)
+        sec = 0.000001;
+
+    char allocs[32];
+    if (BENCH_COUNT_ALLOCS)
+        snprintf(allocs, sizeof(allocs), "%.1f", (end.allocs - beg.allocs) / mb);
+    else
+        snprintf(allocs, sizeof(allocs), "n/a");
+
+    printf("%-9s %-15s %8.0f %10.1f %11s %12.1f  %s\n",
+           scenario, backend, mb, mb / sec, allocs, (end.syscalls - beg.syscalls) / mb,
+           ok ? "ok" : "MISMATCH");
+    fflush(stdout);
+}
+
+/*
+ * 每轮先缓存round字节(模拟隧道建立前的积压), 再flush到空
+ * partial时缓存过程中也随机flush, 覆盖边取走边追加的情况
+ */
+template <class CACHE>
+static bool driveCache(CACHE *cache, BenchHost &host, const char *scenario, const char *backend,
+                       size_t total, size_t round, RecordSizeFunc sizeFunc, bool partial)
+{
+    srand(1);
+    bool ok = true;
+
+    BenchCounters beg = snapshot();
+    size_t done = 0;
+    while (done < total && ok)
+    {
+        for (size_t n = 0; n < round && done < total; )
+        {
+            size_t len = sizeFunc();
+            cache->cache(streamAt(done), len);
+            n += len;
+            done += len;
+
+            if (partial && 0 == rand() % 32)
+                cache->flushAll();
+        }
+
+        // 宿主暂不接收或等待I/O线程时立即重试, 不计入等待时间
+        int spins = 0;
+        while (!cache->empty() && ++spins < BENCH_MAX_SPINS)
+        {
+            if (!cache->flushAll() && gPoller)
+                gPoller->processPendingEvents(0);
+        }
+        ok = cache->empty();
+    }
+    BenchCounters end = snapshot();
+
+    ok = ok && host.verify(done);
+    report(scenario, backend, done, beg, end, ok);
+    return ok;
+}
+
+template <class SPILL, int MAX_LEN>
+static bool runCache(const char *scenario, const char *backend, size_t total, size_t round,
+                     RecordSizeFunc sizeFunc, bool partial)
+{
+    typedef Cache<BenchHost, MAX_LEN, SPILL> BenchCache;
+
+    gChunkPool.trim();
+
+    BenchHost host(partial);
+    BenchCache *cache = new BenchCache(&host, &BenchHost::onData, &BenchHost::onFile, &BenchHost::onDatav);
+    bool ok = driveCache(cache, host, scenario, backend, total, round, sizeFunc, partial);
+
+    delete cache;
+    return ok;
+}
+
+template <int MAX_LEN>
+static bool runBaseline(const char *scenario, size_t total, size_t round, RecordSizeFunc sizeFunc, bool partial)
+{
+    typedef baseline::Cache<BenchHost, MAX_LEN> BenchCache;
+
+    BenchHost host(partial);
+    BenchCache *cache = new BenchCache(&host, &BenchHost::onRecord);
+    bool ok = driveCache(cache, host, scenario, "baseline", total, round, sizeFunc, partial);
+
+    delete cache;
+    return ok;
+}
+
+/*
+ * Cache发送溢出数据的路径: 直接驱动溢出后端, 每次写入若干记录后用front()取出约一半,
+ * 宿主随机只取走一部分, 按实际取走的字节consume(), 全部写完后取到空
+ */
+template <class SPILL>
+static bool runConsume(const char *backend, size_t total)
+{
+    gChunkPool.trim();
+    srand(1);
+
+    BenchHost host(true);
+    SPILL *spill = new SPILL();
+    uint64 left = 0; // 已写入未取走的字节数
+    int spins = 0;
+    bool ok = true;
+
+    BenchCounters beg = snapshot();
+    size_t done = 0;
+    while (ok && (done < total || left > 0))
+    {
+        for (int i = 0; i < 64 && done < total; ++i)
+        {
+            size_t len = mixedSize();
+            if (spill->write(streamAt(done), len) != (ssize_t)len)
+            {
+                ok = false;
+                break;
+            }
+            done += len;
+            left += len;
+        }
+
+        for (int i = 0; ok && left > 0 && (i < 32 || done >= total); ++i)
+        {
+            const void *data = NULL;
+            int fd = -1;
+            off_t off = 0;
+
+            size_t len = spill->front(&data, &fd, &off);
+            if (0 == len)
+            {
+                // 等待I/O线程读盘, 立即重试
+                if (++spins >= BENCH_MAX_SPINS)
+                    ok = false;
+                if (gPoller)
+                    gPoller->processPendingEvents(0);
+                break;
+            }
+
+            ssize_t n = data ? host.onData(data, len) : host.onFile(fd, off, len);
+            if (n < 0)
+            {
+                ok = false;
+                break;
+            }
+            spill->consume(n);
+            left -= n;
+        }
+    }
+    BenchCounters end = snapshot();
+
+    delete spill;
+    ok = ok && 0 == left && host.verify(done);
+    report("consume", backend, done, beg, end, ok);
+    return ok;
+}
+
+/*
+ * baseline的对应路径: 每次read()出一整条记录, 宿主未全部接受时rollback()再读
+ */
+static bool runConsumeBaseline(size_t total)
+{
+    srand(1);
+
+    BenchHost host(true);
+    baseline::DiskCache *dc = new baseline::DiskCache();
+    char *buf = (char *)malloc(BENCH_MAX_RECORD);
+    assert(buf && "runConsumeBaseline malloc failed");
+    uint64 left = 0;
+    bool ok = true;
+
+    BenchCounters beg = snapshot();
+    size_t done = 0;
+    while (ok && (done < total || left > 0))
+    {
+        for (int i = 0; i < 64 && done < total; ++i)
+        {
+            size_t len = mixedSize();
+            if (dc->write(streamAt(done), len) != (ssize_t)len)
+            {
+                ok = false;
+                break;
+            }
+            done += len;
+            left += len;
+        }
+
+        for (int i = 0; ok && left > 0 && (i < 32 || done >= total); ++i)
+        {
+            size_t sz = dc->peeksize();
+            if (0 == sz || dc->read(buf, sz) != (ssize_t)sz)
+            {
+                ok = false;
+                break;
+            }
+
+            if (!host.onRecord(buf, sz))
+            {
+                dc->rollback(sz);
+                continue;
+            }
+            left -= sz;
+        }
+    }
+    BenchCounters end = snapshot();
+
+    delete dc;
+    free(buf);
+    ok = ok && 0 == left && host.verify(done);
+    report("consume", "baseline", done, beg, end, ok);
+    return ok;
+}
+
+static bool selected(const std::vector<std::string> &names, const char *name)
+{
+    return names.empty() || std::find(names.begin(), names.end(), name) != names.end();
+}
+
+int main(int argc, char *argv[])
+{
+    size_t totalMB = BENCH_DEFAULT_MB;
+    bool async = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:a")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            totalMB = atoi(optarg);
+            break;
+        case 'a':
+            async = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s total_mb] [-a] [mem|spill|partial|mixed|consume ...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (0 == totalMB)
+        totalMB = BENCH_DEFAULT_MB;
+
+    std::vector<std::string> names;
+    for (int i = optind; i < argc; ++i)
+    {
+        names.push_back(argv[i]);
+    }
+
+    log_initialise(AllLog);
+    log_reg_console();
+
+    gPattern = (char *)malloc(BENCH_PATTERN_CAP);
+    assert(gPattern && "pattern malloc failed");
+    srand(12345);
+    for (size_t i = 0; i < BENCH_PATTERN_CAP; ++i)
+    {
+        gPattern[i] = i < BENCH_PATTERN_LEN ? (char)rand() : gPattern[i - BENCH_PATTERN_LEN];
+    }
+
+    SelectPoller poller;
+    if (async)
+    {
+        if (!gSpillIo.initialise(&poller))
+        {
+            fprintf(stderr, "start spill io thread failed.\n");
+            return 1;
+        }
+        gPoller = &poller;
+    }
+
+    size_t total = totalMB * 1024 * 1024;
+    bool ok = true;
+
+    printf("spill io: %s\n", async ? "thread" : "sync");
+    printf("%-9s %-15s %8s %10s %11s %12s  %s\n",
+           "scenario", "backend", "MB", "MB/s", "allocs/MB", "syscalls/MB", "check");
+
+    if (selected(names, "mem"))
+    {
+        ok &= runBaseline<BENCH_MEM_LIMIT>("mem", total, BENCH_MEM_ROUND, recvSize, false);
+        ok &= runCache<DiskCache, BENCH_MEM_LIMIT>("mem", "-", total, BENCH_MEM_ROUND, recvSize, false);
+    }
+
+    if (selected(names, "spill"))
+    {
+        ok &= runBaseline<256*1024>("spill", total, BENCH_SPILL_ROUND, recvSize, false);
+        ok &= runCache<DiskCache, 256*1024>("spill", "DiskCache", total, BENCH_SPILL_ROUND, recvSize, false);
+        ok &= runCache<MmapDiskCache, 256*1024>("spill", "MmapDiskCache", total, BENCH_SPILL_ROUND, recvSize, false);
+        ok &= runCache<AsyncDiskCache, 256*1024>("spill", "AsyncDiskCache", total, BENCH_SPILL_ROUND, recvSize, false);
+    }
+
+    if (selected(names, "partial"))
+    {
+        ok &= runBaseline<64*1024>("partial", total, BENCH_PARTIAL_ROUND, recvSize, true);
+        ok &= runCache<DiskCache, 64*1024>("partial", "DiskCache", total, BENCH_PARTIAL_ROUND, recvSize, true);
+        ok &= runCache<MmapDiskCache, 64*1024>("partial", "MmapDiskCache", total, BENCH_PARTIAL_ROUND, recvSize, true);
+        ok &= runCache<AsyncDiskCache, 64*1024>("partial", "AsyncDiskCache", total, BENCH_PARTIAL_ROUND, recvSize, true);
+    }
+
+    if (selected(names, "mixed"))
+    {
+        ok &= runBaseline<256*1024>("mixed", total, BENCH_SPILL_ROUND, mixedSize, false);
+        ok &= runCache<DiskCache, 256*1024>("mixed", "DiskCache", total, BENCH_SPILL_ROUND, mixedSize, false);
+        ok &= runCache<MmapDiskCache, 256*1024>("mixed", "MmapDiskCache", total, BENCH_SPILL_ROUND, mixedSize, false);
+        ok &= runCache<AsyncDiskCache, 256*1024>("mixed", "AsyncDiskCache", total, BENCH_SPILL_ROUND, mixedSize, false);
+    }
+
+    if (selected(names, "consume"))
+    {
+        ok &= runConsumeBaseline(total);
+        ok &= runConsume<DiskCache>("DiskCache", total);
+        ok &= runConsume<MmapDiskCache>("MmapDiskCache", total);
+        ok &= runConsume<AsyncDiskCache>("AsyncDiskCache", total);
+    }
+
+    if (async)
+    {
+        gSpillIo.dumpStats();
+        gSpillIo.finalise();
+    }
+    free(gPattern);
+    log_finalise();
+
+    return ok ? 0 : 1;
+}
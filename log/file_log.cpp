@@ -372,6 +372,13 @@ FileLog::EErrCode FileLog::_deleteEarliestFile()
 
 void FileLog::openRecentFile()
 {
+    // ظע(forkؽ־)ʱȹرѴ򿪵ļ
+    if (mLogFile)
+    {
+        fclose(mLogFile);
+        mLogFile = NULL;
+    }
+
     const char *curdir = _getTodayFileDir();
     DIR *dir = opendir(curdir);
 
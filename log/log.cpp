@@ -47,16 +47,17 @@ bool Log::initialise(int level, bool hasTime)
         return false;
     }
 #else
-    if(pthread_create(&mTid, NULL, Log::_logProc, (void *)this) != 0)
+    // 日志线程一启动就会用到锁和条件变量, 需先初始化
+    if (pthread_mutex_init(&mMutex, NULL) != 0)
     {
         return false;
     }
-
-    if (pthread_mutex_init(&mMutex, NULL) != 0)
+    if (pthread_cond_init(&mCond, NULL) != 0)
     {
         return false;
     }
-    if (pthread_cond_init(&mCond, NULL) != 0)
+
+    if(pthread_create(&mTid, NULL, Log::_logProc, (void *)this) != 0)
     {
         return false;
     }
@@ -70,7 +71,10 @@ void Log::finalise()
     if (!mInited)
         return;
 
+    // 持锁置位, 否则日志线程可能在检查mbExit之后才进入等待, 错过这次唤醒
+    THREAD_MUTEX_LOCK(mMutex);
     mbExit = true;
+    THREAD_MUTEX_UNLOCK(mMutex);
     THREAD_SINGNAL_SET(mCond);
 #if PLATFORM == PLATFORM_WIN32
     ::WaitForSingleObject(mTid, INFINITE);
@@ -0,0 +1,284 @@
+#include "async_disk_cache.h"
+
+NAMESPACE_BEG(proxy)
+
+ChunkPool gSpillBufPool("spill buffer", SPILL_BLOCK_SIZE, SPILL_BUF_POOL_MAX_FREE);
+
+AsyncDiskCache::~AsyncDiskCache()
+{
+    clear();
+}
+
+ssize_t AsyncDiskCache::write(const void *data, size_t datalen)
+{
+    assert(data && datalen > 0);
+
+    // 先分配好所需的块, 失败时整条不写, 由Cache改存内存
+    size_t room = mBlocks.empty() ? 0 : SPILL_BLOCK_SIZE - mBlocks.back()->len;
+    size_t count = mBlocks.size();
+    for (; room < datalen; room += SPILL_BLOCK_SIZE)
+    {
+        char *buf = _allocBuf();
+        Block *b = buf ? new Block() : NULL;
+        if (NULL == b)
+        {
+            _releaseBuf(buf);
+            while (mBlocks.size() > count)
+            {
+                _releaseBuf(mBlocks.back()->buf);
+                delete mBlocks.back();
+                mBlocks.pop_back();
+            }
+            return -1;
+        }
+
+        b->off = -1;
+        b->buf = buf;
+        b->len = 0;
+        b->rpos = 0;
+        b->job = NULL;
+        b->onDisk = false;
+        b->cached = false;
+        mBlocks.push_back(b);
+    }
+
+    // 从原来的最后一块(未写满时)开始写
+    const char *ptr = (const char *)data;
+    size_t left = datalen;
+    size_t i = (count > 0 && mBlocks[count - 1]->len < SPILL_BLOCK_SIZE) ? count - 1 : count;
+    for (; left > 0; ++i)
+    {
+        Block *b = mBlocks[i];
+        size_t n = min(left, SPILL_BLOCK_SIZE - b->len);
+        memcpy(b->buf + b->len, ptr, n);
+        b->len += n;
+        ptr += n;
+        left -= n;
+
+        if (b->len == SPILL_BLOCK_SIZE)
+            _flushBlock(b);
+    }
+
+    return datalen;
+}
+
+size_t AsyncDiskCache::front(const void **data, int *fd, off_t *off)
+{
+    if (mBlocks.empty())
+        return 0;
+
+    bool toFile = fd != NULL;
+    Block *b = mBlocks.front();
+    if (NULL == b->buf && NULL == b->job)
+    {
+        if (!toFile)
+            _loadBlock(b);
+        else if (!b->cached)
+            _prefetchBlock(b);
+    }
+    _readAhead(toFile);
+
+    if (b->buf)
+    {
+        *data = b->buf + b->rpos;
+        return b->len - b->rpos;
+    }
+
+    if (toFile && b->cached)
+    {
+        *data = NULL;
+        *fd = gSpillStore.getFd();
+        *off = b->off + b->rpos;
+        return b->len - b->rpos;
+    }
+
+    mbWaiting = true;
+    return 0;
+}
+
+void AsyncDiskCache::consume(size_t n)
+{
+    if (mBlocks.empty())
+        return;
+
+    Block *b = mBlocks.front();
+    b->rpos = min(b->rpos + n, b->len);
+
+    // 读完的块(包括未写满的最后一块)立即释放, 空闲的隧道不占缓冲
+    while (!mBlocks.empty() && mBlocks.front()->rpos == mBlocks.front()->len)
+    {
+        b = mBlocks.front();
+        mBlocks.pop_front();
+        _freeBlock(b);
+    }
+}
+
+void AsyncDiskCache::clear()
+{
+    BlockList::iterator it = mBlocks.begin();
+    for (; it != mBlocks.end(); ++it)
+    {
+        _freeBlock(*it);
+    }
+    mBlocks.clear();
+    mbWaiting = false;
+}
+
+void AsyncDiskCache::onSpillDone(SpillJob *job)
+{
+    _onJobDone(job);
+
+    if (mbWaiting && !mBlocks.empty() && (mBlocks.front()->buf || mBlocks.front()->cached))
+    {
+        mbWaiting = false;
+        if (mHandler)
+            mHandler->onSpillReady();
+    }
+}
+
+void AsyncDiskCache::_flushBlock(Block *b)
+{
+    b->off = gSpillStore.allocExtent();
+    if (b->off < 0)
+        return; // 留在内存中
+
+    SpillJob *job = new SpillJob(SpillJob::Type_Write, gSpillStore.getFd(), b->off, b->buf, b->len);
+    job->pool = &gSpillBufPool;
+    job->handler = this;
+    job->context = b;
+    b->job = job;
+
+    if (!gSpillIo.submit(job))
+        _onJobDone(job);
+}
+
+void AsyncDiskCache::_loadBlock(Block *b)
+{
+    char *buf = _allocBuf();
+    if (NULL == buf)
+        return;
+
+    SpillJob *job = new SpillJob(SpillJob::Type_Read, gSpillStore.getFd(), b->off, buf, b->len);
+    job->pool = &gSpillBufPool;
+    job->handler = this;
+    job->context = b;
+    b->job = job;
+
+    if (!gSpillIo.submit(job))
+        _onJobDone(job);
+}
+
+void AsyncDiskCache::_prefetchBlock(Block *b)
+{
+    SpillJob *job = new SpillJob(SpillJob::Type_Prefetch, gSpillStore.getFd(), b->off, NULL, b->len);
+    job->handler = this;
+    job->context = b;
+    b->job = job;
+
+    if (!gSpillIo.submit(job))
+        _onJobDone(job);
+}
+
+void AsyncDiskCache::_readAhead(bool toFile)
+{
+    BlockList::iterator it = mBlocks.begin();
+    for (int i = 0; i < SPILL_READ_AHEAD && it != mBlocks.end(); ++i, ++it)
+    {
+        Block *b = *it;
+        if (b->buf || b->job)
+            continue;
+
+        if (!toFile)
+        {
+            // 首块之后的读回只在预算有余时进行
+            if (it != mBlocks.begin() && !gMemoryBudget.hasRoom(SPILL_BLOCK_SIZE))
+                break;
+            _loadBlock(b);
+        }
+        else if (!b->cached)
+            _prefetchBlock(b);
+    }
+}
+
+void AsyncDiskCache::_freeBlock(Block *b)
+{
+    // 区段可立即复用, 其上进行中的请求先于新主人的请求执行
+    if (b->off >= 0)
+        gSpillStore.freeExtent(b->off);
+
+    if (b->job)
+    {
+        // 写请求与块共用buf, 读请求的buf尚未交给块, 都由请求归还池中, 这里只退还预算
+        b->job->handler = NULL;
+        if (b->job->buf)
+            gMemoryBudget.uncharge(SPILL_BLOCK_SIZE);
+    }
+    else
+    {
+        _releaseBuf(b->buf);
+    }
+    delete b;
+}
+
+char *AsyncDiskCache::_allocBuf()
+{
+    char *buf = gSpillBufPool.allocChunk();
+    if (buf)
+        gMemoryBudget.charge(NULL, SPILL_BLOCK_SIZE);
+    return buf;
+}
+
+void AsyncDiskCache::_releaseBuf(char *buf)
+{
+    if (NULL == buf)
+        return;
+
+    gSpillBufPool.freeChunk(buf);
+    gMemoryBudget.uncharge(SPILL_BLOCK_SIZE);
+}
+
+void AsyncDiskCache::_onJobDone(SpillJob *job)
+{
+    Block *b = (Block *)job->context;
+    b->job = NULL;
+
+    if (SpillJob::Type_Write == job->type)
+    {
+        if (job->result != (ssize_t)job->len)
+        {
+            // 数据仍在内存中, 缓冲继续计入预算
+            ErrorPrint("[AsyncDiskCache] write spill failed! %s", job->result < 0 ? strerror(-job->result) : "short write");
+        }
+        else
+        {
+            // 落盘后即归还缓冲, 读到时再读回或预读进页缓存
+            b->onDisk = true;
+            _releaseBuf(b->buf);
+            b->buf = NULL;
+        }
+    }
+    else if (SpillJob::Type_Read == job->type)
+    {
+        if (job->result != (ssize_t)job->len)
+        {
+            // 下次front()时重读
+            ErrorPrint("[AsyncDiskCache] read spill failed! %s", job->result < 0 ? strerror(-job->result) : "short read");
+            _releaseBuf(job->buf);
+        }
+        else
+        {
+            b->buf = job->buf;
+        }
+    }
+    else if (SpillJob::Type_Prefetch == job->type)
+    {
+        // 预读失败不影响数据, 由sendfile自行读盘
+        if (job->result < 0)
+            WarningPrint("[AsyncDiskCache] prefetch spill failed! %s", strerror(-job->result));
+        b->cached = true;
+    }
+
+    delete job;
+}
+
+NAMESPACE_END // namespace proxy
@@ -0,0 +1,95 @@
+#ifndef __ASYNC_DISK_CACHE_H__
+#define __ASYNC_DISK_CACHE_H__
+
+#include "proxy_common.h"
+#include "disk_cache.h"
+#include "spill_io.h"
+#include "spill_store.h"
+#include "memory_budget.h"
+#include "chunk_pool.h"
+
+NAMESPACE_BEG(proxy)
+
+#define SPILL_BLOCK_SIZE SPILL_EXTENT_SIZE // 溢出文件的读写单位, 每块占用一个区段
+#define SPILL_READ_AHEAD 4         // 预读的块数
+#define SPILL_BUF_POOL_MAX_FREE 64 // gSpillBufPool中最多保留的空闲缓冲数
+
+/*
+ * 经I/O线程(gSpillIo)读写溢出文件的DiskCache后端, 事件循环不会阻塞在磁盘上
+ * 溢出文件为进程共用的gSpillStore, 块写满后才从中分配区段, 读完即归还
+ * 数据按块写入, 块写满后提交写请求, 写完前仍可从内存中读出, 写完即归还缓冲
+ * 块的缓冲取自gSpillBufPool, 在内存中期间(未写满, 写盘中, 已读回或写盘失败)按整块计入gMemoryBudget
+ * 读到已落盘的块时提交读请求(并预读其后几块), front()暂时返回0,
+ * 读完后通过SpillEventHandler::onSpillReady()通知继续flush
+ * 调用方能用sendfile发送时, 已落盘的块不再读回内存, 只由I/O线程预读进页缓存,
+ * 之后以文件区间给出, 事件循环中的sendfile不会因读盘而阻塞
+ */
+class AsyncDiskCache : public SpillIo::Handler
+{
+  public:
+    AsyncDiskCache()
+            :mHandler(NULL)
+            ,mBlocks()
+            ,mbWaiting(false)
+    {}
+
+    virtual ~AsyncDiskCache();
+
+    ssize_t write(const void *data, size_t datalen);
+
+    // 取出待发送的连续数据, 在consume()前一直有效
+    // 没有数据或正等待磁盘读时返回0, 后者读完后回调onSpillReady()
+    // 传入fd/off时, 已预读的落盘块以文件区间给出, *data置NULL
+    size_t front(const void **data, int *fd = NULL, off_t *off = NULL);
+    // 已发送front()返回数据的前n字节
+    void consume(size_t n);
+
+    void clear();
+
+    inline void setEventHandler(SpillEventHandler *h)
+    {
+        mHandler = h;
+    }
+
+    // SpillIo::Handler
+    virtual void onSpillDone(SpillJob *job);
+
+  private:
+    struct Block
+    {
+        off_t off;   // 在gSpillStore中的区段, 未落盘时为-1
+        char *buf;   // 为NULL时数据只在磁盘上
+        size_t len;
+        size_t rpos;
+        SpillJob *job; // 进行中的读/写/预读
+        bool onDisk;
+        bool cached;   // 已预读进页缓存, 可直接sendfile
+    };
+
+    typedef std::deque<Block *> BlockList;
+
+    void _flushBlock(Block *b);
+    void _loadBlock(Block *b);
+    void _prefetchBlock(Block *b);
+    // toFile为true时只预读进页缓存, 不读回内存
+    void _readAhead(bool toFile);
+    // 从gSpillBufPool取/还一个块的缓冲, 同时计入/退还预算
+    char *_allocBuf();
+    void _releaseBuf(char *buf);
+    // 放弃块并归还区段, 进行中的请求完成后由SpillIo释放其内存
+    void _freeBlock(Block *b);
+    void _onJobDone(SpillJob *job);
+
+  private:
+    SpillEventHandler *mHandler;
+
+    BlockList mBlocks; // 按写入顺序, 只有最后一块可写
+
+    bool mbWaiting; // front()因等待读盘返回过0
+};
+
+extern ChunkPool gSpillBufPool;
+
+NAMESPACE_END // namespace proxy
+
+#endif // __ASYNC_DISK_CACHE_H__
@@ -3,31 +3,55 @@
 
 #include "proxy_common.h"
 #include "disk_cache.h"
+#include "mmap_cache.h"
+#include "async_disk_cache.h"
+#include "memory_budget.h"
+#include "chunk_pool.h"
+
+#include <sys/uio.h>
 
 NAMESPACE_BEG(proxy)
 
-template <class T, int MAX_LEN_CACHE_IN_MEM = 256*1024>
-class Cache
+#define CACHE_IOV_MAX   64          // flushAll()一次交给宿主的最多块数
+#define CACHE_MIN_SPILL (64*1024)   // 内存中的数据少于此时不为预算溢出, 溢出后端自身的写缓冲就有这么大
+
+/*
+ * 超过内存上限的数据溢出到SPILL中, SPILL为DiskCache, MmapDiskCache或AsyncDiskCache
+ * 内存中的数据同时受全局预算gMemoryBudget约束: 预算紧张时最久未flush的Cache先溢出,
+ * 全局空闲时允许超出MAX_LEN_CACHE_IN_MEM
+ * 内存中的数据依次追加到gChunkPool的定长块中, 小块写入合并在同一块里;
+ * 提供vecFunc时flushAll()把多个块一次交给宿主(如writev)
+ * 提供fileFunc时, 溢出文件中的数据以(fd, off, len)交给宿主直接sendfile
+ *
+ * 宿主只取走当前能发送的部分(如socket可写的量), 其余数据(含溢出的)留在原处,
+ * 宿主在可写后再次flushAll()从断点继续
+ */
+template <class T, int MAX_LEN_CACHE_IN_MEM = 256*1024, class SPILL = DiskCache>
+class Cache : public MemoryBudget::Handler, public SpillEventHandler
 {
-    typedef bool (T::*FuncType)(const void *, size_t);
+    // 各回调返回宿主取走的字节数, 0表示暂不可写
+    typedef ssize_t (T::*FuncType)(const void *, size_t);
+    typedef ssize_t (T::*VecFuncType)(const struct iovec *, int);
+    // 返回<0表示不能sendfile, 改从内存发送
+    typedef ssize_t (T::*FileFuncType)(int, off_t, size_t);
   public:
-    Cache(T *host, FuncType func)
+    Cache(T *host, FuncType func, FileFuncType fileFunc = NULL, VecFuncType vecFunc = NULL)
             :mHost(host)
             ,mFunc(func)
-            ,mCachedList()
+            ,mFileFunc(fileFunc)
+            ,mVecFunc(vecFunc)
+            ,mChunks()
             ,mDiskCache()
             ,mLenCacheInMem(0)
             ,mLenCacheInFile(0)
-    {}
+            ,mClearSeq(0)
+    {
+        mDiskCache.setEventHandler(this);
+    }
 
     virtual ~Cache()
     {
-        typename DataList::iterator it = this->mCachedList.begin();
-        for (; it != this->mCachedList.end(); ++it)
-        {
-            free((*it).data);
-        }
-        this->mCachedList.clear();
+        clear();
     }
 
     bool empty() const
@@ -35,103 +59,238 @@ class Cache
         return 0 == mLenCacheInMem && 0 == mLenCacheInFile;
     }
 
-    void cache(const void *data, size_t len)
+    // 返回false表示磁盘上已有数据而溢出文件写入失败, 新数据不能越过它们放进内存,
+    // 数据流已不完整, 宿主应放弃该数据流
+    bool cache(const void *data, size_t len)
     {
         assert(len > 0 && "cache() && len>0");
 
         // cache in file
-        if (mLenCacheInMem+len > MAX_LEN_CACHE_IN_MEM || mLenCacheInFile > 0)
+        // 磁盘上已有数据时新数据只能排在其后
+        bool toFile = mLenCacheInFile > 0 ||
+                      (mLenCacheInMem+len > MAX_LEN_CACHE_IN_MEM && !gMemoryBudget.canBurst(len)) ||
+                      !gMemoryBudget.tryCharge(this, len);
+        if (toFile)
         {
             int ret = mDiskCache.write(data, len);
             if (ret == (int)len)
             {
                 mLenCacheInFile += len;
-                return;
+                return true;
             }
 
             ErrorPrint("Cache::cache() write to file failed! return code:%d", ret);
+            if (mLenCacheInFile > 0)
+            {
+                return false;
+            }
+            gMemoryBudget.charge(this, len);
         }
 
         // cache in mem
-        Data d;
         mLenCacheInMem += len;
-        d.len = len;
-        d.data = (char *)malloc(len);
-        assert(d.data != NULL && "cache() malloc failed");
-        memcpy(d.data, data, len);
-        this->mCachedList.push_back(d);
+        _append(data, len);
+        return true;
     }
 
     void clear()
     {
-        typename DataList::iterator it = this->mCachedList.begin();
-        for (; it != this->mCachedList.end(); ++it)
-        {
-            free((*it).data);
-        }
-        this->mCachedList.clear();
+        ++mClearSeq;
+        _freeChunks();
 
         mDiskCache.clear();
+        gMemoryBudget.uncharge(mLenCacheInMem);
+        gMemoryBudget.detach(this);
+        mLenCacheInMem = 0;
+        mLenCacheInFile = 0;
     }
 
     bool flushAll()
     {
-        typename DataList::iterator it = this->mCachedList.begin();
-        for (; it != this->mCachedList.end(); )
+        gMemoryBudget.touch(this);
+
+        // 宿主在回调中可能出错而clear(), 之后不能再访问已释放的数据
+        uint32 seq = mClearSeq;
+        int maxcnt = mVecFunc ? CACHE_IOV_MAX : 1;
+        while (!mChunks.empty())
         {
-            if ((mHost->*mFunc)((*it).data, (*it).len))
+            struct iovec iov[CACHE_IOV_MAX];
+            int cnt = 0;
+            size_t len = 0;
+            typename ChunkList::iterator it = mChunks.begin();
+            for (; it != mChunks.end() && cnt < maxcnt; ++it, ++cnt)
             {
-                mLenCacheInMem -= (*it).len;
-                free((*it).data);
-                mCachedList.erase(it++);
+                iov[cnt].iov_base = (*it).buf + (*it).rpos;
+                iov[cnt].iov_len = (*it).len - (*it).rpos;
+                len += iov[cnt].iov_len;
             }
-            else
+
+            ssize_t n = mVecFunc ? (mHost->*mVecFunc)(iov, cnt)
+                                 : (mHost->*mFunc)(iov[0].iov_base, iov[0].iov_len);
+            if (n <= 0 || seq != mClearSeq)
+            {
+                return false;
+            }
+
+            _consumeChunks(n);
+            mLenCacheInMem -= n;
+            gMemoryBudget.uncharge(n);
+
+            // 只取走一部分, 等可写后从断点继续
+            if ((size_t)n < len)
             {
                 return false;
             }
         }
+        gMemoryBudget.detach(this);
 
-        for (ssize_t sz = mDiskCache.peeksize(); sz > 0; sz = mDiskCache.peeksize())
+        // 溢出的数据直接从SPILL给出的内存或文件区间发送, 未取走的留在原处
+        bool useFile = mFileFunc != NULL;
+        const void *ptr = NULL;
+        int fd = -1;
+        off_t off = 0;
+        for (;;)
         {
-            char *ptr = (char *)malloc(sz);
-            if (NULL == ptr)
+            size_t sz = useFile ? mDiskCache.front(&ptr, &fd, &off) : mDiskCache.front(&ptr);
+            if (0 == sz)
+                break;
+
+            ssize_t n = ptr ? (mHost->*mFunc)(ptr, sz) : (mHost->*mFileFunc)(fd, off, sz);
+            if (seq != mClearSeq)
             {
-                ErrorPrint("malloc failed size=%lld", sz);
-                assert(false);
+                return false;
             }
-            assert(mDiskCache.read(ptr, sz) == sz);
-
-            if ((mHost->*mFunc)(ptr, sz))
+            if (n < 0 && NULL == ptr)
+            {
+                useFile = false;
+                continue;
+            }
+            if (n <= 0)
             {
-                mLenCacheInFile -= sz;
-                free(ptr);
+                return false;
             }
-            else
+
+            mDiskCache.consume(n);
+            mLenCacheInFile -= min(mLenCacheInFile, (size_t)n);
+
+            if ((size_t)n < sz)
             {
-                free(ptr);
-                mDiskCache.rollback(sz);
                 return false;
             }
         }
 
-        return true;
+        return mLenCacheInFile == 0;
+    }
+
+    // MemoryBudget::Handler
+    virtual size_t onSpill()
+    {
+        // 磁盘上已有数据时, 内存中的数据排在其前, 不能再追加到磁盘
+        // 数据太少时溢出后端占用的缓冲反而更多
+        if (mLenCacheInFile > 0 || mLenCacheInMem < CACHE_MIN_SPILL)
+            return 0;
+
+        // 全部写入成功才释放内存, 否则丢弃已写入的部分, 保持数据顺序
+        typename ChunkList::iterator it = mChunks.begin();
+        for (; it != mChunks.end(); ++it)
+        {
+            size_t len = (*it).len - (*it).rpos;
+            if (mDiskCache.write((*it).buf + (*it).rpos, len) != (ssize_t)len)
+            {
+                mDiskCache.clear();
+                return 0;
+            }
+        }
+        _freeChunks();
+
+        size_t spilled = mLenCacheInMem;
+        mLenCacheInFile = spilled;
+        mLenCacheInMem = 0;
+        gMemoryBudget.uncharge(spilled);
+        gMemoryBudget.detach(this);
+
+        return spilled;
+    }
+
+    // SpillEventHandler
+    virtual void onSpillReady()
+    {
+        flushAll();
+    }
+
+  private:
+    // 追加到最后一块, 写满再从池中取新块
+    void _append(const void *data, size_t len)
+    {
+        const char *ptr = (const char *)data;
+        while (len > 0)
+        {
+            if (mChunks.empty() || mChunks.back().len == CHUNK_SIZE)
+            {
+                Chunk c;
+                c.buf = gChunkPool.allocChunk();
+                assert(c.buf != NULL && "cache() alloc chunk failed");
+                c.rpos = c.len = 0;
+                mChunks.push_back(c);
+            }
+
+            Chunk &c = mChunks.back();
+            size_t n = min(len, (size_t)CHUNK_SIZE - c.len);
+            memcpy(c.buf + c.len, ptr, n);
+            c.len += n;
+            ptr += n;
+            len -= n;
+        }
+    }
+
+    // 宿主已取走前n字节, 释放取完的块
+    void _consumeChunks(size_t n)
+    {
+        while (n > 0 && !mChunks.empty())
+        {
+            Chunk &c = mChunks.front();
+            size_t left = c.len - c.rpos;
+            if (n < left)
+            {
+                c.rpos += n;
+                return;
+            }
+
+            n -= left;
+            gChunkPool.freeChunk(c.buf);
+            mChunks.pop_front();
+        }
+    }
+
+    void _freeChunks()
+    {
+        typename ChunkList::iterator it = mChunks.begin();
+        for (; it != mChunks.end(); ++it)
+        {
+            gChunkPool.freeChunk((*it).buf);
+        }
+        mChunks.clear();
     }
 
   private:
-    struct Data
+    struct Chunk
     {
+        char *buf;
+        size_t rpos; // 已被宿主取走的部分
         size_t len;
-        char *data;
     };
 
-    typedef std::list<Data> DataList;
+    typedef std::deque<Chunk> ChunkList;
 
     T *mHost;
     FuncType mFunc;
-    DataList mCachedList;
-    DiskCache mDiskCache;
+    FileFuncType mFileFunc;
+    VecFuncType mVecFunc;
+    ChunkList mChunks;
+    SPILL mDiskCache;
     size_t mLenCacheInMem;
     size_t mLenCacheInFile;
+    uint32 mClearSeq; // 每次clear()加1, 用于发现回调中的clear()
 };
 
 NAMESPACE_END // namespace proxy
@@ -0,0 +1,69 @@
+#include "chunk_pool.h"
+
+NAMESPACE_BEG(proxy)
+
+ChunkPool gChunkPool("chunk", CHUNK_SIZE, CHUNK_POOL_MAX_FREE);
+
+ChunkPool::~ChunkPool()
+{
+    trim();
+}
+
+char *ChunkPool::allocChunk()
+{
+    char *chunk = NULL;
+    if (mFreeList)
+    {
+        chunk = (char *)mFreeList;
+        mFreeList = mFreeList->next;
+        --mFreeCount;
+        ++mReuses;
+    }
+    else
+    {
+        chunk = (char *)malloc(mChunkSize);
+        if (NULL == chunk)
+            return NULL;
+        ++mAllocs;
+    }
+
+    ++mInUse;
+    return chunk;
+}
+
+void ChunkPool::freeChunk(char *chunk)
+{
+    if (NULL == chunk)
+        return;
+
+    --mInUse;
+    if (mFreeCount >= mMaxFree)
+    {
+        free(chunk);
+        return;
+    }
+
+    FreeChunk *fc = (FreeChunk *)chunk;
+    fc->next = mFreeList;
+    mFreeList = fc;
+    ++mFreeCount;
+}
+
+void ChunkPool::trim()
+{
+    while (mFreeList)
+    {
+        FreeChunk *fc = mFreeList;
+        mFreeList = fc->next;
+        free(fc);
+    }
+    mFreeCount = 0;
+}
+
+void ChunkPool::dumpStats() const
+{
+    InfoPrint("[stats] %s pool in_use=%u free=%u allocs=%llu reuses=%llu",
+              mName, (uint)mInUse, (uint)mFreeCount, mAllocs, mReuses);
+}
+
+NAMESPACE_END // namespace proxy
@@ -0,0 +1,69 @@
+#ifndef __CHUNK_POOL_H__
+#define __CHUNK_POOL_H__
+
+#include "proxy_common.h"
+
+NAMESPACE_BEG(proxy)
+
+#define CHUNK_SIZE          (16*1024) // 内存缓存的分配单位
+#define CHUNK_POOL_MAX_FREE 256       // 池中最多保留的空闲块数
+
+/*
+ * 进程内共用的定长内存块池: gChunkPool供Cache存放内存中的数据,
+ * gSpillBufPool(见async_disk_cache.h)供AsyncDiskCache作溢出块的读写缓冲
+ * 归还的块挂在空闲链表上复用, 超过上限的直接释放
+ * 只在事件循环中使用, 不加锁
+ */
+class ChunkPool
+{
+  public:
+    ChunkPool(const char *name, size_t chunkSize, size_t maxFree)
+            :mName(name)
+            ,mChunkSize(chunkSize)
+            ,mMaxFree(maxFree)
+            ,mFreeList(NULL)
+            ,mFreeCount(0)
+            ,mInUse(0)
+            ,mAllocs(0)
+            ,mReuses(0)
+    {}
+
+    virtual ~ChunkPool();
+
+    inline size_t getChunkSize() const
+    {
+        return mChunkSize;
+    }
+
+    // 取一个getChunkSize()大小的块, 失败返回NULL
+    char *allocChunk();
+    void freeChunk(char *chunk);
+
+    // 释放全部空闲块
+    void trim();
+
+    void dumpStats() const;
+
+  private:
+    struct FreeChunk
+    {
+        FreeChunk *next;
+    };
+
+    const char *mName;
+    size_t mChunkSize;
+    size_t mMaxFree;
+
+    FreeChunk *mFreeList;
+    size_t mFreeCount;
+    size_t mInUse;
+
+    uint64 mAllocs; // 向系统申请的次数
+    uint64 mReuses; // 从空闲链表复用的次数
+};
+
+extern ChunkPool gChunkPool;
+
+NAMESPACE_END // namespace proxy
+
+#endif // __CHUNK_POOL_H__
@@ -1,5 +1,9 @@
 #include "connection.h"
 
+#ifdef __linux__
+# include <sys/sendfile.h>
+#endif
+
 NAMESPACE_BEG(proxy)
 
 Connection::~Connection()
@@ -8,7 +12,7 @@ Connection::~Connection()
     free(mBuffer);
 }
 
-bool Connection::acceptConnection(int connfd)
+bool Connection::acceptConnection(int connfd, bool nonblocking)
 {
     if (mFd >= 0)
     {
@@ -19,7 +23,7 @@ bool Connection::acceptConnection(int connfd)
     mFd = connfd;
 
     // set nonblocking
-    if (!setNonblocking(mFd))
+    if (!nonblocking && !setNonblocking(mFd))
     {
         ErrorPrint("[acceptConnection] set nonblocking error! %s", strerror(errno));
         goto err_1;
@@ -118,7 +122,10 @@ void Connection::shutdown()
 
     TcpPacketList::iterator it = mTcpPacketList.begin();
     for (; it != mTcpPacketList.end(); ++it)
+    {
+        gMemoryBudget.uncharge((*it)->buflen);
         delete *it;
+    }
     mTcpPacketList.clear();
 }
 
@@ -157,6 +164,76 @@ void Connection::send(const void *data, size_t datalen)
     tryRegWriteEvent(); // 注册发送缓冲区可写事件
 }
 
+ssize_t Connection::trySend(const void *data, size_t datalen)
+{
+    ssize_t ret = 0;
+    if (!_prepareTrySend("trySend", &ret))
+        return ret;
+
+    return _finishTrySend(::send(mFd, data, datalen, 0), datalen);
+}
+
+ssize_t Connection::trySendv(const struct iovec *iov, int iovcnt)
+{
+    ssize_t ret = 0;
+    if (!_prepareTrySend("trySendv", &ret))
+        return ret;
+
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        total += iov[i].iov_len;
+    }
+
+    return _finishTrySend(::writev(mFd, iov, iovcnt), total);
+}
+
+ssize_t Connection::sendfile(int fd, off_t off, size_t len)
+{
+    ssize_t ret = 0;
+    if (!_prepareTrySend("sendfile", &ret))
+        return ret;
+
+#ifdef __linux__
+    ssize_t sentlen = ::sendfile(mFd, fd, &off, len);
+#else
+    ssize_t sentlen = pread(fd, mBuffer, min(len, (size_t)MAXLEN), off);
+    if (sentlen > 0)
+        sentlen = ::send(mFd, mBuffer, sentlen, 0);
+#endif
+    if (0 == sentlen && len > 0)
+    {
+        ErrorPrint("[sendfile] unexpected end of file! fd:%d off:%lld", fd, (long long)off);
+        return -1;
+    }
+
+    return _finishTrySend(sentlen, len);
+}
+
+bool Connection::setKeepAlive(int idle, int interval, int count)
+{
+    if (mFd < 0)
+        return false;
+
+    int on = 1;
+    if (setsockopt(mFd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) < 0)
+    {
+        WarningPrint("[setKeepAlive] set SO_KEEPALIVE error! %s", strerror(errno));
+        return false;
+    }
+
+#ifdef TCP_KEEPIDLE
+    if (idle > 0 && setsockopt(mFd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) < 0)
+        WarningPrint("[setKeepAlive] set TCP_KEEPIDLE error! %s", strerror(errno));
+    if (interval > 0 && setsockopt(mFd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval)) < 0)
+        WarningPrint("[setKeepAlive] set TCP_KEEPINTVL error! %s", strerror(errno));
+    if (count > 0 && setsockopt(mFd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count)) < 0)
+        WarningPrint("[setKeepAlive] set TCP_KEEPCNT error! %s", strerror(errno));
+#endif
+
+    return true;
+}
+
 bool Connection::getpeername(sockaddr *sa, socklen_t *salen) const
 {
     if (mFd < 0)
@@ -279,9 +356,15 @@ int Connection::handleOutputNotification(int fd)
     }
     else if (ConnStatus_Connected == mConnStatus)
     {
-        tryFlushRemainPacket();
-        if (checkSocketErrors())
+        if (!tryFlushRemainPacket())
+        {
+            checkSocketErrors();
             return 0;
+        }
+
+        tryUnregWriteEvent();
+        if (mHandler)
+            mHandler->onWritable(this);
     }
 
     return 0;
@@ -340,6 +423,7 @@ bool Connection::tryFlushRemainPacket()
 
         if (len == (size_t)sentlen)
         {
+            gMemoryBudget.uncharge(p->buflen);
             delete p;
             mTcpPacketList.erase(it++);
             continue;
@@ -367,6 +451,39 @@ void Connection::cachePacket(const void *data, size_t datalen)
     p->buflen = datalen;
     p->sentlen = 0;
     mTcpPacketList.push_back(p);
+
+    // 发送队列不能溢出到磁盘, 只计入全局用量, 促使各Cache先溢出
+    gMemoryBudget.charge(NULL, datalen);
+}
+
+bool Connection::_prepareTrySend(const char *func, ssize_t *ret)
+{
+    if (mFd < 0 || mConnStatus != ConnStatus_Connected)
+    {
+        ErrorPrint("[%s] can't send data in such status(%d)", func, mConnStatus);
+        *ret = -1;
+        return false;
+    }
+
+    if (!tryFlushRemainPacket())
+    {
+        *ret = checkSocketErrors() ? -1 : 0;
+        return false;
+    }
+
+    return true;
+}
+
+ssize_t Connection::_finishTrySend(ssize_t sentlen, size_t len)
+{
+    if ((size_t)sentlen == len)
+        return sentlen;
+
+    if (sentlen < 0 && checkSocketErrors())
+        return -1;
+
+    tryRegWriteEvent(); // 可写后回调onWritable()
+    return sentlen > 0 ? sentlen : 0;
 }
 
 bool Connection::checkSocketErrors()
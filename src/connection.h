@@ -3,6 +3,9 @@
 
 #include "proxy_common.h"
 #include "event_poller.h"
+#include "memory_budget.h"
+
+#include <sys/uio.h>
 
 NAMESPACE_BEG(proxy)
 
@@ -19,6 +22,9 @@ class Connection : public InputNotificationHandler, public OutputNotificationHan
 
         virtual void onRecv(Connection *pConn, const void *data, size_t datalen) = 0;
         virtual void onError(Connection *pConn) {}
+
+        // 发送队列已清空且仍可写, 可继续发送(如sendfile未发完的数据)
+        virtual void onWritable(Connection *pConn) {}
     };
 
     enum EConnStatus
@@ -48,7 +54,8 @@ class Connection : public InputNotificationHandler, public OutputNotificationHan
 
     virtual ~Connection();
 
-    bool acceptConnection(int connfd);
+    // nonblocking为true表示connfd已是非阻塞的(如accept4接入), 不再重复设置
+    bool acceptConnection(int connfd, bool nonblocking = false);
     bool connect(const char *ip, int port);
     bool connect(const sockaddr *sa, socklen_t salen);
 
@@ -56,6 +63,19 @@ class Connection : public InputNotificationHandler, public OutputNotificationHan
 
     void send(const void *data, size_t datalen);
 
+    /*
+     * 只发送socket当前能接收的部分, 其余不排队, 由调用方留在原处
+     * 发送队列中还有数据时不发送, 保持数据顺序
+     * return 已发送的字节数, 发不完时注册可写事件, 可写后回调onWritable()
+     *        0  暂不可写
+     *        -1 出错, 连接出错时已回调onError()
+     */
+    ssize_t trySend(const void *data, size_t datalen);
+    // 一次writev发送多段数据
+    ssize_t trySendv(const struct iovec *iov, int iovcnt);
+    // 把文件fd中[off, off+len)的数据直接发送出去(sendfile), 不经过用户态内存
+    ssize_t sendfile(int fd, off_t off, size_t len);
+
     inline void setEventHandler(Handler *h)
     {
         mHandler = h;
@@ -66,6 +86,17 @@ class Connection : public InputNotificationHandler, public OutputNotificationHan
         return mConnStatus == ConnStatus_Connected;
     }
 
+    // 发送队列中还有未发出的数据
+    inline bool hasPendingData() const
+    {
+        return !mTcpPacketList.empty();
+    }
+
+    /*
+     * 开启TCP保活, idle/interval为秒, 为0的参数保持系统默认值
+     */
+    bool setKeepAlive(int idle, int interval, int count);
+
     bool getpeername(sockaddr *sa, socklen_t *salen) const;
     bool gethostname(sockaddr *sa, socklen_t *salen) const;
 
@@ -85,6 +116,11 @@ class Connection : public InputNotificationHandler, public OutputNotificationHan
     bool tryFlushRemainPacket();
     void cachePacket(const void *data, size_t datalen);
 
+    // trySend系列: 发送前检查状态并先发完队列, 返回false时ret为应返回的值
+    bool _prepareTrySend(const char *func, ssize_t *ret);
+    // trySend系列: 处理发送结果, 发不完时注册可写事件
+    ssize_t _finishTrySend(ssize_t sentlen, size_t len);
+
     bool checkSocketErrors();
     EReason _checkSocketErrors();
 
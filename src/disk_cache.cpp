@@ -1,86 +1,234 @@
 #include "disk_cache.h"
 
+#include <sys/uio.h>
+
 NAMESPACE_BEG(proxy)
 
+#define DISK_CACHE_HEADER sizeof(size_t)
+
 DiskCache::~DiskCache()
 {
-    if (mpFile)
-        fclose(mpFile);
+    clear();
 }
 
 ssize_t DiskCache::write(const void *data, size_t datalen)
 {
     assert(data && datalen > 0);
-    if (NULL == mpFile)
-        _createFile();
-    if (NULL == mpFile)
-        return -1;
-
-    long curpos = ftell(mpFile);
-    if (curpos < 0)
-        return -10;
-    if (fseek(mpFile, 0, SEEK_END) < 0)
-        return -11;
-
-    if (fwrite(&datalen, 1, sizeof(datalen), mpFile) != sizeof(datalen))
+
+    if (NULL == mWriteBuf)
+    {
+        mWriteBuf = (char *)malloc(DISK_CACHE_WRITE_BUF);
+        if (NULL == mWriteBuf)
+            return -1;
+    }
+
+    size_t reclen = DISK_CACHE_HEADER + datalen;
+    if (mWriteLen + reclen > DISK_CACHE_WRITE_BUF && !_flushWriteBuf())
         return -2;
-    if (fwrite(data, 1, datalen, mpFile) != datalen)
-        return -3;
 
-    fseek(mpFile, curpos, SEEK_SET);
+    // 大记录不经过缓冲区, 长度头和数据一次写入
+    if (reclen > DISK_CACHE_WRITE_BUF)
+    {
+        if (mFd < 0 && !_createFile())
+            return -1;
+
+        struct iovec iov[2];
+        iov[0].iov_base = &datalen;
+        iov[0].iov_len = DISK_CACHE_HEADER;
+        iov[1].iov_base = (void *)data;
+        iov[1].iov_len = datalen;
+
+        if (pwritev(mFd, iov, 2, mFileEnd) != (ssize_t)reclen)
+            return -3;
+
+        mFileEnd += reclen;
+        return datalen;
+    }
+
+    memcpy(mWriteBuf + mWriteLen, &datalen, DISK_CACHE_HEADER);
+    memcpy(mWriteBuf + mWriteLen + DISK_CACHE_HEADER, data, datalen);
+    mWriteLen += reclen;
+
     return datalen;
 }
 
-ssize_t DiskCache::read(void *data, size_t datalen)
+ssize_t DiskCache::_read(void *data, size_t datalen)
 {
-    if (NULL == mpFile)
-        return 0;
-
-    size_t peeksz = peeksize();
+    size_t peeksz = _peeksize();
     if (0 == peeksz)
         return 0;
     if (datalen < peeksz)
         return -2;
 
-    fseek(mpFile, sizeof(peeksz), SEEK_CUR);
-    return fread(data, 1, peeksz, mpFile);
+    off_t off = mReadOff + DISK_CACHE_HEADER;
+    if (off >= mFileEnd)
+    {
+        memcpy(data, mWriteBuf + (off - mFileEnd), peeksz);
+        mReadOff = off + peeksz;
+        mPeekLen = 0;
+        return peeksz;
+    }
+
+    // 顺带读出下一条记录的长度头, 省掉下次_peeksize()的pread
+    size_t nextsz = 0;
+    struct iovec iov[2];
+    iov[0].iov_base = data;
+    iov[0].iov_len = peeksz;
+    iov[1].iov_base = &nextsz;
+    iov[1].iov_len = (off + (off_t)(peeksz + DISK_CACHE_HEADER) <= mFileEnd) ? DISK_CACHE_HEADER : 0;
+
+    ssize_t n = preadv(mFd, iov, iov[1].iov_len > 0 ? 2 : 1, off);
+    if (n < (ssize_t)peeksz)
+        return -3;
+
+    mReadOff = off + peeksz;
+    mPeekLen = (n == (ssize_t)(peeksz + DISK_CACHE_HEADER)) ? nextsz : 0;
+
+#ifdef FALLOC_FL_PUNCH_HOLE
+    // 长期读不完时, 释放已读部分占用的磁盘空间, 偏移不变
+    // 刚读出的记录已在front()的缓冲区中, 一并释放
+    off_t start = mReadOff;
+    if (start - mPunchOff >= DISK_CACHE_PUNCH_SIZE)
+    {
+        off_t end = start & ~(off_t)(DISK_CACHE_PUNCH_SIZE - 1);
+        if (end > mPunchOff &&
+            fallocate(mFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, mPunchOff, end - mPunchOff) == 0)
+        {
+            mPunchOff = end;
+        }
+    }
+#endif
+
+    return peeksz;
 }
 
-size_t DiskCache::peeksize()
+size_t DiskCache::_peeksize()
 {
-    if (NULL == mpFile)
+    if (mPeekLen > 0)
+        return mPeekLen;
+
+    if (mReadOff >= mFileEnd + (off_t)mWriteLen)
+    {
+        _compact();
         return 0;
+    }
 
     size_t peeksz = 0;
-    if (fread(&peeksz, 1, sizeof(peeksz), mpFile) != sizeof(peeksz))
+    if (mReadOff >= mFileEnd)
+    {
+        memcpy(&peeksz, mWriteBuf + (mReadOff - mFileEnd), DISK_CACHE_HEADER);
+    }
+    else if (pread(mFd, &peeksz, DISK_CACHE_HEADER, mReadOff) != (ssize_t)DISK_CACHE_HEADER)
+    {
         return 0;
+    }
 
-    fseek(mpFile, -sizeof(peeksz), SEEK_CUR);
+    mPeekLen = peeksz;
     return peeksz;
 }
 
-void DiskCache::rollback(size_t n)
+size_t DiskCache::front(const void **data, int *fd, off_t *off)
 {
-    if (mpFile)
-        fseek(mpFile, -(n+sizeof(size_t)), SEEK_CUR);
+    if (mFrontPos >= mFrontLen)
+    {
+        size_t sz = _peeksize();
+        if (0 == sz)
+            return 0;
+
+        if (sz > mFrontCap)
+        {
+            char *buf = (char *)realloc(mFrontBuf, sz);
+            if (NULL == buf)
+                return 0;
+            mFrontBuf = buf;
+            mFrontCap = sz;
+        }
+
+        ssize_t n = _read(mFrontBuf, sz);
+        if (n != (ssize_t)sz)
+        {
+            ErrorPrint("[DiskCache::front] read failed! return code:%d", (int)n);
+            return 0;
+        }
+        mFrontLen = sz;
+        mFrontPos = 0;
+    }
+
+    *data = mFrontBuf + mFrontPos;
+    return mFrontLen - mFrontPos;
+}
+
+void DiskCache::consume(size_t n)
+{
+    mFrontPos += n;
+    if (mFrontPos > mFrontLen)
+        mFrontPos = mFrontLen;
 }
 
 void DiskCache::clear()
 {
-    if (mpFile)
+    if (mFd >= 0)
+    {
+        close(mFd);
+        mFd = -1;
+    }
+
+    if (mWriteBuf)
+    {
+        free(mWriteBuf);
+        mWriteBuf = NULL;
+    }
+
+    if (mFrontBuf)
     {
-        fclose(mpFile);
-        mpFile = NULL;
+        free(mFrontBuf);
+        mFrontBuf = NULL;
     }
+    mFrontCap = mFrontLen = mFrontPos = 0;
+
+    mReadOff = mFileEnd = mPunchOff = 0;
+    mPeekLen = 0;
+    mWriteLen = 0;
 }
 
 bool DiskCache::_createFile()
 {
-    if (mpFile)
-        fclose(mpFile);
+    mFd = createTempFile(SPILL_FILE_PREFIX);
+    return mFd >= 0;
+}
+
+bool DiskCache::_flushWriteBuf()
+{
+    if (0 == mWriteLen)
+        return true;
+
+    if (mFd < 0 && !_createFile())
+        return false;
+
+    if (pwrite(mFd, mWriteBuf, mWriteLen, mFileEnd) != (ssize_t)mWriteLen)
+    {
+        ErrorPrint("[DiskCache::_flushWriteBuf] pwrite failed! %s", strerror(errno));
+        return false;
+    }
+
+    mFileEnd += mWriteLen;
+    mWriteLen = 0;
+    return true;
+}
+
+void DiskCache::_compact()
+{
+    if (mReadOff < mFileEnd + (off_t)mWriteLen)
+        return;
+
+    if (mFileEnd > 0 && ftruncate(mFd, 0) < 0)
+    {
+        WarningPrint("[DiskCache::_compact] ftruncate failed! %s", strerror(errno));
+    }
 
-    mpFile = tmpfile();
-    return mpFile != NULL;
+    mReadOff = mFileEnd = mPunchOff = 0;
+    mPeekLen = 0;
+    mWriteLen = 0;
 }
 
 NAMESPACE_END // namespace proxy
@@ -5,28 +5,90 @@
 
 NAMESPACE_BEG(proxy)
 
+#define DISK_CACHE_WRITE_BUF  (64*1024)       // 合并写入的缓冲区大小
+#define DISK_CACHE_PUNCH_SIZE (4*1024*1024)   // 已读部分超过该大小时释放其磁盘空间
+#define SPILL_FILE_PREFIX     "http-proxy-spill-"
+
+// 溢出后端通知Cache: 之前因等待读盘而中断的flush可以继续了
+class SpillEventHandler
+{
+  public:
+    SpillEventHandler() {}
+
+    virtual void onSpillReady() = 0;
+};
+
+/*
+ * 只追加的溢出日志: 每条记录为"长度头+数据"
+ * 读写位置自行维护, 以pread/pwrite访问, 不经过stdio缓冲
+ * 新记录先积攒在写缓冲区中, 满了才一次写入文件, 读到缓冲区时直接从内存取
+ * 全部读完后截断文件, 读写位置归零
+ *
+ * Cache通过front()/consume()取数据, 各溢出后端(见MmapDiskCache, AsyncDiskCache)都提供这组接口
+ * front()传入fd/off时, 后端可以给出溢出文件中的区间(*data置NULL)由调用方sendfile发送
+ */
 class DiskCache
 {
   public:
     DiskCache()
-            :mpFile(NULL)
+            :mFd(-1)
+            ,mReadOff(0)
+            ,mFileEnd(0)
+            ,mPunchOff(0)
+            ,mPeekLen(0)
+            ,mWriteBuf(NULL)
+            ,mWriteLen(0)
+            ,mFrontBuf(NULL)
+            ,mFrontCap(0)
+            ,mFrontLen(0)
+            ,mFrontPos(0)
     {}
 
     virtual ~DiskCache();
 
     ssize_t write(const void *data, size_t datalen);
-    ssize_t read(void *data, size_t datalen);
-    size_t peeksize();
 
-    void rollback(size_t n);
+    // 取出待发送的连续数据, 在consume()前一直有效, 没有数据时返回0
+    // 总是读到内存中给出, 不使用fd/off
+    size_t front(const void **data, int *fd = NULL, off_t *off = NULL);
+    // 已发送front()返回数据的前n字节
+    void consume(size_t n);
 
     void clear();
 
+    // 同步读写, 不会回调
+    inline void setEventHandler(SpillEventHandler *h)
+    {}
+
   private:
+    // 读出下一条完整记录, 供front()使用
+    ssize_t _read(void *data, size_t datalen);
+    // 下一条记录的长度, 没有数据时返回0
+    size_t _peeksize();
+
     bool _createFile();
+    bool _flushWriteBuf();
+    // 全部读完时截断文件
+    void _compact();
 
   private:
-    FILE *mpFile;
+    int mFd;
+
+    // 以下均为逻辑偏移, 写缓冲区中的数据紧接在mFileEnd之后
+    off_t mReadOff;  // 下一条记录的位置
+    off_t mFileEnd;  // 已写入文件的末尾
+    off_t mPunchOff; // 此前的磁盘空间已释放
+
+    size_t mPeekLen; // 已取到的下一条记录的长度, 0为未知
+
+    char *mWriteBuf;
+    size_t mWriteLen;
+
+    // front()读出的记录, 复用同一块内存
+    char *mFrontBuf;
+    size_t mFrontCap;
+    size_t mFrontLen;
+    size_t mFrontPos;
 };
 
 NAMESPACE_END // namespace proxy
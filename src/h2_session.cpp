@@ -0,0 +1,971 @@
+#include "h2_session.h"
+#include "hpack.h"
+
+NAMESPACE_BEG(proxy)
+
+static inline uint32 readUint32(const uint8 *p)
+{
+    return ((uint32)p[0] << 24) | ((uint32)p[1] << 16) | ((uint32)p[2] << 8) | (uint32)p[3];
+}
+
+static inline void writeUint32(uint8 *p, uint32 v)
+{
+    p[0] = (uint8)(v >> 24);
+    p[1] = (uint8)(v >> 16);
+    p[2] = (uint8)(v >> 8);
+    p[3] = (uint8)v;
+}
+
+//--------------------------------------------------------------------------
+H2Session::~H2Session()
+{
+    _closeSession(Error_NoError, false);
+}
+
+bool H2Session::connect(const sockaddr *sa, socklen_t salen)
+{
+    if (mStatus != SessionStatus_Closed)
+    {
+        ErrorPrint("[H2Session::connect] session already in use.");
+        return false;
+    }
+
+    mStatus = SessionStatus_Connecting;
+    mConn.setEventHandler(this);
+    if (!mConn.connect(sa, salen))
+    {
+        mConn.setEventHandler(NULL);
+        mStatus = SessionStatus_Closed;
+        return false;
+    }
+
+    return true;
+}
+
+void H2Session::close()
+{
+    _closeSession(Error_NoError, true);
+}
+
+bool H2Session::isUsable() const
+{
+    return mStatus != SessionStatus_Closed &&
+            !mbGoaway &&
+            mNextStreamId <= H2_MAX_STREAM_ID &&
+            mStreams.size() < min(mPeerMaxStreams, (uint32)H2_MAX_STREAMS);
+}
+
+uint32 H2Session::openStream(const char *authority, const char *authorization, StreamHandler *h)
+{
+    if (!isUsable())
+    {
+        return 0;
+    }
+
+    uint8 block[HTTP_HEADER_BLOCK_SIZE];
+    size_t n = 0;
+
+    if (strlen(authority) + (authorization ? strlen(authorization) : 0) + 32 > sizeof(block))
+    {
+        ErrorPrint("[H2Session::openStream] header too long.");
+        return 0;
+    }
+
+    n += hpackEncodeLiteral(block + n, HPACK_STATIC_METHOD, "CONNECT");
+    n += hpackEncodeLiteral(block + n, HPACK_STATIC_AUTHORITY, authority);
+    if (authorization)
+    {
+        n += hpackEncodeLiteral(block + n, HPACK_STATIC_PROXY_AUTH, authorization);
+    }
+
+    uint32 id = mNextStreamId;
+    mNextStreamId += 2;
+
+    _sendFrame(Frame_Headers, Flag_EndHeaders, id, block, n);
+    if (isClosed())
+    {
+        return 0;
+    }
+
+    Stream *s = new Stream();
+    assert(s && "new h2 stream failed.");
+    s->handler = h;
+    s->sendWindow = mPeerInitialWindow;
+    mStreams[id] = s;
+
+    return id;
+}
+
+ssize_t H2Session::sendData(uint32 id, const void *data, size_t datalen)
+{
+    struct iovec iov;
+    iov.iov_base = (void *)data;
+    iov.iov_len = datalen;
+    return sendData(id, &iov, 1);
+}
+
+ssize_t H2Session::sendData(uint32 id, const struct iovec *iov, int iovcnt)
+{
+    StreamMap::iterator it = mStreams.find(id);
+    if (it == mStreams.end())
+    {
+        return -1;
+    }
+
+    Stream *s = it->second;
+    if (s->localClosed || s->endPending)
+    {
+        return -1;
+    }
+
+    size_t datalen = 0;
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        datalen += iov[i].iov_len;
+    }
+
+    // 每帧发出前检查, 连接的发送队列中最多积压一帧
+    uint8 *payload = mFrameBuf + H2_FRAME_HEADER_SIZE;
+    size_t accepted = 0;
+    int idx = 0;
+    size_t off = 0;
+    while (accepted < datalen && _canSendData(s, datalen - accepted))
+    {
+        size_t n = min(datalen - accepted, (size_t)min(s->sendWindow, mConnSendWindow));
+        n = min(n, (size_t)min(mPeerMaxFrameSize, (uint32)H2_DEFAULT_FRAME_SIZE));
+
+        // 从各段依次拷入帧缓冲区
+        for (size_t filled = 0; filled < n; )
+        {
+            size_t m = min(n - filled, iov[idx].iov_len - off);
+            memcpy(payload + filled, (const char *)iov[idx].iov_base + off, m);
+            filled += m;
+            off += m;
+            if (off == iov[idx].iov_len)
+            {
+                ++idx;
+                off = 0;
+            }
+        }
+
+        s->sendWindow -= n;
+        mConnSendWindow -= n;
+        _sendFrame(Frame_Data, 0, id, payload, n);
+        if (isClosed())
+        {
+            // 会话已关闭, 流的出错回调中隧道可能已被回收
+            return -1;
+        }
+
+        accepted += n;
+    }
+
+    if (accepted < datalen)
+    {
+        s->blocked = true;
+    }
+
+    return (ssize_t)accepted;
+}
+
+void H2Session::queueData(uint32 id, const void *data, size_t datalen)
+{
+    StreamMap::iterator it = mStreams.find(id);
+    if (it == mStreams.end())
+    {
+        return;
+    }
+
+    Stream *s = it->second;
+    if (s->localClosed || s->endPending)
+    {
+        return;
+    }
+
+    const char *ptr = (const char *)data;
+    while (datalen > 0 && s->pending.empty() && s->sendWindow > 0 && mConnSendWindow > 0)
+    {
+        size_t n = min(datalen, (size_t)min(s->sendWindow, mConnSendWindow));
+        n = min(n, (size_t)min(mPeerMaxFrameSize, (uint32)H2_DEFAULT_FRAME_SIZE));
+
+        s->sendWindow -= n;
+        mConnSendWindow -= n;
+        _sendFrame(Frame_Data, 0, id, ptr, n);
+        if (isClosed())
+        {
+            return;
+        }
+
+        ptr += n;
+        datalen -= n;
+    }
+
+    if (datalen > 0) // 窗口不足, 等待WINDOW_UPDATE
+    {
+        s->pending.append(ptr, datalen);
+    }
+}
+
+void H2Session::closeStream(uint32 id)
+{
+    StreamMap::iterator it = mStreams.find(id);
+    if (it == mStreams.end())
+    {
+        return;
+    }
+
+    Stream *s = it->second;
+    s->handler = NULL;
+    s->endPending = true;
+    _flushStream(id, s);
+}
+
+void H2Session::resetStream(uint32 id)
+{
+    StreamMap::iterator it = mStreams.find(id);
+    if (it == mStreams.end())
+    {
+        return;
+    }
+
+    it->second->handler = NULL;
+    _sendRstStream(id, Error_Cancel);
+    if (isClosed())
+    {
+        return;
+    }
+
+    _eraseStream(id);
+}
+
+void H2Session::onConnected(Connection *pConn)
+{
+    mStatus = SessionStatus_Connected;
+    mConn.send(H2_PREFACE, sizeof(H2_PREFACE) - 1);
+
+    // 关闭服务端推送, 不使用动态表, 放大接收窗口
+    uint8 settings[18];
+    settings[0] = 0; settings[1] = Settings_HeaderTableSize;
+    writeUint32(settings + 2, 0);
+    settings[6] = 0; settings[7] = Settings_EnablePush;
+    writeUint32(settings + 8, 0);
+    settings[12] = 0; settings[13] = Settings_InitialWindowSize;
+    writeUint32(settings + 14, H2_STREAM_WINDOW);
+    _sendFrame(Frame_Settings, 0, 0, settings, sizeof(settings));
+    _sendWindowUpdate(0, H2_CONN_WINDOW - H2_DEFAULT_WINDOW);
+
+    if (!mPendingOut.empty() && !isClosed())
+    {
+        std::string out;
+        out.swap(mPendingOut);
+        mConn.send(out.data(), out.size());
+    }
+}
+
+void H2Session::onDisconnected(Connection *pConn)
+{
+    InfoPrint("[H2Session::onDisconnected] h2 session closed by proxy, %u stream(s) dropped.",
+              (uint)mStreams.size());
+    _closeSession(Error_NoError, false);
+}
+
+void H2Session::onRecv(Connection *pConn, const void *data, size_t datalen)
+{
+    mRecvBuf.append((const char *)data, datalen);
+
+    size_t off = 0;
+    while (!isClosed() && mRecvBuf.size() - off >= H2_FRAME_HEADER_SIZE)
+    {
+        const uint8 *hdr = (const uint8 *)mRecvBuf.data() + off;
+        size_t len = ((size_t)hdr[0] << 16) | ((size_t)hdr[1] << 8) | hdr[2];
+        uint8 type = hdr[3];
+        uint8 flags = hdr[4];
+        uint32 id = readUint32(hdr + 5) & H2_MAX_STREAM_ID;
+
+        if (len > H2_DEFAULT_FRAME_SIZE)
+        {
+            ErrorPrint("[H2Session::onRecv] frame too large(%u).", (uint)len);
+            _closeSession(Error_FrameSize, true);
+            return;
+        }
+        if (mRecvBuf.size() - off < H2_FRAME_HEADER_SIZE + len)
+        {
+            break;
+        }
+
+        off += H2_FRAME_HEADER_SIZE + len;
+        if (!_onFrame(type, flags, id, hdr + H2_FRAME_HEADER_SIZE, len))
+        {
+            ErrorPrint("[H2Session::onRecv] protocol error. frame type=%d stream=%u", type, id);
+            _closeSession(Error_Protocol, true);
+            return;
+        }
+    }
+
+    if (!isClosed())
+    {
+        mRecvBuf.erase(0, off);
+    }
+}
+
+void H2Session::onError(Connection *pConn)
+{
+    WarningPrint("[H2Session::onError] h2 session error, %u stream(s) dropped. reason:%s",
+                 (uint)mStreams.size(), strerror(errno));
+    _closeSession(Error_NoError, false);
+}
+
+void H2Session::onWritable(Connection *pConn)
+{
+    _notifyWritable();
+}
+
+bool H2Session::_onFrame(uint8 type, uint8 flags, uint32 id, const uint8 *payload, size_t len)
+{
+    if (mHeaderStreamId != 0 && type != Frame_Continuation) // 头块未结束时只能收到CONTINUATION
+    {
+        return false;
+    }
+
+    switch (type)
+    {
+    case Frame_Data:
+        return _onData(flags, id, payload, len);
+    case Frame_Headers:
+        return _onHeaders(flags, id, payload, len);
+    case Frame_Continuation:
+        return _onContinuation(flags, id, payload, len);
+    case Frame_Settings:
+        return 0 == id && _onSettings(flags, payload, len);
+    case Frame_WindowUpdate:
+        return _onWindowUpdate(id, payload, len);
+    case Frame_RstStream:
+        if (0 == id || len != 4)
+            return false;
+        _onRstStream(id);
+        return true;
+    case Frame_Ping:
+        if (id != 0 || len != 8)
+            return false;
+        if (!(flags & Flag_Ack))
+            _sendFrame(Frame_Ping, Flag_Ack, 0, payload, len);
+        return true;
+    case Frame_Goaway:
+        if (id != 0 || len < 8)
+            return false;
+        _onGoaway(payload, len);
+        return true;
+    case Frame_PushPromise: // 已禁止推送
+        return false;
+    default: // PRIORITY及未知帧忽略
+        return true;
+    }
+}
+
+bool H2Session::_onData(uint8 flags, uint32 id, const uint8 *payload, size_t len)
+{
+    if (0 == id)
+    {
+        return false;
+    }
+
+    // 整个帧长(含填充)都计入流量控制
+    mConnRecvConsumed += len;
+    if (mConnRecvConsumed >= H2_CONN_WINDOW/2)
+    {
+        _sendWindowUpdate(0, mConnRecvConsumed);
+        mConnRecvConsumed = 0;
+    }
+
+    const uint8 *data = payload;
+    size_t datalen = len;
+    if (flags & Flag_Padded)
+    {
+        if (0 == len || (size_t)payload[0] + 1 > len)
+            return false;
+        data = payload + 1;
+        datalen = len - 1 - payload[0];
+    }
+
+    StreamMap::iterator it = mStreams.find(id);
+    if (it == mStreams.end()) // 已关闭的流
+    {
+        return true;
+    }
+
+    Stream *s = it->second;
+    s->recvConsumed += len;
+    if (s->recvConsumed >= H2_STREAM_WINDOW/2 && !(flags & Flag_EndStream))
+    {
+        _sendWindowUpdate(id, s->recvConsumed);
+        s->recvConsumed = 0;
+    }
+
+    if (datalen > 0 && s->handler)
+    {
+        s->handler->onStreamData(id, data, datalen);
+    }
+
+    if (flags & Flag_EndStream)
+    {
+        _onRemoteEnd(id);
+    }
+
+    return true;
+}
+
+bool H2Session::_onHeaders(uint8 flags, uint32 id, const uint8 *payload, size_t len)
+{
+    if (0 == id)
+    {
+        return false;
+    }
+
+    const uint8 *block = payload;
+    size_t blocklen = len;
+    size_t padlen = 0;
+
+    if (flags & Flag_Padded)
+    {
+        if (0 == blocklen)
+            return false;
+        padlen = block[0];
+        ++block;
+        --blocklen;
+    }
+    if (flags & Flag_Priority)
+    {
+        if (blocklen < 5)
+            return false;
+        block += 5;
+        blocklen -= 5;
+    }
+    if (padlen > blocklen)
+    {
+        return false;
+    }
+    blocklen -= padlen;
+
+    mHeaderBlock.assign((const char *)block, blocklen);
+    mHeaderStreamId = id;
+    mHeaderEndStream = (flags & Flag_EndStream) != 0;
+
+    if (flags & Flag_EndHeaders)
+    {
+        return _onHeaderBlock();
+    }
+
+    return true;
+}
+
+bool H2Session::_onContinuation(uint8 flags, uint32 id, const uint8 *payload, size_t len)
+{
+    if (0 == mHeaderStreamId || id != mHeaderStreamId)
+    {
+        return false;
+    }
+
+    if (mHeaderBlock.size() + len > H2_HEADER_BLOCK_MAX)
+    {
+        ErrorPrint("[H2Session::_onContinuation] header block too large.");
+        return false;
+    }
+    mHeaderBlock.append((const char *)payload, len);
+
+    if (flags & Flag_EndHeaders)
+    {
+        return _onHeaderBlock();
+    }
+
+    return true;
+}
+
+bool H2Session::_onHeaderBlock()
+{
+    uint32 id = mHeaderStreamId;
+    mHeaderStreamId = 0;
+
+    int status = hpackDecodeResponse((const uint8 *)mHeaderBlock.data(), mHeaderBlock.size());
+    mHeaderBlock.clear();
+    if (status < 0) // 头部压缩错误为连接错误
+    {
+        return false;
+    }
+
+    StreamMap::iterator it = mStreams.find(id);
+    if (it == mStreams.end())
+    {
+        return true;
+    }
+
+    Stream *s = it->second;
+    if (status >= 200 && s->handler) // 忽略1xx及trailer
+    {
+        s->handler->onStreamResponse(id, status);
+    }
+
+    if (mHeaderEndStream)
+    {
+        _onRemoteEnd(id);
+    }
+
+    return true;
+}
+
+bool H2Session::_onSettings(uint8 flags, const uint8 *payload, size_t len)
+{
+    if (flags & Flag_Ack)
+    {
+        return 0 == len;
+    }
+    if (len % 6 != 0)
+    {
+        return false;
+    }
+
+    bool windowGrown = false;
+    for (size_t i = 0; i < len; i += 6)
+    {
+        uint16 key = (uint16)((payload[i] << 8) | payload[i + 1]);
+        uint32 value = readUint32(payload + i + 2);
+
+        switch (key)
+        {
+        case Settings_MaxConcurrentStreams:
+            mPeerMaxStreams = value;
+            break;
+        case Settings_InitialWindowSize:
+            {
+                if (value > H2_MAX_WINDOW)
+                    return false;
+
+                // 调整所有流的发送窗口
+                int64 delta = (int64)value - (int64)mPeerInitialWindow;
+                for (StreamMap::iterator it = mStreams.begin(); it != mStreams.end(); ++it)
+                    it->second->sendWindow += delta;
+
+                mPeerInitialWindow = value;
+                windowGrown = windowGrown || delta > 0;
+            }
+            break;
+        case Settings_MaxFrameSize:
+            if (value < H2_DEFAULT_FRAME_SIZE || value > 0xffffff)
+                return false;
+            mPeerMaxFrameSize = value;
+            break;
+        default:
+            break;
+        }
+    }
+
+    _sendFrame(Frame_Settings, Flag_Ack, 0, NULL, 0);
+
+    if (windowGrown)
+    {
+        _flushAllStreams();
+        _notifyWritable();
+    }
+
+    return true;
+}
+
+bool H2Session::_onWindowUpdate(uint32 id, const uint8 *payload, size_t len)
+{
+    if (len != 4)
+    {
+        return false;
+    }
+
+    uint32 increment = readUint32(payload) & H2_MAX_WINDOW;
+    if (0 == increment)
+    {
+        return id != 0;
+    }
+
+    if (0 == id)
+    {
+        mConnSendWindow += increment;
+        if (mConnSendWindow > H2_MAX_WINDOW)
+        {
+            return false;
+        }
+        _flushAllStreams();
+        _notifyWritable();
+        return true;
+    }
+
+    StreamMap::iterator it = mStreams.find(id);
+    if (it != mStreams.end())
+    {
+        Stream *s = it->second;
+        s->sendWindow += increment;
+        _flushStream(id, s);
+
+        // 流可能已在_flushStream()中结束
+        it = mStreams.find(id);
+        if (!isClosed() && it != mStreams.end() && it->second->blocked &&
+            _canSendData(it->second, H2_MIN_SEND_WINDOW))
+        {
+            s = it->second;
+            s->blocked = false;
+            if (s->handler)
+                s->handler->onStreamWritable(id);
+        }
+    }
+
+    return true;
+}
+
+void H2Session::_onRstStream(uint32 id)
+{
+    StreamMap::iterator it = mStreams.find(id);
+    if (it == mStreams.end())
+    {
+        return;
+    }
+
+    StreamHandler *h = it->second->handler;
+    _eraseStream(id);
+
+    if (h)
+    {
+        h->onStreamClosed(id, true);
+    }
+}
+
+void H2Session::_onGoaway(const uint8 *payload, size_t len)
+{
+    uint32 lastId = readUint32(payload) & H2_MAX_STREAM_ID;
+    uint32 err = readUint32(payload + 4);
+
+    InfoPrint("[H2Session::_onGoaway] last stream=%u error=%u", lastId, err);
+    mbGoaway = true;
+
+    // 未被处理的流直接失败
+    std::vector<uint32> ids;
+    for (StreamMap::iterator it = mStreams.upper_bound(lastId); it != mStreams.end(); ++it)
+    {
+        ids.push_back(it->first);
+    }
+
+    for (size_t i = 0; i < ids.size() && !isClosed(); ++i)
+    {
+        _onRstStream(ids[i]);
+    }
+}
+
+void H2Session::_onRemoteEnd(uint32 id)
+{
+    StreamMap::iterator it = mStreams.find(id);
+    if (it == mStreams.end())
+    {
+        return;
+    }
+
+    Stream *s = it->second;
+    StreamHandler *h = s->handler;
+    s->remoteClosed = true;
+    s->handler = NULL;
+
+    if (h)
+    {
+        h->onStreamClosed(id, false);
+    }
+
+    // 回调中流可能已被重置
+    it = mStreams.find(id);
+    if (it == mStreams.end() || isClosed())
+    {
+        return;
+    }
+
+    s = it->second;
+    if (!s->localClosed)
+    {
+        s->localClosed = true;
+        _sendFrame(Frame_Data, Flag_EndStream, id, NULL, 0);
+        if (isClosed())
+        {
+            return;
+        }
+    }
+
+    _eraseStream(id);
+}
+
+void H2Session::_flushStream(uint32 id, Stream *s)
+{
+    while (!s->pending.empty() && s->sendWindow > 0 && mConnSendWindow > 0)
+    {
+        size_t n = min(s->pending.size(), (size_t)min(s->sendWindow, mConnSendWindow));
+        n = min(n, (size_t)min(mPeerMaxFrameSize, (uint32)H2_DEFAULT_FRAME_SIZE));
+
+        s->sendWindow -= n;
+        mConnSendWindow -= n;
+        _sendFrame(Frame_Data, 0, id, s->pending.data(), n);
+        if (isClosed())
+        {
+            return;
+        }
+
+        s->pending.erase(0, n);
+    }
+
+    if (s->pending.empty() && s->endPending && !s->localClosed)
+    {
+        s->localClosed = true;
+        _sendFrame(Frame_Data, Flag_EndStream, id, NULL, 0);
+        if (isClosed())
+        {
+            return;
+        }
+
+        if (s->remoteClosed)
+        {
+            _eraseStream(id);
+        }
+    }
+}
+
+void H2Session::_flushAllStreams()
+{
+    std::vector<uint32> ids;
+    for (StreamMap::iterator it = mStreams.begin(); it != mStreams.end(); ++it)
+    {
+        if (!it->second->pending.empty() || it->second->endPending)
+        {
+            ids.push_back(it->first);
+        }
+    }
+
+    for (size_t i = 0; i < ids.size() && mConnSendWindow > 0 && !isClosed(); ++i)
+    {
+        StreamMap::iterator it = mStreams.find(ids[i]);
+        if (it != mStreams.end())
+        {
+            _flushStream(ids[i], it->second);
+        }
+    }
+}
+
+void H2Session::_notifyWritable()
+{
+    std::vector<uint32> ids;
+    for (StreamMap::iterator it = mStreams.begin(); it != mStreams.end(); ++it)
+    {
+        if (it->second->blocked)
+        {
+            ids.push_back(it->first);
+        }
+    }
+
+    // 回调中可能关闭流或会话, 也可能用完窗口, 逐个重新查找
+    for (size_t i = 0; i < ids.size() && !isClosed(); ++i)
+    {
+        StreamMap::iterator it = mStreams.find(ids[i]);
+        if (it == mStreams.end())
+        {
+            continue;
+        }
+
+        Stream *s = it->second;
+        if (!_canSendData(s, H2_MIN_SEND_WINDOW))
+        {
+            if (mConnSendWindow <= 0 || mConn.hasPendingData())
+                break;
+            continue;
+        }
+
+        s->blocked = false;
+        if (s->handler)
+        {
+            s->handler->onStreamWritable(ids[i]);
+        }
+    }
+}
+
+bool H2Session::_canSendData(const Stream *s, size_t len) const
+{
+    if (SessionStatus_Connected != mStatus || !s->pending.empty() || mConn.hasPendingData())
+        return false;
+
+    // 对端每收到一帧就归还同样大小的窗口, 小窗口一旦被用掉就会一直只能发小帧
+    // 窗口上限很小时按其一半等待, 否则可能永远等不到
+    int64 window = min(s->sendWindow, mConnSendWindow);
+    int64 need = min((int64)len, min((int64)H2_MIN_SEND_WINDOW, (int64)mPeerInitialWindow / 2));
+    return window > 0 && window >= need;
+}
+
+void H2Session::_eraseStream(uint32 id)
+{
+    StreamMap::iterator it = mStreams.find(id);
+    if (it != mStreams.end())
+    {
+        delete it->second;
+        mStreams.erase(it);
+    }
+}
+
+void H2Session::_closeSession(uint32 err, bool sendGoaway)
+{
+    if (isClosed())
+    {
+        return;
+    }
+
+    mConn.setEventHandler(NULL);
+    if (sendGoaway && SessionStatus_Connected == mStatus)
+    {
+        uint8 payload[8];
+        writeUint32(payload, 0);
+        writeUint32(payload + 4, err);
+        _sendFrame(Frame_Goaway, 0, 0, payload, sizeof(payload));
+    }
+
+    mStatus = SessionStatus_Closed;
+    mConn.shutdown();
+
+    mPendingOut.clear();
+    mRecvBuf.clear();
+    mHeaderBlock.clear();
+    mHeaderStreamId = 0;
+
+    // 通知所有流失败
+    StreamMap streams;
+    streams.swap(mStreams);
+    for (StreamMap::iterator it = streams.begin(); it != streams.end(); ++it)
+    {
+        StreamHandler *h = it->second->handler;
+        delete it->second;
+
+        if (h)
+        {
+            h->onStreamClosed(it->first, true);
+        }
+    }
+}
+
+void H2Session::_sendFrame(uint8 type, uint8 flags, uint32 id, const void *payload, size_t len)
+{
+    assert(len <= H2_DEFAULT_FRAME_SIZE && "h2 frame too large");
+
+    mFrameBuf[0] = (uint8)(len >> 16);
+    mFrameBuf[1] = (uint8)(len >> 8);
+    mFrameBuf[2] = (uint8)len;
+    mFrameBuf[3] = type;
+    mFrameBuf[4] = flags;
+    writeUint32(mFrameBuf + 5, id & H2_MAX_STREAM_ID);
+    if (len > 0 && payload != mFrameBuf + H2_FRAME_HEADER_SIZE)
+    {
+        memcpy(mFrameBuf + H2_FRAME_HEADER_SIZE, payload, len);
+    }
+
+    _write(mFrameBuf, H2_FRAME_HEADER_SIZE + len);
+}
+
+void H2Session::_sendWindowUpdate(uint32 id, uint32 increment)
+{
+    uint8 payload[4];
+    writeUint32(payload, increment & H2_MAX_WINDOW);
+    _sendFrame(Frame_WindowUpdate, 0, id, payload, sizeof(payload));
+}
+
+void H2Session::_sendRstStream(uint32 id, uint32 err)
+{
+    uint8 payload[4];
+    writeUint32(payload, err);
+    _sendFrame(Frame_RstStream, 0, id, payload, sizeof(payload));
+}
+
+void H2Session::_write(const void *data, size_t datalen)
+{
+    if (SessionStatus_Connecting == mStatus)
+    {
+        mPendingOut.append((const char *)data, datalen);
+    }
+    else if (SessionStatus_Connected == mStatus)
+    {
+        mConn.send(data, datalen);
+    }
+}
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+H2SessionPool::~H2SessionPool()
+{
+    finalise();
+}
+
+H2Session *H2SessionPool::acquire(const sockaddr_in &addr)
+{
+    uint64 key = ((uint64)ntohl(addr.sin_addr.s_addr) << 16) | ntohs(addr.sin_port);
+    SessionList &sessions = mSessions[key];
+
+    SessionList::iterator it = sessions.begin();
+    for (; it != sessions.end(); ++it)
+    {
+        if ((*it)->isUsable())
+        {
+            return *it;
+        }
+    }
+
+    H2Session *session = new H2Session(mEventPoller);
+    assert(session && "new h2 session failed.");
+
+    if (!session->connect((const sockaddr *)&addr, sizeof(addr)))
+    {
+        delete session;
+        return NULL;
+    }
+    sessions.push_back(session);
+
+    DebugPrint("[H2SessionPool::acquire] new h2 session:%p, %u session(s) to this proxy",
+               session, (uint)sessions.size());
+    return session;
+}
+
+void H2SessionPool::reap()
+{
+    SessionMap::iterator it = mSessions.begin();
+    while (it != mSessions.end())
+    {
+        SessionList &sessions = it->second;
+        SessionList::iterator itSession = sessions.begin();
+        while (itSession != sessions.end())
+        {
+            if ((*itSession)->isClosed())
+            {
+                delete *itSession;
+                sessions.erase(itSession++);
+            }
+            else
+            {
+                ++itSession;
+            }
+        }
+
+        if (sessions.empty())
+            mSessions.erase(it++);
+        else
+            ++it;
+    }
+}
+
+void H2SessionPool::finalise()
+{
+    SessionMap::iterator it = mSessions.begin();
+    for (; it != mSessions.end(); ++it)
+    {
+        SessionList::iterator itSession = it->second.begin();
+        for (; itSession != it->second.end(); ++itSession)
+        {
+            (*itSession)->close();
+            delete *itSession;
+        }
+    }
+    mSessions.clear();
+}
+//--------------------------------------------------------------------------
+
+NAMESPACE_END // namespace proxy
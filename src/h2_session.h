@@ -0,0 +1,261 @@
+#ifndef __H2_SESSION_H__
+#define __H2_SESSION_H__
+
+#include "proxy_common.h"
+#include "event_poller.h"
+#include "connection.h"
+
+#define H2_PREFACE                 "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_FRAME_HEADER_SIZE       9
+#define H2_DEFAULT_FRAME_SIZE      16384
+#define H2_DEFAULT_WINDOW          65535
+#define H2_MAX_WINDOW              0x7fffffff
+#define H2_MAX_STREAM_ID           0x7fffffff
+
+#define H2_STREAM_WINDOW           (1024*1024)      // 本端每个流的接收窗口
+#define H2_CONN_WINDOW             (16*1024*1024)   // 本端连接级接收窗口
+#define H2_MAX_STREAMS             100              // 每个会话上最多承载的隧道数
+#define H2_HEADER_BLOCK_MAX        (16*1024)        // 响应头块最大长度
+#define H2_MIN_SEND_WINDOW         H2_DEFAULT_FRAME_SIZE // 发送窗口不足此数且不够发完时等待, 避免窗口被碎帧切碎
+#define HTTP_HEADER_BLOCK_SIZE     1024             // CONNECT请求头块缓冲区
+
+NAMESPACE_BEG(proxy)
+
+/*
+ * 与上游代理之间的一条HTTP/2连接(h2c, prior knowledge)
+ * 每个隧道对应一个CONNECT流, 按流做流量控制
+ */
+class H2Session : public Connection::Handler
+{
+    enum EFrameType
+    {
+        Frame_Data         = 0x0,
+        Frame_Headers      = 0x1,
+        Frame_Priority     = 0x2,
+        Frame_RstStream    = 0x3,
+        Frame_Settings     = 0x4,
+        Frame_PushPromise  = 0x5,
+        Frame_Ping         = 0x6,
+        Frame_Goaway       = 0x7,
+        Frame_WindowUpdate = 0x8,
+        Frame_Continuation = 0x9,
+    };
+
+    enum EFrameFlag
+    {
+        Flag_EndStream  = 0x1,
+        Flag_Ack        = 0x1,
+        Flag_EndHeaders = 0x4,
+        Flag_Padded     = 0x8,
+        Flag_Priority   = 0x20,
+    };
+
+    enum ESettings
+    {
+        Settings_HeaderTableSize      = 0x1,
+        Settings_EnablePush           = 0x2,
+        Settings_MaxConcurrentStreams = 0x3,
+        Settings_InitialWindowSize    = 0x4,
+        Settings_MaxFrameSize         = 0x5,
+    };
+
+    enum EErrorCode
+    {
+        Error_NoError       = 0x0,
+        Error_Protocol      = 0x1,
+        Error_FlowControl   = 0x3,
+        Error_FrameSize     = 0x6,
+        Error_Cancel        = 0x8,
+    };
+
+    enum ESessionStatus
+    {
+        SessionStatus_Closed = 0,
+        SessionStatus_Connecting,
+        SessionStatus_Connected,
+    };
+
+  public:
+    class StreamHandler
+    {
+      public:
+        StreamHandler() {}
+
+        // 收到CONNECT的响应状态码
+        virtual void onStreamResponse(uint32 id, int status) = 0;
+        virtual void onStreamData(uint32 id, const void *data, size_t datalen) = 0;
+        // 流被对端关闭或出错, 回调之后流即失效
+        virtual void onStreamClosed(uint32 id, bool error) = 0;
+        // sendData()未全部接受后, 窗口打开或连接可写时回调, 可继续发送
+        virtual void onStreamWritable(uint32 id) {}
+    };
+
+    H2Session(EventPoller *poller)
+            :mConn(poller)
+            ,mStatus(SessionStatus_Closed)
+            ,mbGoaway(false)
+            ,mNextStreamId(1)
+            ,mStreams()
+            ,mPendingOut()
+            ,mRecvBuf()
+            ,mHeaderBlock()
+            ,mHeaderStreamId(0)
+            ,mHeaderEndStream(false)
+            ,mPeerMaxStreams(H2_MAX_STREAMS)
+            ,mPeerInitialWindow(H2_DEFAULT_WINDOW)
+            ,mPeerMaxFrameSize(H2_DEFAULT_FRAME_SIZE)
+            ,mConnSendWindow(H2_DEFAULT_WINDOW)
+            ,mConnRecvConsumed(0)
+    {}
+
+    virtual ~H2Session();
+
+    bool connect(const sockaddr *sa, socklen_t salen);
+    void close();
+
+    // 会话是否还能承载新的隧道
+    bool isUsable() const;
+
+    inline bool isClosed() const
+    {
+        return SessionStatus_Closed == mStatus;
+    }
+
+    inline size_t getStreamCount() const
+    {
+        return mStreams.size();
+    }
+
+    /*
+     * 打开一个CONNECT流
+     * return 流ID, 失败返回0
+     */
+    uint32 openStream(const char *authority, const char *authorization, StreamHandler *h);
+
+    /*
+     * 只发送流和连接发送窗口允许的部分, 其余不排队, 由调用方留在原处
+     * 连接的发送队列中还有数据时不发送
+     * return 接受的字节数, 未全部接受时之后回调onStreamWritable()
+     *        -1 流已关闭, 或发送出错导致会话关闭(流的回调已同步执行)
+     */
+    ssize_t sendData(uint32 id, const void *data, size_t datalen);
+    // 多段数据连续填入数据帧, 不按段拆帧
+    ssize_t sendData(uint32 id, const struct iovec *iov, int iovcnt);
+
+    // 全部接受, 窗口不足的部分在会话中排队, 只用于少量数据(如代理链各跳的CONNECT请求)
+    void queueData(uint32 id, const void *data, size_t datalen);
+
+    // 发送完缓存的数据后半关闭流, 之后不再回调
+    void closeStream(uint32 id);
+
+    // 立即重置流, 之后不再回调
+    void resetStream(uint32 id);
+
+    virtual void onConnected(Connection *pConn);
+    virtual void onDisconnected(Connection *pConn);
+
+    virtual void onRecv(Connection *pConn, const void *data, size_t datalen);
+    virtual void onError(Connection *pConn);
+    virtual void onWritable(Connection *pConn);
+
+  private:
+    struct Stream
+    {
+        StreamHandler *handler;
+        int64 sendWindow;      // 对端为该流开放的发送窗口
+        uint32 recvConsumed;   // 已消费但尚未通告的接收字节数
+        std::string pending;   // queueData()中因窗口不足而等待发送的数据
+        bool endPending;       // 数据发送完后需要半关闭
+        bool localClosed;
+        bool remoteClosed;
+        bool blocked;          // sendData()未全部接受, 可发送时回调onStreamWritable()
+
+        Stream() : handler(NULL), sendWindow(0), recvConsumed(0), pending()
+                 , endPending(false), localClosed(false), remoteClosed(false), blocked(false)
+        {}
+    };
+
+    typedef std::map<uint32, Stream *> StreamMap;
+
+    bool _onFrame(uint8 type, uint8 flags, uint32 id, const uint8 *payload, size_t len);
+    bool _onData(uint8 flags, uint32 id, const uint8 *payload, size_t len);
+    bool _onHeaders(uint8 flags, uint32 id, const uint8 *payload, size_t len);
+    bool _onContinuation(uint8 flags, uint32 id, const uint8 *payload, size_t len);
+    bool _onSettings(uint8 flags, const uint8 *payload, size_t len);
+    bool _onWindowUpdate(uint32 id, const uint8 *payload, size_t len);
+    void _onRstStream(uint32 id);
+    void _onGoaway(const uint8 *payload, size_t len);
+    bool _onHeaderBlock();
+    void _onRemoteEnd(uint32 id);
+
+    void _flushStream(uint32 id, Stream *s);
+    void _flushAllStreams();
+    // 回调被阻塞的流继续发送
+    void _notifyWritable();
+    // 流和连接的窗口及发送队列允许发送数据帧, len为待发送的长度
+    bool _canSendData(const Stream *s, size_t len) const;
+    void _eraseStream(uint32 id);
+    void _closeSession(uint32 err, bool sendGoaway);
+
+    void _sendFrame(uint8 type, uint8 flags, uint32 id, const void *payload, size_t len);
+    void _sendWindowUpdate(uint32 id, uint32 increment);
+    void _sendRstStream(uint32 id, uint32 err);
+    void _write(const void *data, size_t datalen);
+
+  private:
+    Connection mConn;
+    ESessionStatus mStatus;
+    bool mbGoaway;
+
+    uint32 mNextStreamId;
+    StreamMap mStreams;
+
+    std::string mPendingOut; // 连接建立前待发送的数据
+    std::string mRecvBuf;    // 未处理完的帧数据
+
+    std::string mHeaderBlock; // 跨CONTINUATION帧的响应头块
+    uint32 mHeaderStreamId;
+    bool mHeaderEndStream;
+
+    uint32 mPeerMaxStreams;
+    uint32 mPeerInitialWindow;
+    uint32 mPeerMaxFrameSize;
+
+    int64 mConnSendWindow;
+    uint32 mConnRecvConsumed;
+
+    uint8 mFrameBuf[H2_FRAME_HEADER_SIZE + H2_DEFAULT_FRAME_SIZE];
+};
+
+/*
+ * 按上游代理地址管理HTTP/2会话, 新隧道优先复用已有会话
+ */
+class H2SessionPool
+{
+    typedef std::list<H2Session *> SessionList;
+    typedef std::map<uint64, SessionList> SessionMap;
+
+  public:
+    H2SessionPool(EventPoller *poller)
+            :mEventPoller(poller)
+            ,mSessions()
+    {}
+
+    virtual ~H2SessionPool();
+
+    // 取一个可承载新隧道的会话, 没有则新建
+    H2Session *acquire(const sockaddr_in &addr);
+
+    // 回收已关闭的会话
+    void reap();
+
+    void finalise();
+
+  private:
+    EventPoller *mEventPoller;
+    SessionMap mSessions;
+};
+
+NAMESPACE_END // namespace proxy
+
+#endif // __H2_SESSION_H__
@@ -0,0 +1,388 @@
+#include "hot_upgrade.h"
+
+#include <sys/un.h>
+
+NAMESPACE_BEG(proxy)
+
+static bool makeUnixAddr(const char *path, sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path))
+    {
+        ErrorPrint("[HotUpgrade] path too long: %s", path);
+        return false;
+    }
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+static void setIoTimeout(int fd, int secs)
+{
+    struct timeval tv;
+    tv.tv_sec = secs;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+HotUpgrade::~HotUpgrade()
+{
+    finalise();
+}
+
+bool HotUpgrade::takeover(const char *path)
+{
+    sockaddr_un addr;
+    if (!makeUnixAddr(path, &addr))
+    {
+        return false;
+    }
+
+    mPeerFd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (mPeerFd < 0)
+    {
+        ErrorPrint("[HotUpgrade::takeover] init socket error! %s", strerror(errno));
+        return false;
+    }
+
+    if (connect(mPeerFd, (const sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        // 没有旧进程, 正常启动
+        close(mPeerFd);
+        mPeerFd = -1;
+        return true;
+    }
+    setIoTimeout(mPeerFd, UPGRADE_ACK_TIMEOUT);
+
+    // 每条消息为一个监听fd及其名字, 名字为空表示结束
+    for (;;)
+    {
+        char name[UPGRADE_NAME_SIZE] = {0};
+        char control[CMSG_SPACE(sizeof(int))];
+
+        struct iovec iov;
+        iov.iov_base = name;
+        iov.iov_len = sizeof(name) - 1;
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t n = recvmsg(mPeerFd, &msg, 0);
+        if (n <= 0)
+        {
+            ErrorPrint("[HotUpgrade::takeover] receive listeners failed! %s", n < 0 ? strerror(errno) : "closed");
+            goto err_1;
+        }
+
+        int fd = -1;
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+
+        if ('\0' == *name)
+        {
+            if (fd >= 0)
+                close(fd);
+            break;
+        }
+
+        if (fd < 0)
+        {
+            ErrorPrint("[HotUpgrade::takeover] no fd for listener %s", name);
+            goto err_1;
+        }
+
+        if (mInherited.find(name) != mInherited.end())
+        {
+            close(mInherited[name]);
+        }
+        mInherited[name] = fd;
+        InfoPrint("[HotUpgrade::takeover] inherit listener %s fd=%d", name, fd);
+    }
+
+    return true;
+
+err_1:
+    close(mPeerFd);
+    mPeerFd = -1;
+
+    ListenerFdMap::iterator it = mInherited.begin();
+    for (; it != mInherited.end(); ++it)
+    {
+        close(it->second);
+    }
+    mInherited.clear();
+
+    return false;
+}
+
+int HotUpgrade::fetch(const std::string &name)
+{
+    ListenerFdMap::iterator it = mInherited.find(name);
+    if (it == mInherited.end())
+    {
+        return -1;
+    }
+
+    int fd = it->second;
+    mInherited.erase(it);
+    return fd;
+}
+
+bool HotUpgrade::initialise(const char *path)
+{
+    if (mFd >= 0)
+    {
+        ErrorPrint("HotUpgrade already inited!");
+        return false;
+    }
+
+    sockaddr_un addr;
+    if (!makeUnixAddr(path, &addr))
+    {
+        return false;
+    }
+
+    // 新配置中已没有的路由, 其监听fd不再需要
+    ListenerFdMap::iterator it = mInherited.begin();
+    for (; it != mInherited.end(); ++it)
+    {
+        InfoPrint("[HotUpgrade::initialise] listener %s no longer configured, closed.", it->first.c_str());
+        close(it->second);
+    }
+    mInherited.clear();
+
+    // 确认接管, 旧进程随即停止接入
+    if (mPeerFd >= 0)
+    {
+        char ack = 1;
+        if (send(mPeerFd, &ack, sizeof(ack), 0) != sizeof(ack))
+        {
+            WarningPrint("[HotUpgrade::initialise] ack old process failed! %s", strerror(errno));
+        }
+        close(mPeerFd);
+        mPeerFd = -1;
+    }
+
+    mFd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (mFd < 0)
+    {
+        ErrorPrint("[HotUpgrade::initialise] init socket error! %s", strerror(errno));
+        return false;
+    }
+
+    unlink(path);
+    if (bind(mFd, (const sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        ErrorPrint("[HotUpgrade::initialise] bind %s error! %s", path, strerror(errno));
+        goto err_1;
+    }
+    mPath = path;
+
+    if (listen(mFd, 1) < 0 || !setNonblocking(mFd))
+    {
+        ErrorPrint("[HotUpgrade::initialise] listen failed! %s", strerror(errno));
+        goto err_2;
+    }
+
+    if (!mEventPoller->registerForRead(mFd, this))
+    {
+        ErrorPrint("[HotUpgrade::initialise] registerForRead failed! %s", strerror(errno));
+        goto err_2;
+    }
+    mbHandedOver = false;
+
+    return true;
+
+err_2:
+    unlink(path);
+    mPath.clear();
+err_1:
+    close(mFd);
+    mFd = -1;
+
+    return false;
+}
+
+void HotUpgrade::finalise()
+{
+    if (mPeerFd >= 0)
+    {
+        close(mPeerFd);
+        mPeerFd = -1;
+    }
+
+    abortHandOver();
+
+    ListenerFdMap::iterator it = mInherited.begin();
+    for (; it != mInherited.end(); ++it)
+    {
+        close(it->second);
+    }
+    mInherited.clear();
+
+    if (mFd < 0)
+        return;
+
+    mEventPoller->deregisterForRead(mFd);
+    close(mFd);
+    mFd = -1;
+
+    // 已交接时路径归新进程所有
+    if (!mbHandedOver && !mPath.empty())
+    {
+        unlink(mPath.c_str());
+    }
+    mPath.clear();
+}
+
+bool HotUpgrade::handOver(int connfd)
+{
+    ListenerFdList fds;
+    if (mHandler)
+    {
+        mHandler->collectListeners(fds);
+    }
+
+    if (!setNonblocking(connfd))
+    {
+        WarningPrint("[HotUpgrade::handOver] set nonblocking failed! %s", strerror(errno));
+        return false;
+    }
+
+    for (size_t i = 0; i <= fds.size(); ++i)
+    {
+        char name[UPGRADE_NAME_SIZE] = {0};
+        char control[CMSG_SPACE(sizeof(int))];
+        memset(control, 0, sizeof(control));
+
+        struct iovec iov;
+        iov.iov_base = name;
+        iov.iov_len = 1;
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+
+        // 最后发一条空名字的消息表示结束
+        if (i < fds.size())
+        {
+            snprintf(name, sizeof(name), "%s", fds[i].first.c_str());
+            iov.iov_len = strlen(name) + 1;
+
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(cmsg), &fds[i].second, sizeof(int));
+        }
+
+        // 消息很小, 新连接的发送缓冲区足以容纳, 发不出即视为失败
+        if (sendmsg(connfd, &msg, MSG_NOSIGNAL) < 0)
+        {
+            WarningPrint("[HotUpgrade::handOver] send listener failed! %s", strerror(errno));
+            return false;
+        }
+    }
+
+    // 新进程建好路由后才确认, 在事件循环中等待
+    if (!mEventPoller->registerForRead(connfd, this))
+    {
+        WarningPrint("[HotUpgrade::handOver] registerForRead failed! %s", strerror(errno));
+        return false;
+    }
+    mAckFd = connfd;
+    mTimerWheel->schedule(&mAckTimer, UPGRADE_ACK_TIMEOUT * 1000);
+
+    return true;
+}
+
+void HotUpgrade::onAck()
+{
+    char ack = 0;
+    ssize_t n = recv(mAckFd, &ack, sizeof(ack), 0);
+    if (n < 0 && (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno))
+    {
+        return;
+    }
+
+    abortHandOver();
+    if (n != sizeof(ack))
+    {
+        WarningPrint("[HotUpgrade::onAck] new process did not confirm, keep serving. %s",
+                     n < 0 ? strerror(errno) : "closed");
+        return;
+    }
+
+    // 控制套接字的路径已由新进程接管
+    mbHandedOver = true;
+    mEventPoller->deregisterForRead(mFd);
+    close(mFd);
+    mFd = -1;
+
+    if (mHandler)
+    {
+        mHandler->onHandedOver();
+    }
+}
+
+void HotUpgrade::abortHandOver()
+{
+    mAckTimer.cancel();
+    if (mAckFd < 0)
+        return;
+
+    mEventPoller->deregisterForRead(mAckFd);
+    close(mAckFd);
+    mAckFd = -1;
+}
+
+void HotUpgrade::onTimeout(Timer *timer)
+{
+    WarningPrint("[HotUpgrade::onTimeout] new process did not confirm in %ds, keep serving.", UPGRADE_ACK_TIMEOUT);
+    abortHandOver();
+}
+
+int HotUpgrade::handleInputNotification(int fd)
+{
+    if (fd == mAckFd)
+    {
+        onAck();
+        return 0;
+    }
+
+    int connfd = accept(fd, NULL, NULL);
+    if (connfd < 0)
+    {
+        return 0;
+    }
+
+    // 同一时间只进行一次交接
+    if (mAckFd >= 0)
+    {
+        WarningPrint("[HotUpgrade] hand over in progress, reject another new process.");
+        close(connfd);
+        return 0;
+    }
+
+    InfoPrint("[HotUpgrade] new process connected, hand over listeners.");
+    if (!handOver(connfd))
+    {
+        close(connfd);
+    }
+
+    return 0;
+}
+
+NAMESPACE_END // namespace proxy
@@ -0,0 +1,105 @@
+#ifndef __HOT_UPGRADE_H__
+#define __HOT_UPGRADE_H__
+
+#include "proxy_common.h"
+#include "event_poller.h"
+#include "timer_wheel.h"
+
+#define UPGRADE_NAME_SIZE   128 // 监听fd的名字, 即路由的"listen_ip:port"或"unix:path"
+#define UPGRADE_ACK_TIMEOUT 5  // 旧进程等待新进程确认接管的时间(s)
+
+NAMESPACE_BEG(proxy)
+
+/*
+ * 热升级: 新进程经Unix域套接字(SCM_RIGHTS)从旧进程接过监听fd,
+ * 旧进程确认后停止接入, 已有隧道继续服务直至结束或超时
+ *
+ * 新进程: takeover() -> 以fetch()取到的fd建立路由 -> initialise()
+ * 旧进程: initialise()后等待新进程连接, 交出监听fd并收到确认后回调onHandedOver()
+ *         等待确认期间不阻塞事件循环, 超时未确认则继续服务
+ */
+class HotUpgrade : public InputNotificationHandler, public Timer::Handler
+{
+  public:
+    typedef std::vector<std::pair<std::string, int> > ListenerFdList;
+    typedef std::map<std::string, int> ListenerFdMap;
+
+    class Handler
+    {
+      public:
+        Handler() {}
+
+        // 列出要交给新进程的监听fd
+        virtual void collectListeners(ListenerFdList &fds) = 0;
+        // 新进程已接管监听fd
+        virtual void onHandedOver() = 0;
+    };
+
+    HotUpgrade(EventPoller *poller, TimerWheel *wheel)
+            :mEventPoller(poller)
+            ,mTimerWheel(wheel)
+            ,mHandler(NULL)
+            ,mFd(-1)
+            ,mPeerFd(-1)
+            ,mAckFd(-1)
+            ,mAckTimer()
+            ,mPath()
+            ,mInherited()
+            ,mbHandedOver(false)
+    {
+        mAckTimer.setHandler(this);
+    }
+
+    virtual ~HotUpgrade();
+
+    /*
+     * 连接旧进程的控制套接字并接收其监听fd
+     * 没有旧进程在运行时返回true, 此时不继承任何fd
+     */
+    bool takeover(const char *path);
+
+    // 取出继承的监听fd, 没有时返回-1
+    int fetch(const std::string &name);
+
+    /*
+     * 确认接管(关闭未用到的继承fd)并在path上监听后续的升级请求
+     */
+    bool initialise(const char *path);
+    void finalise();
+
+    inline void setEventHandler(Handler *h)
+    {
+        mHandler = h;
+    }
+
+    // InputNotificationHandler
+    virtual int handleInputNotification(int fd);
+
+    // Timer::Handler
+    virtual void onTimeout(Timer *timer);
+
+  private:
+    // 向新进程交出监听fd, 之后等待其确认
+    bool handOver(int connfd);
+    void onAck();
+    // 放弃本次交接, 继续接受后续的升级请求
+    void abortHandOver();
+
+  private:
+    EventPoller *mEventPoller;
+    TimerWheel *mTimerWheel;
+    Handler *mHandler;
+
+    int mFd;     // 控制套接字
+    int mPeerFd; // 新进程: 与旧进程的连接, 确认接管后关闭
+    int mAckFd;  // 旧进程: 已交出监听fd, 等待确认的新进程连接
+    Timer mAckTimer;
+    std::string mPath;
+
+    ListenerFdMap mInherited;
+    bool mbHandedOver;
+};
+
+NAMESPACE_END // namespace proxy
+
+#endif // __HOT_UPGRADE_H__
@@ -0,0 +1,202 @@
+#include "hpack.h"
+
+NAMESPACE_BEG(proxy)
+
+static const int HPACK_STATIC_STATUS[] = { 200, 204, 206, 304, 400, 404, 500 };
+
+size_t hpackEncodeInt(uint8 *buf, uint8 first, int prefix, uint32 v)
+{
+    uint32 mask = (1u << prefix) - 1;
+    if (v < mask)
+    {
+        buf[0] = first | (uint8)v;
+        return 1;
+    }
+
+    size_t n = 0;
+    buf[n++] = first | (uint8)mask;
+    v -= mask;
+    while (v >= 0x80)
+    {
+        buf[n++] = (uint8)((v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = (uint8)v;
+
+    return n;
+}
+
+size_t hpackEncodeLiteral(uint8 *buf, uint32 nameIndex, const char *value)
+{
+    size_t vlen = strlen(value);
+    size_t n = hpackEncodeInt(buf, 0x00, 4, nameIndex);
+    n += hpackEncodeInt(buf + n, 0x00, 7, (uint32)vlen);
+    memcpy(buf + n, value, vlen);
+
+    return n + vlen;
+}
+
+bool hpackDecodeInt(const uint8 *&p, const uint8 *end, int prefix, uint32 &v)
+{
+    if (p >= end)
+        return false;
+
+    uint32 mask = (1u << prefix) - 1;
+    v = *p++ & mask;
+    if (v < mask)
+        return true;
+
+    for (int shift = 0; p < end && shift <= 28; shift += 7)
+    {
+        uint8 b = *p++;
+        v += (uint32)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+
+    return false;
+}
+
+bool hpackDecodeString(const uint8 *&p, const uint8 *end, const uint8 *&str, uint32 &len, bool &huffman)
+{
+    if (p >= end)
+        return false;
+
+    huffman = (*p & 0x80) != 0;
+    if (!hpackDecodeInt(p, end, 7, len) || (size_t)(end - p) < len)
+        return false;
+
+    str = p;
+    p += len;
+    return true;
+}
+
+/*
+ * 解码:status的值, 仅需处理数字
+ * 霍夫曼编码中'0'~'2'为5位码00000~00010, '3'~'9'为6位码011001~011111
+ */
+int hpackDecodeStatus(const uint8 *str, uint32 len, bool huffman)
+{
+    char digits[3];
+    size_t ndigit = 0;
+
+    if (!huffman)
+    {
+        if (len != sizeof(digits))
+            return -1;
+        memcpy(digits, str, len);
+        ndigit = len;
+    }
+    else
+    {
+        uint32 acc = 0;
+        int bits = 0;
+        size_t i = 0;
+
+        for (;;)
+        {
+            while (bits < 6 && i < len)
+            {
+                acc = (acc << 8) | str[i++];
+                bits += 8;
+            }
+
+            // 末尾不足8位且全为1的是EOS填充
+            if (i >= len && bits <= 7)
+            {
+                uint32 mask = (1u << bits) - 1;
+                if ((acc & mask) == mask)
+                    break;
+            }
+            if (bits < 5 || ndigit >= sizeof(digits))
+                return -1;
+
+            uint32 code = (acc >> (bits - 5)) & 0x1f;
+            if (code <= 0x2)
+            {
+                digits[ndigit++] = (char)('0' + code);
+                bits -= 5;
+            }
+            else
+            {
+                if (bits < 6)
+                    return -1;
+
+                code = (acc >> (bits - 6)) & 0x3f;
+                if (code < 0x19 || code > 0x1f)
+                    return -1;
+
+                digits[ndigit++] = (char)('3' + code - 0x19);
+                bits -= 6;
+            }
+            acc &= (1u << bits) - 1;
+        }
+    }
+
+    if (ndigit != sizeof(digits))
+        return -1;
+
+    int status = 0;
+    for (size_t i = 0; i < ndigit; ++i)
+    {
+        if (digits[i] < '0' || digits[i] > '9')
+            return -1;
+        status = status*10 + (digits[i] - '0');
+    }
+
+    return status;
+}
+
+int hpackDecodeResponse(const uint8 *block, size_t len)
+{
+    const uint8 *p = block, *end = block + len;
+    int status = 0;
+
+    while (p < end)
+    {
+        uint8 b = *p;
+        uint32 index = 0;
+
+        if (b & 0x80) // 索引头部
+        {
+            if (!hpackDecodeInt(p, end, 7, index) || 0 == index || index > HPACK_STATIC_TABLE_SIZE)
+                return -1;
+
+            if (index >= HPACK_STATIC_STATUS_FIRST && index <= HPACK_STATIC_STATUS_LAST)
+                status = HPACK_STATIC_STATUS[index - HPACK_STATIC_STATUS_FIRST];
+        }
+        else if ((b & 0xe0) == 0x20) // 动态表大小更新
+        {
+            if (!hpackDecodeInt(p, end, 5, index))
+                return -1;
+        }
+        else // 字面头部
+        {
+            int prefix = (b & 0xc0) == 0x40 ? 6 : 4;
+            if (!hpackDecodeInt(p, end, prefix, index) || index > HPACK_STATIC_TABLE_SIZE)
+                return -1;
+
+            const uint8 *str = NULL;
+            uint32 slen = 0;
+            bool huffman = false;
+            bool isStatus = index >= HPACK_STATIC_STATUS_FIRST && index <= HPACK_STATIC_STATUS_LAST;
+
+            if (0 == index)
+            {
+                if (!hpackDecodeString(p, end, str, slen, huffman))
+                    return -1;
+                isStatus = !huffman && 7 == slen && memcmp(str, ":status", 7) == 0;
+            }
+
+            if (!hpackDecodeString(p, end, str, slen, huffman))
+                return -1;
+
+            if (isStatus && (status = hpackDecodeStatus(str, slen, huffman)) < 0)
+                return -1;
+        }
+    }
+
+    return status;
+}
+
+NAMESPACE_END
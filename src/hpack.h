@@ -0,0 +1,42 @@
+#ifndef __HPACK_H__
+#define __HPACK_H__
+
+#include "proxy_common.h"
+
+//--------------------------------------------------------------------------
+// HPACK(RFC 7541)辅助函数
+// 本端通告SETTINGS_HEADER_TABLE_SIZE=0, 因此解码时无需维护动态表
+
+#define HPACK_STATIC_AUTHORITY      1
+#define HPACK_STATIC_METHOD         2
+#define HPACK_STATIC_STATUS_FIRST   8  // ":status 200"
+#define HPACK_STATIC_STATUS_LAST    14 // ":status 500"
+#define HPACK_STATIC_PROXY_AUTH     48
+#define HPACK_STATIC_TABLE_SIZE     61
+
+NAMESPACE_BEG(proxy)
+
+// 编码整数, first为首字节中前缀以外的位, 返回写入的字节数
+size_t hpackEncodeInt(uint8 *buf, uint8 first, int prefix, uint32 v);
+
+// 不索引的字面头部, 头部名引用静态表
+size_t hpackEncodeLiteral(uint8 *buf, uint32 nameIndex, const char *value);
+
+bool hpackDecodeInt(const uint8 *&p, const uint8 *end, int prefix, uint32 &v);
+
+// 取出字符串的位置和长度, 不做霍夫曼解码
+bool hpackDecodeString(const uint8 *&p, const uint8 *end, const uint8 *&str, uint32 &len, bool &huffman);
+
+// 解码:status的值, 出错返回-1
+int hpackDecodeStatus(const uint8 *str, uint32 len, bool huffman);
+
+/*
+ * 从响应头块中取出:status
+ * return 状态码, 没有:status返回0, 解码出错返回-1
+ */
+int hpackDecodeResponse(const uint8 *block, size_t len);
+
+NAMESPACE_END
+//--------------------------------------------------------------------------
+
+#endif // __HPACK_H__
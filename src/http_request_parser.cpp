@@ -0,0 +1,227 @@
+#include "http_request_parser.h"
+
+NAMESPACE_BEG(proxy)
+
+void HttpRequestParser::reset()
+{
+    mState = State_Method;
+    mTotalLen = 0;
+    mbConnect = false;
+
+    *mMethod = '\0';
+    mMethodLen = 0;
+    *mTarget = '\0';
+    mTargetLen = 0;
+    *mVersion = '\0';
+    mVersionLen = 0;
+
+    *mHost = '\0';
+    mPort = 0;
+    mPathOff = 0;
+}
+
+size_t HttpRequestParser::feed(const char *data, size_t datalen)
+{
+    size_t i = 0;
+    for (; i < datalen && mState != State_Done && mState != State_Error; ++i)
+    {
+        char c = data[i];
+
+        if (++mTotalLen > HTTP_REQUEST_MAX)
+        {
+            mState = State_Error;
+            break;
+        }
+
+        switch (mState)
+        {
+        case State_Method:
+            if (' ' == c)
+            {
+                mMethod[mMethodLen] = '\0';
+                mState = mMethodLen > 0 ? State_Target : State_Error;
+            }
+            else if (c < 'A' || c > 'Z' || mMethodLen + 1 >= sizeof(mMethod))
+            {
+                mState = State_Error;
+            }
+            else
+            {
+                mMethod[mMethodLen++] = c;
+            }
+            break;
+        case State_Target:
+            if (' ' == c)
+            {
+                mTarget[mTargetLen] = '\0';
+                mState = mTargetLen > 0 ? State_Version : State_Error;
+            }
+            else if ('\r' == c || '\n' == c || mTargetLen + 1 >= sizeof(mTarget))
+            {
+                mState = State_Error;
+            }
+            else
+            {
+                mTarget[mTargetLen++] = c;
+            }
+            break;
+        case State_Version:
+            if ('\r' == c || '\n' == c)
+            {
+                mVersion[mVersionLen] = '\0';
+                if ('\r' == c)
+                    mState = State_LineLF;
+                else if (!_onRequestLine())
+                    mState = State_Error;
+            }
+            else if (mVersionLen + 1 >= sizeof(mVersion))
+            {
+                mState = State_Error;
+            }
+            else
+            {
+                mVersion[mVersionLen++] = c;
+            }
+            break;
+        case State_LineLF:
+            if ('\n' != c || !_onRequestLine())
+                mState = State_Error;
+            break;
+        case State_HeaderStart:
+            if ('\r' == c)
+                mState = State_EndLF;
+            else if ('\n' == c)
+                mState = State_Done;
+            else
+                mState = State_Header;
+            break;
+        case State_Header:
+            if ('\r' == c)
+                mState = State_HeaderLF;
+            else if ('\n' == c)
+                mState = State_HeaderStart;
+            break;
+        case State_HeaderLF:
+            mState = '\n' == c ? State_HeaderStart : State_Error;
+            break;
+        case State_EndLF:
+            mState = '\n' == c ? State_Done : State_Error;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return i;
+}
+
+int HttpRequestParser::buildRequestLine(char *buf, size_t buflen) const
+{
+    if (State_Done != mState || mbConnect)
+        return -1;
+
+    const char *path = mTarget + mPathOff;
+    int n = snprintf(buf, buflen, "%s %s%s %s\r\n",
+                     mMethod, '/' == *path ? "" : "/", path, mVersion);
+    if (n < 0 || (size_t)n >= buflen)
+        return -1;
+
+    return n;
+}
+
+bool HttpRequestParser::_onRequestLine()
+{
+    if (strncmp(mVersion, "HTTP/1.", 7) != 0)
+        return false;
+
+    if (strcmp(mMethod, "CONNECT") == 0)
+    {
+        mbConnect = true;
+        if (!_parseAuthority(mTarget, mTarget + mTargetLen, 0))
+            return false;
+
+        mState = State_HeaderStart;
+        return true;
+    }
+
+    // absolute-URI, 仅支持http
+    static const char scheme[] = "http://";
+    const size_t schemelen = sizeof(scheme) - 1;
+    if (mTargetLen <= schemelen || strncasecmp(mTarget, scheme, schemelen) != 0)
+        return false;
+
+    const char *begin = mTarget + schemelen;
+    const char *end = begin;
+    while (*end && *end != '/' && *end != '?')
+        ++end;
+
+    if (!_parseAuthority(begin, end, 80))
+        return false;
+
+    mPathOff = end - mTarget;
+    mState = State_Done;
+    return true;
+}
+
+bool HttpRequestParser::_parseAuthority(const char *begin, const char *end, int defport)
+{
+    const char *hostbeg = begin, *hostend = NULL, *portbeg = NULL;
+
+    if (begin < end && '[' == *begin) // IPv6字面地址
+    {
+        hostbeg = begin + 1;
+        hostend = (const char *)memchr(hostbeg, ']', end - hostbeg);
+        if (NULL == hostend)
+            return false;
+
+        if (hostend + 1 < end)
+        {
+            if (hostend[1] != ':')
+                return false;
+            portbeg = hostend + 2;
+        }
+    }
+    else
+    {
+        hostend = end;
+        for (const char *p = begin; p < end; ++p)
+        {
+            if (':' == *p)
+            {
+                hostend = p;
+                portbeg = p + 1;
+                break;
+            }
+        }
+    }
+
+    size_t hostlen = hostend - hostbeg;
+    if (0 == hostlen || hostlen >= sizeof(mHost))
+        return false;
+
+    int port = defport;
+    if (portbeg)
+    {
+        if (portbeg >= end)
+            return false;
+
+        port = 0;
+        for (const char *p = portbeg; p < end; ++p)
+        {
+            if (*p < '0' || *p > '9' || port > 65535)
+                return false;
+            port = port*10 + (*p - '0');
+        }
+    }
+
+    if (!isValidPort(port))
+        return false;
+
+    memcpy(mHost, hostbeg, hostlen);
+    mHost[hostlen] = '\0';
+    mPort = port;
+
+    return true;
+}
+
+NAMESPACE_END // namespace proxy
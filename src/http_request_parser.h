@@ -0,0 +1,106 @@
+#ifndef __HTTP_REQUEST_PARSER_H__
+#define __HTTP_REQUEST_PARSER_H__
+
+#include "proxy_common.h"
+
+#define HTTP_METHOD_SIZE   16
+#define HTTP_VERSION_SIZE  16
+#define HTTP_URI_SIZE      2048
+#define HTTP_REQUEST_MAX   8192 // CONNECT请求头最大长度
+
+NAMESPACE_BEG(proxy)
+
+/*
+ * 本地客户端代理请求解析器(增量式, 不分配内存)
+ * 支持两种请求:
+ *   CONNECT host:port HTTP/1.1      解析完整个请求头
+ *   GET http://host[:port]/path ... 解析完请求行即结束, 请求头原样转发
+ */
+class HttpRequestParser
+{
+    enum EState
+    {
+        State_Method = 0,
+        State_Target,
+        State_Version,
+        State_LineLF,
+        State_HeaderStart,
+        State_Header,
+        State_HeaderLF,
+        State_EndLF,
+        State_Done,
+        State_Error,
+    };
+
+  public:
+    HttpRequestParser()
+    {
+        reset();
+    }
+
+    void reset();
+
+    /*
+     * 输入数据, 返回本次消耗的字节数
+     * 请求解析完成后不再消耗数据, 剩余数据属于请求之后的负载
+     */
+    size_t feed(const char *data, size_t datalen);
+
+    inline bool isDone() const
+    {
+        return State_Done == mState;
+    }
+
+    inline bool isError() const
+    {
+        return State_Error == mState;
+    }
+
+    inline bool isConnect() const
+    {
+        return mbConnect;
+    }
+
+    inline const char *getHost() const
+    {
+        return mHost;
+    }
+
+    inline int getPort() const
+    {
+        return mPort;
+    }
+
+    /*
+     * 生成转发给目标服务器的请求行(absolute-URI改写为origin-form)
+     * return 写入的字节数, 失败返回-1
+     */
+    int buildRequestLine(char *buf, size_t buflen) const;
+
+  private:
+    bool _onRequestLine();
+    bool _parseAuthority(const char *begin, const char *end, int defport);
+
+  private:
+    EState mState;
+    size_t mTotalLen;
+
+    bool mbConnect;
+
+    char mMethod[HTTP_METHOD_SIZE];
+    size_t mMethodLen;
+
+    char mTarget[HTTP_URI_SIZE];
+    size_t mTargetLen;
+
+    char mVersion[HTTP_VERSION_SIZE];
+    size_t mVersionLen;
+
+    char mHost[ADDR_SIZE];
+    int mPort;
+    size_t mPathOff; // 路径部分在mTarget中的偏移
+};
+
+NAMESPACE_END // namespace proxy
+
+#endif // __HTTP_REQUEST_PARSER_H__
@@ -0,0 +1,128 @@
+#include "http_response_parser.h"
+
+NAMESPACE_BEG(proxy)
+
+void HttpResponseParser::reset()
+{
+    mState = State_Version;
+    mTotalLen = 0;
+    mFieldLen = 0;
+    mStatus = 0;
+
+    *mStatusLine = '\0';
+    mStatusLineLen = 0;
+}
+
+size_t HttpResponseParser::feed(const char *data, size_t datalen)
+{
+    static const char version[] = "HTTP/1.";
+
+    size_t i = 0;
+    for (; i < datalen && mState != State_Done && mState != State_Error; ++i)
+    {
+        char c = data[i];
+
+        if (++mTotalLen > HTTP_RESPONSE_MAX)
+        {
+            mState = State_Error;
+            break;
+        }
+
+        switch (mState)
+        {
+        case State_Version: // "HTTP/1.x "
+            _appendStatusLine(c);
+            if (mFieldLen < sizeof(version) - 1)
+            {
+                if (c != version[mFieldLen++])
+                    mState = State_Error;
+            }
+            else if (mFieldLen == sizeof(version) - 1)
+            {
+                if (c < '0' || c > '9')
+                    mState = State_Error;
+                ++mFieldLen;
+            }
+            else if (' ' == c)
+            {
+                mState = State_Status;
+                mFieldLen = 0;
+            }
+            else
+            {
+                mState = State_Error;
+            }
+            break;
+        case State_Status: // 三位数字状态码
+            _appendStatusLine(c);
+            if (mFieldLen < 3)
+            {
+                if (c < '0' || c > '9')
+                    mState = State_Error;
+                else
+                    mStatus = mStatus*10 + (c - '0');
+                ++mFieldLen;
+            }
+            else if (' ' == c)
+                mState = State_Reason;
+            else if ('\r' == c)
+                mState = State_LineLF;
+            else if ('\n' == c)
+                mState = State_HeaderStart;
+            else
+                mState = State_Error;
+            break;
+        case State_Reason:
+            if ('\r' == c)
+                mState = State_LineLF;
+            else if ('\n' == c)
+                mState = State_HeaderStart;
+            else
+                _appendStatusLine(c);
+            break;
+        case State_LineLF:
+            mState = '\n' == c ? State_HeaderStart : State_Error;
+            break;
+        case State_HeaderStart:
+            if ('\r' == c)
+                mState = State_EndLF;
+            else if ('\n' == c)
+                mState = State_Done;
+            else
+                mState = State_Header;
+            break;
+        case State_Header:
+            {
+                // 字段内容不关心, 直接跳到行尾
+                const char *eol = '\n' == c ? data + i : (const char *)memchr(data + i + 1, '\n', datalen - i - 1);
+                size_t last = eol ? (size_t)(eol - data) : datalen - 1;
+
+                mTotalLen += last - i;
+                i = last;
+                if (mTotalLen > HTTP_RESPONSE_MAX)
+                    mState = State_Error;
+                else if (eol)
+                    mState = State_HeaderStart;
+            }
+            break;
+        case State_EndLF:
+            mState = '\n' == c ? State_Done : State_Error;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return i;
+}
+
+void HttpResponseParser::_appendStatusLine(char c)
+{
+    if (mStatusLineLen + 1 < sizeof(mStatusLine))
+    {
+        mStatusLine[mStatusLineLen++] = c;
+        mStatusLine[mStatusLineLen] = '\0';
+    }
+}
+
+NAMESPACE_END // namespace proxy
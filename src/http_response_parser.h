@@ -0,0 +1,86 @@
+#ifndef __HTTP_RESPONSE_PARSER_H__
+#define __HTTP_RESPONSE_PARSER_H__
+
+#include "proxy_common.h"
+
+#define HTTP_STATUS_LINE_SIZE 128         // 保留用于日志的状态行长度
+#define HTTP_RESPONSE_MAX     (64*1024)   // CONNECT响应头最大长度
+
+NAMESPACE_BEG(proxy)
+
+/*
+ * 上游代理CONNECT响应解析器(增量式, 不分配内存)
+ * 状态跨数据段保存, 每个字节只扫描一次; 响应头内容不保存, 仅受总长度限制
+ */
+class HttpResponseParser
+{
+    enum EState
+    {
+        State_Version = 0,
+        State_Status,
+        State_Reason,
+        State_LineLF,
+        State_HeaderStart,
+        State_Header,
+        State_EndLF,
+        State_Done,
+        State_Error,
+    };
+
+  public:
+    HttpResponseParser()
+    {
+        reset();
+    }
+
+    void reset();
+
+    /*
+     * 输入数据, 返回本次消耗的字节数
+     * 响应头解析完成后不再消耗数据, 剩余数据属于隧道负载(或代理链下一跳的响应)
+     */
+    size_t feed(const char *data, size_t datalen);
+
+    inline bool isDone() const
+    {
+        return State_Done == mState;
+    }
+
+    inline bool isError() const
+    {
+        return State_Error == mState;
+    }
+
+    // 2xx即视为隧道建立成功, 不检查原因短语
+    inline bool isSuccess() const
+    {
+        return State_Done == mState && mStatus >= 200 && mStatus < 300;
+    }
+
+    inline int getStatus() const
+    {
+        return mStatus;
+    }
+
+    inline const char *getStatusLine() const
+    {
+        return mStatusLine;
+    }
+
+  private:
+    void _appendStatusLine(char c);
+
+  private:
+    EState mState;
+    size_t mTotalLen;
+    size_t mFieldLen; // 当前字段(版本号/状态码)已读长度
+
+    int mStatus;
+
+    char mStatusLine[HTTP_STATUS_LINE_SIZE];
+    size_t mStatusLineLen;
+};
+
+NAMESPACE_END // namespace proxy
+
+#endif // __HTTP_RESPONSE_PARSER_H__
@@ -1,7 +1,28 @@
 #include "listener.h"
 
+#include <stddef.h>
+#include <sys/un.h>
+
 NAMESPACE_BEG(proxy)
 
+// 进程内所有监听共用一个预留fd, 不随监听数增加
+static int gReserveFd = -1;
+static std::vector<Listener *> gStarvedListeners;
+
+static bool openReserveFd()
+{
+    if (gReserveFd < 0)
+        gReserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return gReserveFd >= 0;
+}
+
+static bool isUnixSocket(int fd)
+{
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    return getsockname(fd, (sockaddr *)&addr, &addrlen) == 0 && AF_UNIX == addr.ss_family;
+}
+
 Listener::~Listener()
 {
     finalise();
@@ -29,19 +50,33 @@ bool Listener::initialise(const sockaddr *sa, socklen_t salen)
         return false;
     }
 
-    mFd = socket(AF_INET, SOCK_STREAM, 0);
+    mFd = socket(sa->sa_family, SOCK_STREAM, 0);
     if (mFd < 0)
     {
         ErrorPrint("[Listener::initialise] init socket error! %s", strerror(errno));
         return false;
     }
 
-    int opt = 1;
-    setsockopt(mFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (AF_INET == sa->sa_family)
+    {
+        int opt = 1;
+        setsockopt(mFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
 
 #ifdef SO_REUSEPORT
-    opt = 1;
-    setsockopt(mFd, SOL_SOCKET, SO_REUSEPORT, (const char*)&opt, sizeof(opt));
+        opt = 1;
+        setsockopt(mFd, SOL_SOCKET, SO_REUSEPORT, (const char*)&opt, sizeof(opt));
+#endif
+    }
+
+#ifdef IP_TRANSPARENT
+    if (mbTransparent && AF_INET == sa->sa_family)
+    {
+        int opt = 1;
+        if (setsockopt(mFd, SOL_IP, IP_TRANSPARENT, &opt, sizeof(opt)) < 0)
+        {
+            WarningPrint("[Listener::initialise] set IP_TRANSPARENT failed, only REDIRECT works! %s", strerror(errno));
+        }
+    }
 #endif
 
     // set nonblocking
@@ -57,17 +92,121 @@ bool Listener::initialise(const sockaddr *sa, socklen_t salen)
         goto err_1;
     }
 
-    if (listen(mFd, LISTENQ) < 0)
+    return _listen();
+
+err_1:
+    close(mFd);
+    mFd = -1;
+
+    return false;
+}
+
+bool Listener::initialiseUnix(const char *path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    size_t len = strlen(path);
+    if (0 == len || len >= sizeof(addr.sun_path))
+    {
+        ErrorPrint("[Listener::initialiseUnix] illegal path(%s)", path);
+        return false;
+    }
+
+    // 抽象命名空间: sun_path以'\0'开头, 地址长度即名字长度, 不在文件系统中留下文件
+    if ('@' == *path)
+    {
+        memcpy(addr.sun_path + 1, path + 1, len - 1);
+        return initialise((const sockaddr *)&addr, offsetof(struct sockaddr_un, sun_path) + len);
+    }
+
+    memcpy(addr.sun_path, path, len);
+
+    // 清理上次运行残留的套接字文件, 仍有进程在监听时不抢占
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        bool live = fd >= 0 && ::connect(fd, (const sockaddr *)&addr, sizeof(addr)) == 0;
+        if (fd >= 0)
+            close(fd);
+
+        if (live)
+        {
+            ErrorPrint("[Listener::initialiseUnix] %s is in use.", path);
+            return false;
+        }
+        unlink(path);
+    }
+
+    return initialise((const sockaddr *)&addr, sizeof(addr));
+}
+
+bool Listener::attach(int fd)
+{
+    if (mFd >= 0)
+    {
+        ErrorPrint("Listener already inited!");
+        close(fd);
+        return false;
+    }
+
+    mFd = fd;
+    if (!setNonblocking(mFd))
+    {
+        ErrorPrint("[Listener::attach] set nonblocking error! %s", strerror(errno));
+        close(mFd);
+        mFd = -1;
+        return false;
+    }
+
+#ifdef IP_TRANSPARENT
+    // 接管的fd可能来自透明属性不同的路由, 按当前配置重设
+    if (!isUnixSocket(mFd))
+    {
+        int opt = mbTransparent ? 1 : 0;
+        if (setsockopt(mFd, SOL_IP, IP_TRANSPARENT, &opt, sizeof(opt)) < 0 && mbTransparent)
+        {
+            WarningPrint("[Listener::attach] set IP_TRANSPARENT failed, only REDIRECT works! %s", strerror(errno));
+        }
+    }
+#endif
+
+    // 重新listen可按新的配置调整backlog
+    return _listen();
+}
+
+bool Listener::_listen()
+{
+    if (listen(mFd, mBacklog) < 0)
     {
         ErrorPrint("[Listener::initialise] listen failed! %s", strerror(errno));
         goto err_1;
     }
 
+#ifdef TCP_DEFER_ACCEPT
+    // Unix域套接字不支持TCP_DEFER_ACCEPT
+    if (mDeferAccept > 0 && !isUnixSocket(mFd) &&
+        setsockopt(mFd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &mDeferAccept, sizeof(mDeferAccept)) < 0)
+    {
+        WarningPrint("[Listener::initialise] set TCP_DEFER_ACCEPT failed! %s", strerror(errno));
+    }
+#endif
+
     if (!mEventPoller->registerForRead(mFd, this))
     {
         ErrorPrint("[Listener::initialise] registerForRead failed! %s", strerror(errno));
         goto err_1;
     }
+    mbPaused = false;
+    mbStarved = false;
+    mbRegistered = true;
+
+    if (!openReserveFd())
+    {
+        WarningPrint("[Listener::initialise] open reserve fd failed! %s", strerror(errno));
+    }
 
     return true;
 
@@ -83,23 +222,147 @@ void Listener::finalise()
     if (mFd < 0)
         return;
 
-    mEventPoller->deregisterForRead(mFd);
+    if (mbRegistered)
+        mEventPoller->deregisterForRead(mFd);
     close(mFd);
     mFd = -1;
+    mbPaused = false;
+    mbRegistered = false;
+
+    if (mbStarved)
+    {
+        gStarvedListeners.erase(std::find(gStarvedListeners.begin(), gStarvedListeners.end(), this));
+        mbStarved = false;
+    }
+}
+
+void Listener::pause()
+{
+    if (mFd < 0 || mbPaused)
+        return;
+
+    mbPaused = true;
+    _updateEvents();
+}
+
+void Listener::resume()
+{
+    if (mFd < 0 || !mbPaused)
+        return;
+
+    mbPaused = false;
+    _updateEvents();
+}
+
+void Listener::recoverStarved()
+{
+    if (gStarvedListeners.empty() || !openReserveFd())
+        return;
+
+    std::vector<Listener *> starved;
+    starved.swap(gStarvedListeners);
+    for (size_t i = 0; i < starved.size(); ++i)
+    {
+        starved[i]->mbStarved = false;
+        starved[i]->_updateEvents();
+    }
+    InfoPrint("[Listener::recoverStarved] fds available, resume %u listener(s).", (uint)starved.size());
+}
+
+void Listener::_updateEvents()
+{
+    bool want = !mbPaused && !mbStarved;
+    if (want == mbRegistered)
+        return;
+
+    if (!want)
+    {
+        mEventPoller->deregisterForRead(mFd);
+    }
+    else if (!mEventPoller->registerForRead(mFd, this))
+    {
+        // 下次状态变化时重试
+        ErrorPrint("[Listener::_updateEvents] registerForRead failed! %s", strerror(errno));
+        return;
+    }
+    mbRegistered = want;
+}
+
+void Listener::shedConnection()
+{
+    if (!openReserveFd())
+    {
+        // 没有预留的fd可用, 暂停接入, 待有fd释放后由recoverStarved()恢复, 期间不再空转accept
+        WarningPrint("[Listener::shedConnection] out of fds, pause accepting.");
+        if (!mbStarved)
+        {
+            mbStarved = true;
+            gStarvedListeners.push_back(this);
+            _updateEvents();
+        }
+    }
+    else
+    {
+        close(gReserveFd);
+        gReserveFd = -1;
+
+        int connfd = accept(mFd, NULL, NULL);
+        if (connfd >= 0)
+            close(connfd);
+
+        openReserveFd();
+        WarningPrint("[Listener::shedConnection] out of fds, connection dropped.");
+    }
+
+    if (mHandler)
+    {
+        mHandler->onOverload();
+    }
+}
+
+int Listener::acceptOne(sockaddr *addr, socklen_t *addrlen)
+{
+#ifdef SOCK_NONBLOCK
+    return accept4(mFd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    int connfd = accept(mFd, addr, addrlen);
+    if (connfd < 0)
+        return -1;
+
+    if (!setNonblocking(connfd))
+    {
+        ErrorPrint("[Listener::acceptOne] set nonblocking error! %s", strerror(errno));
+        close(connfd);
+        errno = EAGAIN;
+        return -1;
+    }
+    fcntl(connfd, F_SETFD, FD_CLOEXEC);
+    return connfd;
+#endif
 }
 
 int Listener::handleInputNotification(int fd)
 {
-    struct sockaddr_in addr;
+    struct sockaddr_storage addr;
     socklen_t addrlen;
     int newConns = 0;
-    while (newConns++ < 32)
+    bool drained = false;
+    while (newConns < mAcceptBudget && mbRegistered)
     {
         addrlen = sizeof(addr);
-        int connfd = accept(fd, (sockaddr *)&addr, &addrlen);
+        int connfd = acceptOne((sockaddr *)&addr, &addrlen);
         if (connfd < 0)
         {
             // DebugPrint("accept failed! %s", strerror(errno));
+            if (EMFILE == errno || ENFILE == errno)
+            {
+                shedConnection();
+            }
+            else if (EINTR == errno || ECONNABORTED == errno)
+            {
+                continue;
+            }
+            drained = true;
             break;
         }
         else
@@ -123,6 +386,7 @@ int Listener::handleInputNotification(int fd)
             }
 #endif
 
+            ++newConns;
             if (mHandler)
             {
                 mHandler->onAccept(connfd);
@@ -130,6 +394,16 @@ int Listener::handleInputNotification(int fd)
         }
     }
 
+    // 用完预算说明backlog中还有积压, 加倍; 一次就取空且远未用完则减半, 把时间让给已有隧道
+    if (!drained && newConns >= mAcceptBudget)
+    {
+        mAcceptBudget = min(mAcceptBudget * 2, mMaxAcceptBudget);
+    }
+    else if (drained && newConns < mAcceptBudget / 4)
+    {
+        mAcceptBudget = max(mAcceptBudget / 2, MIN_ACCEPT_BUDGET);
+    }
+
     return 0;
 }
 
@@ -4,6 +4,10 @@
 #include "proxy_common.h"
 #include "event_poller.h"
 
+#define DEFAULT_LISTEN_BACKLOG 1024 // 实际生效值受net.core.somaxconn限制
+#define DEFAULT_ACCEPT_BUDGET  64   // 每次可读事件最多accept的连接数
+#define MIN_ACCEPT_BUDGET      4
+
 NAMESPACE_BEG(proxy)
 
 class Listener : InputNotificationHandler
@@ -11,13 +15,25 @@ class Listener : InputNotificationHandler
   public:
     struct Handler
     {
+        // connfd已设置为非阻塞及close-on-exec
         virtual void onAccept(int connfd) = 0;
+
+        // 文件描述符耗尽, 已丢弃一个新连接或暂停了监听
+        virtual void onOverload() {}
     };
 
     Listener(EventPoller *poller)
             :mFd(-1)
             ,mHandler(NULL)
             ,mEventPoller(poller)
+            ,mbTransparent(false)
+            ,mBacklog(DEFAULT_LISTEN_BACKLOG)
+            ,mDeferAccept(0)
+            ,mMaxAcceptBudget(DEFAULT_ACCEPT_BUDGET)
+            ,mAcceptBudget(MIN_ACCEPT_BUDGET)
+            ,mbPaused(false)
+            ,mbStarved(false)
+            ,mbRegistered(false)
     {
         assert(mEventPoller && "Listener::mEventPoller != NULL");
     }
@@ -26,20 +42,100 @@ class Listener : InputNotificationHandler
 
     bool initialise(const char *ip, int port);
     bool initialise(const sockaddr *sa, socklen_t salen);
+    // 监听Unix域套接字, path以'@'开头时为抽象命名空间
+    bool initialiseUnix(const char *path);
+    // 接管一个已绑定的监听fd(如热升级时从旧进程继承), 失败时关闭该fd
+    bool attach(int fd);
     void finalise();
 
+    inline int getFd() const
+    {
+        return mFd;
+    }
+
     inline void setEventHandler(Handler *h)
     {
         mHandler = h;
     }
 
+    // 透明代理(TPROXY)需在initialise之前设置IP_TRANSPARENT
+    inline void setTransparent(bool b)
+    {
+        mbTransparent = b;
+    }
+
+    // 以下选项需在initialise之前设置
+    inline void setBacklog(int backlog)
+    {
+        mBacklog = backlog > 0 ? backlog : DEFAULT_LISTEN_BACKLOG;
+    }
+
+    // TCP_DEFER_ACCEPT: 客户端发来数据后才唤醒, 最多等待secs秒, 0为关闭
+    // 仅适用于客户端先发数据的协议
+    inline void setDeferAccept(int secs)
+    {
+        mDeferAccept = secs;
+    }
+
+    // 每次可读事件accept的连接数上限, 实际数量在[MIN_ACCEPT_BUDGET, budget]间自适应
+    inline void setAcceptBudget(int budget)
+    {
+        mMaxAcceptBudget = budget > MIN_ACCEPT_BUDGET ? budget : MIN_ACCEPT_BUDGET;
+        mAcceptBudget = min(mAcceptBudget, mMaxAcceptBudget);
+    }
+
+    /*
+     * 暂停/恢复接入, 暂停期间新连接留在内核的backlog中排队
+     */
+    void pause();
+    void resume();
+
+    inline bool isPaused() const
+    {
+        return mbPaused;
+    }
+
+    // fd耗尽又没有预留fd可用时自行暂停, 与pause()/resume()相互独立
+    inline bool isStarved() const
+    {
+        return mbStarved;
+    }
+
+    /*
+     * 有fd释放后调用(如隧道回收): 重新打开进程共用的预留fd, 成功时恢复所有因fd耗尽而暂停的监听
+     */
+    static void recoverStarved();
+
     // InputNotificationHandler
     virtual int handleInputNotification(int fd);
+
+  private:
+    // listen并注册读事件, 失败时关闭mFd
+    bool _listen();
+    // 按mbPaused/mbStarved注册或注销读事件
+    void _updateEvents();
+
+    int acceptOne(sockaddr *addr, socklen_t *addrlen);
+
+    // fd耗尽时用预留的fd接入并立即关闭新连接, 让客户端尽快失败而不是挂在backlog里
+    // 没有预留fd可用时暂停接入, 直到recoverStarved()
+    void shedConnection();
+
   private:
     int mFd;
     Handler *mHandler;
 
     EventPoller *mEventPoller;
+    bool mbTransparent;
+    int mBacklog;
+    int mDeferAccept;
+
+    int mMaxAcceptBudget;
+    int mAcceptBudget; // 当前每次可读事件的accept数量
+
+    bool mbPaused;     // 上层暂停(如达到并发上限)
+    bool mbStarved;    // 因fd耗尽暂停
+    bool mbRegistered; // 已注册读事件
 };
 
 NAMESPACE_END // namespace proxy
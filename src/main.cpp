@@ -5,49 +5,108 @@ using namespace proxy;
 
 void sigHandler(int signo)
 {
-    switch (signo)
+    // 信号处理函数中只能做异步信号安全的操作, 具体处理交给事件循环
+    if (gPrefork.isMaster())
+        gPrefork.notifySignal(signo);
+    else
+        gProxyClient.notifySignal(signo);
+}
+
+static void initLog()
+{
+    log_initialise(AllLog);
+    log_reg_console();
+    log_reg_filelog("log", "http-proxy-", "/tmp", "http-proxy-old-", "/tmp");
+}
+
+static const char *gConfigFile = NULL;
+static const char *gUpgradePath = NULL;
+static int gDrainTimeout = DEFAULT_DRAIN_TIMEOUT;
+static std::vector<RouteConfig> gRoutes;
+
+/*
+ * 运行代理直至退出, 单进程模式及多进程模式的工作进程共用
+ */
+static int runProxy(WorkerStats *stats)
+{
+    if (!gProxyClient.initialise())
     {
-    case SIGPIPE:
-        {
-            WarningPrint("broken pipe!");
-        }
-        break;
-    case SIGINT:
-        {
-            InfoPrint("catch SIGINT!");
-            gProxyClient.exitLoop();
-        }
-        break;
-    case SIGQUIT:
-        {
-            InfoPrint("catch SIGQUIT!");
-            gProxyClient.exitLoop();
-        }
-        break;
-    case SIGKILL:
-        {
-            InfoPrint("catch SIGKILL!");
-            gProxyClient.exitLoop();
-        }
-        break;
-    case SIGTERM:
-        {
-            InfoPrint("catch SIGTERM!");
-            gProxyClient.exitLoop();
-        }
-        break;
-    default:
-        break;
+        return 1;
+    }
+    gProxyClient.setSharedStats(stats);
+
+    // 热升级: 先接过旧进程的监听fd, 建好路由后旧进程才停止接入
+    if (gUpgradePath && !gProxyClient.takeoverListeners(gUpgradePath, gDrainTimeout))
+    {
+        gProxyClient.finalise();
+        return 1;
+    }
+
+    gProxyClient.setConfig(gConfigFile, gRoutes);
+    if (!gProxyClient.reloadConfig())
+    {
+        gProxyClient.finalise();
+        return 1;
     }
+
+    if (gUpgradePath && !gProxyClient.serveUpgrade(gUpgradePath))
+    {
+        gProxyClient.finalise();
+        return 1;
+    }
+
+    gProxyClient.runLoop();
+    gProxyClient.dumpStats();
+    gProxyClient.finalise();
+
+    return 0;
+}
+
+class WorkerLauncher : public Prefork::Handler
+{
+  public:
+    virtual int onWorkerStart(int index, WorkerStats *stats)
+    {
+        // 每个工作进程有独立的日志线程, 日志文件共用(逐行追加写入)
+        initLog();
+
+        if (stats->cpu >= 0)
+            InfoPrint("worker %d pinned to cpu %d.", index, stats->cpu);
+
+        int code = runProxy(stats);
+        log_finalise();
+        return code;
+    }
+
+    // fork时日志线程不会被复制, 先停掉, 之后在父子进程中各自重建
+    virtual void onForkPrepare()
+    {
+        log_finalise();
+    }
+
+    virtual void onForkParent()
+    {
+        initLog();
+    }
+};
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s -l listen_ip:port -t dest_host:port -r proxy_ip:port\n"
+            "       %s -R listen_ip:port|unix:path=dest_host:port|http|socks5[:user:pass]|transparent@[h2://]proxy_ip:port[>hop_host:port...][,...][+option=value...] [-R ...]\n"
+            "       [-c route_config_file] [-w workers | -U upgrade_sock_path [-D drain_timeout]] [-M mem_budget_mb]\n",
+            prog, prog);
 }
 
 int main(int argc, char *argv[])
 {
     int opt = 0;
     const char *bindaddr = NULL, *destaddr = NULL, *proxyaddr = NULL;
-    std::vector<std::string> vbindaddr, vdestaddr, vproxyaddr;
+    int workers = 0;
+    std::vector<RouteConfig> &routes = gRoutes;
 
-    while ((opt = getopt(argc, argv, "l:t:r:")) != -1)
+    while ((opt = getopt(argc, argv, "l:t:r:R:c:U:D:w:M:")) != -1)
     {
         switch (opt)
         {
@@ -59,58 +118,87 @@ int main(int argc, char *argv[])
             break;
         case 'r':
             proxyaddr = optarg;
-        default:
             break;
+        case 'c':
+            gConfigFile = optarg;
+            break;
+        case 'U':
+            gUpgradePath = optarg;
+            break;
+        case 'D':
+            gDrainTimeout = atoi(optarg);
+            break;
+        case 'w':
+            workers = atoi(optarg);
+            break;
+        case 'M':
+            // 每个进程各自的预算(MB), 多进程模式下总用量为其workers倍
+            if (atoi(optarg) < 0)
+            {
+                fprintf(stderr, "illegal memory budget: %s\n", optarg);
+                exit(1);
+            }
+            gMemoryBudget.setLimit((size_t)atoi(optarg) * 1024 * 1024);
+            break;
+        case 'R':
+            {
+                RouteConfig conf;
+                if (!parseRouteSpec(optarg, conf))
+                {
+                    fprintf(stderr, "route format error: %s\n", optarg);
+                    exit(1);
+                }
+                routes.push_back(conf);
+            }
+            break;
+        default:
+            usage(argv[0]);
+            exit(1);
         }
     }
 
-    if (!bindaddr)
-    {
-        fprintf(stderr, "no listen address\n");
-        exit(1);
-    }
-    if (!proxyaddr)
+    // 兼容单路由的 -l/-t/-r 参数
+    if (bindaddr || destaddr || proxyaddr)
     {
-        fprintf(stderr, "no proxy server\n");
-        exit(1);
-    }
-    if (!destaddr)
-    {
-        fprintf(stderr, "no target server\n");
-        exit(1);
-    }
-
-    split(std::string(bindaddr), ':', vbindaddr);
-    split(std::string(proxyaddr), ':', vproxyaddr);
-    split(std::string(destaddr), ':', vdestaddr);
+        if (!bindaddr)
+        {
+            fprintf(stderr, "no listen address\n");
+            exit(1);
+        }
+        if (!proxyaddr)
+        {
+            fprintf(stderr, "no proxy server\n");
+            exit(1);
+        }
+        if (!destaddr)
+        {
+            fprintf(stderr, "no target server\n");
+            exit(1);
+        }
 
-    if (vbindaddr.size() != 2 ||
-        vproxyaddr.size() != 2 ||
-        vdestaddr.size() != 2)
-    {
-        fprintf(stderr, "ip format error!\n");
-        exit(1);
+        RouteConfig conf;
+        Upstream up;
+        if (!parseHostPort(bindaddr, conf.listenIp, sizeof(conf.listenIp), &conf.listenPort) ||
+            !parseHostPort(proxyaddr, up.ip, sizeof(up.ip), &up.port) ||
+            !parseHostPort(destaddr, conf.destHost, sizeof(conf.destHost), &conf.destPort))
+        {
+            fprintf(stderr, "ip format error!\n");
+            exit(1);
+        }
+        conf.upstreams.push_back(up);
+        routes.push_back(conf);
     }
 
-    log_initialise(AllLog);
-    log_reg_console();
-    log_reg_filelog("log", "http-proxy-", "/tmp", "http-proxy-old-", "/tmp");
-
-    if (!gProxyClient.initialise(vbindaddr[0].c_str(), atoi(vbindaddr[1].c_str())))
+    if (routes.empty() && !gConfigFile)
     {
-        log_finalise();
+        usage(argv[0]);
         exit(1);
     }
-    if (!gProxyClient.setProxyServer(vproxyaddr[0].c_str(), atoi(vproxyaddr[1].c_str())))
-    {
-        gProxyClient.finalise();
-        log_finalise();
-        exit(1);
-    }
-    if (!gProxyClient.setDestServer(vdestaddr[0].c_str(), atoi(vdestaddr[1].c_str())))
+
+    // 监听fd分散在各工作进程中, 无法整体交接
+    if (workers > 0 && gUpgradePath)
     {
-        gProxyClient.finalise();
-        log_finalise();
+        fprintf(stderr, "-w and -U can not be used together\n");
         exit(1);
     }
 
@@ -124,13 +212,51 @@ int main(int argc, char *argv[])
 
     sigaction(SIGINT, &newAct, NULL);
     sigaction(SIGQUIT, &newAct, NULL);
+    sigaction(SIGHUP, &newAct, NULL);
 
     // sigaction(SIGKILL, &newAct, NULL);
     sigaction(SIGTERM, &newAct, NULL);
 
-    gProxyClient.runLoop();
+    int code = 0;
+    if (workers > 0)
+    {
+        initLog();
 
-    log_finalise();
+        // 先在主进程中检查配置文件, 避免工作进程反复启动失败
+        std::vector<RouteConfig> confs = gRoutes;
+        if (gConfigFile && !parseRouteFile(gConfigFile, confs))
+        {
+            log_finalise();
+            exit(1);
+        }
+        for (size_t i = 0; i < confs.size(); ++i)
+        {
+            if (*confs[i].listenUnix)
+            {
+                ErrorPrint("unix listener %s not supported with -w.", getListenName(confs[i]).c_str());
+                log_finalise();
+                exit(1);
+            }
+        }
+
+        WorkerLauncher launcher;
+        gPrefork.setEventHandler(&launcher);
+        if (!gPrefork.initialise(workers))
+        {
+            log_finalise();
+            exit(1);
+        }
+
+        code = gPrefork.run();
+        gPrefork.finalise();
+        log_finalise();
+    }
+    else
+    {
+        initLog();
+        code = runProxy(NULL);
+        log_finalise();
+    }
 
-    exit(0);
+    exit(code);
 }
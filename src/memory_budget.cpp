@@ -0,0 +1,123 @@
+#include "memory_budget.h"
+
+NAMESPACE_BEG(proxy)
+
+MemoryBudget gMemoryBudget;
+
+bool MemoryBudget::tryCharge(Handler *h, size_t len)
+{
+    if (mLimit > 0 && mUsed + len > mLimit)
+    {
+        reclaim(mUsed + len - mLimit, h);
+        if (mUsed + len > mLimit)
+            return false;
+    }
+
+    charge(h, len);
+    return true;
+}
+
+void MemoryBudget::charge(Handler *h, size_t len)
+{
+    mUsed += len;
+    if (mUsed > mPeak)
+        mPeak = mUsed;
+
+    if (h && !h->mbBudgetLinked)
+        link(h);
+}
+
+void MemoryBudget::uncharge(size_t len)
+{
+    mUsed -= min(mUsed, len);
+}
+
+bool MemoryBudget::canBurst(size_t len) const
+{
+    return mLimit > 0 && mUsed + len <= (size_t)(mLimit * MEMORY_BUDGET_BURST_RATIO);
+}
+
+bool MemoryBudget::hasRoom(size_t len) const
+{
+    return 0 == mLimit || mUsed + len <= mLimit;
+}
+
+void MemoryBudget::touch(Handler *h)
+{
+    if (!h->mbBudgetLinked || h == mTail)
+        return;
+
+    detach(h);
+    link(h);
+}
+
+void MemoryBudget::detach(Handler *h)
+{
+    if (!h->mbBudgetLinked)
+        return;
+
+    if (h->mPrevBudget)
+        h->mPrevBudget->mNextBudget = h->mNextBudget;
+    else
+        mHead = h->mNextBudget;
+
+    if (h->mNextBudget)
+        h->mNextBudget->mPrevBudget = h->mPrevBudget;
+    else
+        mTail = h->mPrevBudget;
+
+    h->mPrevBudget = h->mNextBudget = NULL;
+    h->mbBudgetLinked = false;
+}
+
+void MemoryBudget::dumpStats() const
+{
+    if (0 == mLimit)
+        return;
+
+    InfoPrint("[stats] memory budget limit=%llu used=%llu peak=%llu spilled=%llu",
+              (uint64)mLimit, (uint64)mUsed, (uint64)mPeak, mSpilled);
+}
+
+void MemoryBudget::link(Handler *h)
+{
+    h->mPrevBudget = mTail;
+    h->mNextBudget = NULL;
+    if (mTail)
+        mTail->mNextBudget = h;
+    else
+        mHead = h;
+    mTail = h;
+    h->mbBudgetLinked = true;
+}
+
+size_t MemoryBudget::reclaim(size_t want, Handler *except)
+{
+    size_t freed = 0;
+    Handler *h = mHead;
+    while (h && freed < want)
+    {
+        // onSpill()中可能detach自身
+        Handler *next = h->mNextBudget;
+        if (h != except)
+        {
+            size_t n = h->onSpill();
+            freed += n;
+            mSpilled += n;
+
+            // 暂时无法溢出的不再参与扫描, 下次申请内存时重新加入
+            if (0 == n)
+                detach(h);
+        }
+        h = next;
+    }
+
+    if (freed > 0)
+    {
+        DebugPrint("[MemoryBudget::reclaim] spilled %llu bytes, used=%llu limit=%llu",
+                   (uint64)freed, (uint64)mUsed, (uint64)mLimit);
+    }
+    return freed;
+}
+
+NAMESPACE_END // namespace proxy
@@ -0,0 +1,106 @@
+#ifndef __MEMORY_BUDGET_H__
+#define __MEMORY_BUDGET_H__
+
+#include "proxy_common.h"
+
+NAMESPACE_BEG(proxy)
+
+#define MEMORY_BUDGET_BURST_RATIO 0.5 // 总用量低于预算的该比例时, 单个隧道可超出自身上限
+
+/*
+ * 进程内所有隧道缓存(Cache)及连接发送队列共用的内存预算
+ * 超出预算时, 按最久未flush的顺序让Cache把内存中的数据溢出到磁盘
+ * 发送队列不能溢出, 只计入用量
+ * 预算为0时不限制, 各Cache只受自身上限约束
+ */
+class MemoryBudget
+{
+  public:
+    // 可溢出的内存使用者, 按最近一次flush的时间串成LRU链表
+    class Handler
+    {
+      public:
+        Handler()
+                :mPrevBudget(NULL)
+                ,mNextBudget(NULL)
+                ,mbBudgetLinked(false)
+        {}
+
+        // 把内存中的数据溢出到磁盘, 返回释放的字节数
+        virtual size_t onSpill() = 0;
+
+      private:
+        friend class MemoryBudget;
+
+        Handler *mPrevBudget;
+        Handler *mNextBudget;
+        bool mbBudgetLinked;
+    };
+
+    MemoryBudget()
+            :mLimit(0)
+            ,mUsed(0)
+            ,mPeak(0)
+            ,mSpilled(0)
+            ,mHead(NULL)
+            ,mTail(NULL)
+    {}
+
+    inline void setLimit(size_t limit)
+    {
+        mLimit = limit;
+    }
+
+    inline size_t getLimit() const
+    {
+        return mLimit;
+    }
+
+    inline size_t getUsed() const
+    {
+        return mUsed;
+    }
+
+    /*
+     * 为h申请len字节, 超出预算时先溢出其他使用者
+     * return false 预算不足, 调用方应改存磁盘
+     */
+    bool tryCharge(Handler *h, size_t len);
+
+    // 无条件计入用量, h为NULL表示不可溢出的使用者(如发送队列)
+    void charge(Handler *h, size_t len);
+    void uncharge(size_t len);
+
+    // 总体空闲, 允许超出单个隧道的上限
+    bool canBurst(size_t len) const;
+
+    // 再用len字节仍不超出预算(不溢出其他使用者), 用于可有可无的缓冲(如预读)
+    bool hasRoom(size_t len) const;
+
+    // h刚flush过, 移到LRU链表尾部
+    void touch(Handler *h);
+    // h已不占用内存
+    void detach(Handler *h);
+
+    void dumpStats() const;
+
+  private:
+    void link(Handler *h);
+    // 从最久未flush的使用者开始溢出, 直到释放want字节
+    size_t reclaim(size_t want, Handler *except);
+
+  private:
+    size_t mLimit;
+    size_t mUsed;
+    size_t mPeak;
+    uint64 mSpilled; // 累计因预算不足溢出的字节数
+
+    Handler *mHead; // 最久未flush
+    Handler *mTail;
+};
+
+extern MemoryBudget gMemoryBudget;
+
+NAMESPACE_END // namespace proxy
+
+#endif // __MEMORY_BUDGET_H__
@@ -0,0 +1,182 @@
+#include "mmap_cache.h"
+
+#include <sys/mman.h>
+
+NAMESPACE_BEG(proxy)
+
+MmapDiskCache::~MmapDiskCache()
+{
+    clear();
+}
+
+ssize_t MmapDiskCache::write(const void *data, size_t datalen)
+{
+    assert(data && datalen > 0);
+
+    // 记录没有边界, 段尾放不下的部分写入后续的段
+    // 先分配好所需的段, 失败时整条不写, 由Cache改存内存
+    size_t room = mSegments.empty() ? 0 : MMAP_CACHE_SEGMENT - mSegments.back().wpos;
+    size_t count = mSegments.size();
+    size_t tail = mSegments.empty() ? 0 : count - 1;
+    for (; room < datalen; room += MMAP_CACHE_SEGMENT)
+    {
+        if (!_allocSegment())
+        {
+            while (mSegments.size() > count)
+            {
+                Segment seg = mSegments.back();
+                mSegments.pop_back();
+                _releaseSegment(seg);
+            }
+            return -1;
+        }
+    }
+
+    const char *ptr = (const char *)data;
+    size_t left = datalen;
+    for (size_t i = tail; left > 0; ++i)
+    {
+        Segment &seg = mSegments[i];
+        size_t n = min(left, (size_t)MMAP_CACHE_SEGMENT - seg.wpos);
+        memcpy(seg.base + seg.wpos, ptr, n);
+        seg.wpos += n;
+        ptr += n;
+        left -= n;
+    }
+
+    return datalen;
+}
+
+size_t MmapDiskCache::front(const void **data, int *fd, off_t *off)
+{
+    if (mSegments.empty())
+        return 0;
+
+    Segment &seg = mSegments.front();
+    *data = seg.base + seg.rpos;
+    return seg.wpos - seg.rpos;
+}
+
+void MmapDiskCache::consume(size_t n)
+{
+    if (mSegments.empty())
+        return;
+
+    Segment &seg = mSegments.front();
+    seg.rpos = min(seg.rpos + n, seg.wpos);
+    if (seg.rpos < seg.wpos)
+        return;
+
+    // 最后一段读完时原地复用
+    if (mSegments.size() == 1)
+    {
+        seg.rpos = seg.wpos = 0;
+        return;
+    }
+
+    Segment drained = seg;
+    mSegments.pop_front();
+    _releaseSegment(drained);
+}
+
+void MmapDiskCache::clear()
+{
+    SegmentList::iterator it = mSegments.begin();
+    for (; it != mSegments.end(); ++it)
+    {
+        _unmapSegment(*it);
+    }
+    mSegments.clear();
+
+    for (size_t i = 0; i < mSpares.size(); ++i)
+    {
+        _unmapSegment(mSpares[i]);
+    }
+    mSpares.clear();
+    mFreeOffs.clear();
+
+    if (mFd >= 0)
+    {
+        close(mFd);
+        mFd = -1;
+    }
+    mFileSize = 0;
+}
+
+bool MmapDiskCache::_allocSegment()
+{
+    Segment seg;
+    if (!mSpares.empty())
+    {
+        seg = mSpares.back();
+        mSpares.pop_back();
+    }
+    else
+    {
+        if (mFd < 0)
+        {
+            mFd = createTempFile(SPILL_FILE_PREFIX);
+            if (mFd < 0)
+                return false;
+        }
+
+        if (!mFreeOffs.empty())
+        {
+            seg.off = mFreeOffs.back();
+            mFreeOffs.pop_back();
+        }
+        else
+        {
+            seg.off = mFileSize;
+        }
+
+        // 先分配好磁盘块, 否则磁盘满时写映射页会收到SIGBUS
+        int err = posix_fallocate(mFd, seg.off, MMAP_CACHE_SEGMENT);
+        if (err != 0)
+        {
+            ErrorPrint("[MmapDiskCache::_allocSegment] fallocate failed! %s", strerror(err));
+            if (seg.off < mFileSize)
+                mFreeOffs.push_back(seg.off);
+            return false;
+        }
+        if (seg.off == mFileSize)
+            mFileSize += MMAP_CACHE_SEGMENT;
+
+        void *p = mmap(NULL, MMAP_CACHE_SEGMENT, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, seg.off);
+        if (MAP_FAILED == p)
+        {
+            ErrorPrint("[MmapDiskCache::_allocSegment] mmap failed! %s", strerror(errno));
+            mFreeOffs.push_back(seg.off);
+            return false;
+        }
+        seg.base = (char *)p;
+    }
+
+    seg.rpos = seg.wpos = 0;
+    mSegments.push_back(seg);
+    return true;
+}
+
+void MmapDiskCache::_releaseSegment(const Segment &seg)
+{
+    if (mSpares.size() < MMAP_CACHE_SPARES)
+    {
+        mSpares.push_back(seg);
+        return;
+    }
+
+    _unmapSegment(seg);
+
+#ifdef FALLOC_FL_PUNCH_HOLE
+    // 丢弃已读数据的页缓存(不必回写)并释放磁盘空间, 区间留待复用
+    fallocate(mFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, seg.off, MMAP_CACHE_SEGMENT);
+#endif
+    mFreeOffs.push_back(seg.off);
+}
+
+void MmapDiskCache::_unmapSegment(const Segment &seg)
+{
+    munmap(seg.base, MMAP_CACHE_SEGMENT);
+}
+
+NAMESPACE_END // namespace proxy
@@ -0,0 +1,71 @@
+#ifndef __MMAP_CACHE_H__
+#define __MMAP_CACHE_H__
+
+#include "proxy_common.h"
+#include "disk_cache.h"
+
+NAMESPACE_BEG(proxy)
+
+#define MMAP_CACHE_SEGMENT (1024*1024) // 映射段大小
+#define MMAP_CACHE_SPARES  2           // 读完后留作复用的映射段数
+
+/*
+ * 以mmap映射的临时文件做溢出的DiskCache后端
+ * 文件按固定大小分段映射, 数据直接拷贝进映射页, 由内核页缓存吸收突发并按需回写
+ * front()直接返回映射页中的数据, 发送时不再读到新分配的内存中
+ * 读完的段留少量复用, 其余解除映射并释放其页缓存和磁盘空间
+ */
+class MmapDiskCache
+{
+  public:
+    MmapDiskCache()
+            :mFd(-1)
+            ,mFileSize(0)
+            ,mSegments()
+            ,mSpares()
+            ,mFreeOffs()
+    {}
+
+    virtual ~MmapDiskCache();
+
+    ssize_t write(const void *data, size_t datalen);
+
+    // 取出待发送的连续数据, 在consume()前一直有效, 没有数据时返回0
+    // 映射页已在内存中, 不使用fd/off
+    size_t front(const void **data, int *fd = NULL, off_t *off = NULL);
+    // 已发送front()返回数据的前n字节
+    void consume(size_t n);
+
+    void clear();
+
+    // 同步读写, 不会回调
+    inline void setEventHandler(SpillEventHandler *h)
+    {}
+
+  private:
+    struct Segment
+    {
+        char *base;
+        off_t off;   // 在文件中的位置
+        size_t rpos;
+        size_t wpos;
+    };
+
+    typedef std::deque<Segment> SegmentList;
+
+    bool _allocSegment();
+    void _releaseSegment(const Segment &seg);
+    void _unmapSegment(const Segment &seg);
+
+  private:
+    int mFd;
+    off_t mFileSize;
+
+    SegmentList mSegments;         // 按写入顺序, 只有最后一段可写
+    std::vector<Segment> mSpares;  // 读完留作复用的段
+    std::vector<off_t> mFreeOffs;  // 文件中已释放可复用的区间
+};
+
+NAMESPACE_END // namespace proxy
+
+#endif // __MMAP_CACHE_H__
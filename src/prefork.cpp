@@ -0,0 +1,257 @@
+#include "prefork.h"
+
+#include <sys/mman.h>
+#ifdef __linux__
+# include <sched.h>
+# include <sys/prctl.h>
+#endif
+
+NAMESPACE_BEG(proxy)
+
+Prefork gPrefork;
+
+Prefork::~Prefork()
+{
+    finalise();
+}
+
+bool Prefork::initialise(int workers)
+{
+    if (workers <= 0 || workers > PREFORK_MAX_WORKERS)
+    {
+        ErrorPrint("[Prefork::initialise] illegal worker count(%d), max %d.", workers, PREFORK_MAX_WORKERS);
+        return false;
+    }
+
+    // 匿名共享映射, fork后主进程与工作进程看到同一份计数
+    void *p = mmap(NULL, sizeof(WorkerStats) * workers, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == p)
+    {
+        ErrorPrint("[Prefork::initialise] mmap stats failed! %s", strerror(errno));
+        return false;
+    }
+    memset(p, 0, sizeof(WorkerStats) * workers);
+
+    mStats = (WorkerStats *)p;
+    mWorkers = workers;
+    mbMaster = true;
+    return true;
+}
+
+void Prefork::finalise()
+{
+    if (mStats)
+    {
+        munmap(mStats, sizeof(WorkerStats) * mWorkers);
+        mStats = NULL;
+    }
+    mWorkers = 0;
+}
+
+int Prefork::run()
+{
+    assert(mHandler && mStats && "Prefork::run() not inited");
+
+    mLastStatsTime = getClock64();
+    while (!mbExit)
+    {
+        reapWorkers();
+
+        uint64 now = getClock64();
+        for (int i = 0; i < mWorkers && !mbExit; ++i)
+        {
+            // 避免启动即崩溃的工作进程被反复快速拉起
+            if (0 == mPids[i] && now - mStartTime[i] >= PREFORK_RESPAWN_DELAY*1000)
+            {
+                spawnWorker(i);
+            }
+        }
+
+        if (mbReload)
+        {
+            mbReload = false;
+            InfoPrint("[Prefork::run] reload workers.");
+            signalWorkers(SIGHUP);
+        }
+
+        if (now - mLastStatsTime >= PREFORK_STATS_INTERVAL*1000)
+        {
+            mLastStatsTime = now;
+            dumpStats();
+        }
+
+        // 信号会打断sleep
+        if (!mbExit)
+            sleep(1);
+    }
+
+    InfoPrint("[Prefork::run] stop workers.");
+    signalWorkers(SIGTERM);
+    for (int i = 0; i < mWorkers; ++i)
+    {
+        if (mPids[i] > 0)
+        {
+            waitpid(mPids[i], NULL, 0);
+            mPids[i] = 0;
+        }
+    }
+    dumpStats();
+
+    return 0;
+}
+
+void Prefork::notifySignal(int signo)
+{
+    switch (signo)
+    {
+    case SIGHUP:
+        mbReload = true;
+        break;
+    case SIGINT:
+    case SIGQUIT:
+    case SIGTERM:
+        mbExit = true;
+        break;
+    default:
+        break;
+    }
+}
+
+void Prefork::spawnWorker(int index)
+{
+    mStartTime[index] = getClock64();
+
+    // fork时不能有其他线程持有锁
+    mHandler->onForkPrepare();
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        mHandler->onForkParent();
+        ErrorPrint("[Prefork::spawnWorker] fork worker %d failed! %s", index, strerror(errno));
+        return;
+    }
+
+    if (0 == pid)
+    {
+        mbMaster = false;
+
+#ifdef __linux__
+        // 主进程退出时工作进程随之退出
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+        WorkerStats *stats = &mStats[index];
+        memset((void *)stats, 0, sizeof(*stats));
+        stats->pid = getpid();
+        stats->cpu = pinCpu(index);
+
+        int code = mHandler->onWorkerStart(index, stats);
+        exit(code);
+    }
+
+    mHandler->onForkParent();
+
+    mPids[index] = pid;
+    if (mRestarts[index]++ > 0)
+    {
+        WarningPrint("[Prefork::spawnWorker] worker %d restarted, pid=%d", index, pid);
+    }
+    else
+    {
+        InfoPrint("[Prefork::spawnWorker] worker %d started, pid=%d", index, pid);
+    }
+}
+
+void Prefork::reapWorkers()
+{
+    int status = 0;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        for (int i = 0; i < mWorkers; ++i)
+        {
+            if (mPids[i] != pid)
+                continue;
+
+            mPids[i] = 0;
+            if (WIFSIGNALED(status))
+            {
+                ErrorPrint("[Prefork::reapWorkers] worker %d(pid=%d) killed by signal %d.", i, pid, WTERMSIG(status));
+            }
+            else
+            {
+                WarningPrint("[Prefork::reapWorkers] worker %d(pid=%d) exited with %d.", i, pid, WEXITSTATUS(status));
+            }
+            break;
+        }
+    }
+}
+
+void Prefork::signalWorkers(int signo)
+{
+    for (int i = 0; i < mWorkers; ++i)
+    {
+        if (mPids[i] > 0)
+        {
+            kill(mPids[i], signo);
+        }
+    }
+}
+
+void Prefork::dumpStats()
+{
+    WorkerStats total;
+    memset(&total, 0, sizeof(total));
+
+    for (int i = 0; i < mWorkers; ++i)
+    {
+        const WorkerStats &s = mStats[i];
+        InfoPrint("[stats] worker %d pid=%d cpu=%d restarts=%u accepted=%llu active=%llu closed=%llu failed=%llu retried=%llu",
+                  i, (int)mPids[i], s.cpu, mRestarts[i] > 0 ? mRestarts[i] - 1 : 0,
+                  s.accepted, s.active, s.closed, s.failed, s.retried);
+
+        total.accepted += s.accepted;
+        total.active += s.active;
+        total.closed += s.closed;
+        total.failed += s.failed;
+        total.retried += s.retried;
+    }
+
+    InfoPrint("[stats] total accepted=%llu active=%llu closed=%llu failed=%llu retried=%llu",
+              total.accepted, total.active, total.closed, total.failed, total.retried);
+}
+
+int Prefork::pinCpu(int index)
+{
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+    {
+        return -1;
+    }
+
+    int count = CPU_COUNT(&allowed);
+    if (count <= 0)
+    {
+        return -1;
+    }
+
+    // 取第(index % count)个允许使用的CPU
+    int nth = index % count;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (!CPU_ISSET(cpu, &allowed) || nth-- > 0)
+            continue;
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return sched_setaffinity(0, sizeof(set), &set) < 0 ? -1 : cpu;
+    }
+#endif
+
+    return -1;
+}
+
+NAMESPACE_END // namespace proxy
@@ -0,0 +1,113 @@
+#ifndef __PREFORK_H__
+#define __PREFORK_H__
+
+#include "proxy_common.h"
+
+#define PREFORK_MAX_WORKERS    64
+#define PREFORK_STATS_INTERVAL 60 // 主进程汇总统计信息的间隔(s)
+#define PREFORK_RESPAWN_DELAY  1  // 工作进程退出后重新拉起的最小间隔(s)
+
+NAMESPACE_BEG(proxy)
+
+// 工作进程发布到共享内存中的计数, 只由对应的工作进程写
+struct WorkerStats
+{
+    volatile pid_t pid;
+    volatile int cpu; // 绑定的CPU, -1为未绑定
+    volatile uint64 accepted;
+    volatile uint64 failed;
+    volatile uint64 closed;
+    volatile uint64 active;
+    volatile uint64 retried;
+};
+
+/*
+ * 多进程模式: 主进程fork出N个工作进程并监管, 工作进程各自运行完整的ProxyClient
+ * 工作进程以SO_REUSEPORT各自监听, 由内核分配连接, 某个工作进程崩溃只影响其上的隧道
+ */
+class Prefork
+{
+  public:
+    class Handler
+    {
+      public:
+        Handler() {}
+
+        // 工作进程入口, 需自行初始化日志等模块, 返回值为进程退出码
+        virtual int onWorkerStart(int index, WorkerStats *stats) = 0;
+
+        // fork前后由主进程调用, 用于停止/重建带线程的模块(如日志)
+        virtual void onForkPrepare() = 0;
+        virtual void onForkParent() = 0;
+    };
+
+    Prefork()
+            :mHandler(NULL)
+            ,mWorkers(0)
+            ,mStats(NULL)
+            ,mbMaster(false)
+            ,mbExit(false)
+            ,mbReload(false)
+            ,mLastStatsTime(0)
+    {
+        memset(mPids, 0, sizeof(mPids));
+        memset(mStartTime, 0, sizeof(mStartTime));
+        memset(mRestarts, 0, sizeof(mRestarts));
+    }
+
+    virtual ~Prefork();
+
+    bool initialise(int workers);
+    void finalise();
+
+    inline void setEventHandler(Handler *h)
+    {
+        mHandler = h;
+    }
+
+    inline bool isMaster() const
+    {
+        return mbMaster;
+    }
+
+    /*
+     * 拉起工作进程并监管, 直到收到退出信号
+     * 只在主进程中返回, 工作进程在onWorkerStart返回后直接退出
+     */
+    int run();
+
+    // 在信号处理函数中调用
+    void notifySignal(int signo);
+
+  private:
+    void spawnWorker(int index);
+    void reapWorkers();
+    void signalWorkers(int signo);
+    void dumpStats();
+
+    // 把当前进程绑定到第index个可用的CPU上, 返回CPU编号, 失败返回-1
+    // 在fork出的子进程中调用, 此时日志尚未初始化
+    static int pinCpu(int index);
+
+  private:
+    Handler *mHandler;
+    int mWorkers;
+
+    WorkerStats *mStats; // 共享内存, 每个工作进程一个槽位
+
+    pid_t mPids[PREFORK_MAX_WORKERS];
+    uint64 mStartTime[PREFORK_MAX_WORKERS];
+    uint32 mRestarts[PREFORK_MAX_WORKERS];
+
+    bool mbMaster;
+    volatile sig_atomic_t mbExit;
+    volatile sig_atomic_t mbReload;
+
+    uint64 mLastStatsTime;
+};
+
+extern Prefork gPrefork;
+
+NAMESPACE_END // namespace proxy
+
+#endif // __PREFORK_H__
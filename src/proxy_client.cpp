@@ -9,7 +9,7 @@ ProxyClient gProxyClient;
 ProxyClient::~ProxyClient()
 {}
 
-bool ProxyClient::initialise(const char *ip, int port)
+bool ProxyClient::initialise()
 {
     if (mInited)
     {
@@ -19,22 +19,37 @@ bool ProxyClient::initialise(const char *ip, int port)
     mEventPoller = new SelectPoller();
     assert(mEventPoller && "alloc event poller failed.");
 
-    mListener = new Listener(mEventPoller);
-    assert(mListener && "alloc listener failed.");
+    mH2Pool = new H2SessionPool(mEventPoller);
+    assert(mH2Pool && "alloc h2 session pool failed.");
 
-    if (!mListener->initialise(ip, port))
+    if (pipe(mSignalPipe) < 0)
     {
-        ErrorPrint("bind %s:d failed.", ip, port);
-
-        delete mListener;
-        mListener = NULL;
-
-        delete mEventPoller;
-        mEventPoller = NULL;
-
+        ErrorPrint("[ProxyClient::initialise] create signal pipe failed! %s", strerror(errno));
         return false;
     }
-    mListener->setEventHandler(this);
+    setNonblocking(mSignalPipe[0]);
+    setNonblocking(mSignalPipe[1]);
+    fcntl(mSignalPipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(mSignalPipe[1], F_SETFD, FD_CLOEXEC);
+    mEventPoller->registerForRead(mSignalPipe[0], this);
+
+    // 失败时溢出文件在事件循环中同步读写
+    if (!gSpillIo.initialise(mEventPoller))
+    {
+        WarningPrint("[ProxyClient::initialise] start spill io thread failed, spill synchronously.");
+    }
+
+#ifdef _USE_KMEM
+    mTunSlab = ikmem_create("proxy_tunnel", sizeof(ProxyTunnel));
+    if (!mTunSlab)
+    {
+        WarningPrint("[ProxyClient::initialise] create tunnel slab failed, use heap instead.");
+    }
+#endif
+
+    mLastStatsTime = getClock64();
+    mLastPoolTime = mLastStatsTime;
+    mTimerWheel.initialise(mLastStatsTime);
 
     mInited = true;
     return true;
@@ -48,53 +63,392 @@ void ProxyClient::finalise()
     }
     mInited = false;
 
-    TunnelSet::iterator itSet;
-    for (itSet = mBrokenTuns.begin(); itSet != mBrokenTuns.end(); itSet++)
+    if (mUpgrade)
+    {
+        mUpgrade->finalise();
+        delete mUpgrade;
+        mUpgrade = NULL;
+    }
+
+    // 关闭HTTP/2会话时其上的隧道会进入mBrokenTuns
+    mH2Pool->finalise();
+    delete mH2Pool;
+    mH2Pool = NULL;
+
+    while (!mBrokenTuns.empty())
+    {
+        destroyTunnel(mBrokenTuns.pop());
+    }
+
+    while (!mFreeTuns.empty())
     {
-        delete *itSet;
+        destroyTunnel(mFreeTuns.pop());
     }
-    mBrokenTuns.clear();
 
-    TunnelList::iterator it;
-    for (it = mFreeTuns.begin(); it != mFreeTuns.end(); it++)
+#ifdef _USE_KMEM
+    // 仍在使用中的隧道随进程退出, 不再逐个析构
+    if (mTunSlab)
     {
-        delete *it;
+        ikmem_delete(mTunSlab);
+        mTunSlab = NULL;
     }
-    mFreeTuns.clear();
+#endif
 
-    mListener->finalise();
+    RouteList::iterator itRoute;
+    for (itRoute = mRoutes.begin(); itRoute != mRoutes.end(); itRoute++)
+    {
+        (*itRoute)->finalise();
+        delete *itRoute;
+    }
+    mRoutes.clear();
+
+    for (itRoute = mRetiredRoutes.begin(); itRoute != mRetiredRoutes.end(); itRoute++)
+    {
+        delete *itRoute;
+    }
+    mRetiredRoutes.clear();
+
+    gSpillIo.finalise();
 
-    delete mListener;
-    mListener = NULL;
+    mEventPoller->deregisterForRead(mSignalPipe[0]);
+    close(mSignalPipe[0]);
+    close(mSignalPipe[1]);
+    mSignalPipe[0] = mSignalPipe[1] = -1;
 
     delete mEventPoller;
     mEventPoller = NULL;
 }
 
-bool ProxyClient::setDestServer(const char *hostname, int port)
+bool ProxyClient::takeoverListeners(const char *path, int drainTimeout)
 {
-    snprintf(mDestHost, sizeof(mDestHost), "%s", hostname);
-    mDestPort = port;
+    if (!mInited)
+    {
+        ErrorPrint("[ProxyClient::takeoverListeners] proxy client not inited.");
+        return false;
+    }
 
-    return true;
+    if (!mUpgrade)
+    {
+        mUpgrade = new HotUpgrade(mEventPoller, &mTimerWheel);
+        assert(mUpgrade && "alloc hot upgrade failed.");
+        mUpgrade->setEventHandler(this);
+    }
+    mDrainTimeout = drainTimeout;
+
+    return mUpgrade->takeover(path);
 }
 
-bool ProxyClient::setProxyServer(const char *ip, int port)
+bool ProxyClient::serveUpgrade(const char *path)
 {
-    struct sockaddr_in tmpaddr;
+    if (!mUpgrade)
+    {
+        ErrorPrint("[ProxyClient::serveUpgrade] takeoverListeners not called.");
+        return false;
+    }
+
+    return mUpgrade->initialise(path);
+}
+
+bool ProxyClient::addRoute(const RouteConfig &conf)
+{
+    if (!mInited)
+    {
+        ErrorPrint("[ProxyClient::addRoute] proxy client not inited.");
+        return false;
+    }
+
+    // 各工作进程无法像SO_REUSEPORT那样共用同一个Unix域套接字路径
+    if (mSharedStats && *conf.listenUnix)
+    {
+        ErrorPrint("[ProxyClient::addRoute] unix listener %s not supported in worker mode.",
+                   getListenName(conf).c_str());
+        return false;
+    }
 
-    if (inet_pton(AF_INET, ip, &tmpaddr.sin_addr) < 0)
+    int listenFd = mUpgrade ? mUpgrade->fetch(getListenName(conf)) : -1;
+    Route *route = createRoute(conf, listenFd);
+    if (!route)
     {
-        ErrorPrint("[ProxyClient::setProxyServer] illegal ip(%s).", ip);
         return false;
     }
 
-    snprintf(mProxyIp, sizeof(mProxyIp), "%s", ip);
-    mProxyPort = port;
+    mRoutes.push_back(route);
 
+    InfoPrint("route %s -> %s:%d added, %u upstream(s).",
+              getListenName(conf).c_str(), conf.destHost, conf.destPort,
+              (uint)conf.upstreams.size());
     return true;
 }
 
+Route *ProxyClient::createRoute(const RouteConfig &conf, int listenFd)
+{
+    Route *route = new Route(mEventPoller, conf);
+    assert(route && "alloc route failed.");
+
+    if (!route->initialise(listenFd))
+    {
+        delete route;
+        return NULL;
+    }
+    route->setEventHandler(this);
+
+    return route;
+}
+
+void ProxyClient::setConfig(const char *configFile, const std::vector<RouteConfig> &staticRoutes)
+{
+    mConfigFile = configFile ? configFile : "";
+    mStaticRoutes = staticRoutes;
+}
+
+bool ProxyClient::reloadConfig()
+{
+    if (!mInited)
+    {
+        ErrorPrint("[ProxyClient::reloadConfig] proxy client not inited.");
+        return false;
+    }
+
+    // 监听已交给新进程
+    if (mbDraining)
+    {
+        WarningPrint("[ProxyClient::reloadConfig] draining, ignore reload.");
+        return false;
+    }
+
+    RouteConfigList confs = mStaticRoutes;
+    if (!mConfigFile.empty() && !parseRouteFile(mConfigFile.c_str(), confs))
+    {
+        ErrorPrint("[ProxyClient::reloadConfig] load %s failed, keep current routes.", mConfigFile.c_str());
+        return false;
+    }
+
+    return applyRoutes(confs);
+}
+
+bool ProxyClient::applyRoutes(const RouteConfigList &confs)
+{
+    typedef std::map<std::string, const RouteConfig *> ConfigMap;
+    ConfigMap wanted;
+
+    RouteConfigList::const_iterator itConf = confs.begin();
+    for (; itConf != confs.end(); ++itConf)
+    {
+        std::string name = getListenName(*itConf);
+        if (wanted.find(name) != wanted.end())
+        {
+            ErrorPrint("[ProxyClient::applyRoutes] duplicate route on %s, keep current routes.", name.c_str());
+            return false;
+        }
+        wanted[name] = &*itConf;
+    }
+
+    // 先撤下已删除的路由, 让出其监听地址
+    bool ret = true;
+    RouteList kept;
+    RouteList::iterator itRoute = mRoutes.begin();
+    for (; itRoute != mRoutes.end(); ++itRoute)
+    {
+        Route *route = *itRoute;
+        std::string name = getListenName(route->getConfig());
+
+        ConfigMap::iterator it = wanted.find(name);
+        if (it == wanted.end())
+        {
+            InfoPrint("route %s removed.", name.c_str());
+            retireRoute(route);
+            continue;
+        }
+
+        // 监听参数有变: 新路由接管原监听socket的副本并按新参数重新listen,
+        // 成功后才撤下原路由, 监听地址不会有空窗; 失败时保留原路由
+        if (!route->canReconfigure(*it->second))
+        {
+            int fd = fcntl(route->getListenerFd(), F_DUPFD_CLOEXEC, 0);
+            Route *fresh = fd >= 0 ? createRoute(*it->second, fd) : NULL;
+            wanted.erase(it);
+            if (!fresh)
+            {
+                ErrorPrint("[ProxyClient::applyRoutes] replace route %s failed, keep current route.", name.c_str());
+                kept.push_back(route);
+                ret = false;
+                continue;
+            }
+
+            retireRoute(route);
+            kept.push_back(fresh);
+
+            InfoPrint("route %s replaced, %u upstream(s).", name.c_str(),
+                      (uint)fresh->getConfig().upstreams.size());
+            continue;
+        }
+
+        route->reconfigure(*it->second);
+        wanted.erase(it);
+        kept.push_back(route);
+
+        InfoPrint("route %s updated, %u upstream(s).", name.c_str(),
+                  (uint)route->getConfig().upstreams.size());
+    }
+    mRoutes.swap(kept);
+
+    for (itConf = confs.begin(); itConf != confs.end(); ++itConf)
+    {
+        if (wanted.find(getListenName(*itConf)) != wanted.end() && !addRoute(*itConf))
+        {
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+
+void ProxyClient::retireRoute(Route *route)
+{
+    route->finalise();
+
+    if (0 == route->getStats().active)
+    {
+        deleteRoute(route);
+        return;
+    }
+
+    mRetiredRoutes.push_back(route);
+}
+
+void ProxyClient::reapRoutes()
+{
+    RouteList::iterator it = mRetiredRoutes.begin();
+    while (it != mRetiredRoutes.end())
+    {
+        if (0 == (*it)->getStats().active)
+        {
+            deleteRoute(*it);
+            it = mRetiredRoutes.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+void ProxyClient::deleteRoute(Route *route)
+{
+    const RouteStats &stats = route->getStats();
+    mRemovedStats.accepted += stats.accepted;
+    mRemovedStats.failed += stats.failed;
+    mRemovedStats.closed += stats.closed;
+    mRemovedStats.retried += stats.retried;
+
+    delete route;
+}
+
+uint64 ProxyClient::getActiveTunnels() const
+{
+    uint64 active = 0;
+
+    RouteList::const_iterator it = mRoutes.begin();
+    for (; it != mRoutes.end(); ++it)
+    {
+        active += (*it)->getStats().active;
+    }
+    for (it = mRetiredRoutes.begin(); it != mRetiredRoutes.end(); ++it)
+    {
+        active += (*it)->getStats().active;
+    }
+
+    return active;
+}
+
+void ProxyClient::publishStats()
+{
+    if (!mSharedStats)
+    {
+        return;
+    }
+
+    uint64 accepted = mRemovedStats.accepted;
+    uint64 failed = mRemovedStats.failed;
+    uint64 closed = mRemovedStats.closed;
+    uint64 retried = mRemovedStats.retried;
+    uint64 active = 0;
+    for (int i = 0; i < 2; ++i)
+    {
+        const RouteList &routes = (0 == i) ? mRoutes : mRetiredRoutes;
+        RouteList::const_iterator it = routes.begin();
+        for (; it != routes.end(); ++it)
+        {
+            const RouteStats &stats = (*it)->getStats();
+            accepted += stats.accepted;
+            failed += stats.failed;
+            closed += stats.closed;
+            active += stats.active;
+            retried += stats.retried;
+        }
+    }
+
+    mSharedStats->accepted = accepted;
+    mSharedStats->failed = failed;
+    mSharedStats->closed = closed;
+    mSharedStats->active = active;
+    mSharedStats->retried = retried;
+}
+
+void ProxyClient::notifySignal(int signo)
+{
+    if (mSignalPipe[1] < 0)
+    {
+        return;
+    }
+
+    int savedErrno = errno;
+    unsigned char c = (unsigned char)signo;
+    if (write(mSignalPipe[1], &c, 1) < 0)
+    {
+        // 管道满时丢弃, 已有未处理的信号
+    }
+    errno = savedErrno;
+}
+
+int ProxyClient::handleInputNotification(int fd)
+{
+    unsigned char sigs[64];
+    ssize_t n = 0;
+    while ((n = read(fd, sigs, sizeof(sigs))) > 0)
+    {
+        for (ssize_t i = 0; i < n; ++i)
+        {
+            switch (sigs[i])
+            {
+            case SIGPIPE:
+                WarningPrint("broken pipe!");
+                break;
+            case SIGHUP:
+                InfoPrint("catch SIGHUP, reload config.");
+                reloadConfig();
+                break;
+            case SIGINT:
+                InfoPrint("catch SIGINT!");
+                exitLoop();
+                break;
+            case SIGQUIT:
+                InfoPrint("catch SIGQUIT!");
+                exitLoop();
+                break;
+            case SIGTERM:
+                InfoPrint("catch SIGTERM!");
+                exitLoop();
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
+
 void ProxyClient::runLoop()
 {
     mbLoop = true;
@@ -104,13 +458,54 @@ void ProxyClient::runLoop()
         // 事件分发
         mEventPoller->processPendingEvents(PER_FRAME_TIME);
 
-        // 回收断开的隧道
-        TunnelSet::iterator it = mBrokenTuns.begin();
-        for (; it != mBrokenTuns.end(); it++)
+        uint64 now = getClock64();
+
+        // 处理超时
+        mTimerWheel.advance(now);
+
+        // 回收断开的隧道, 其fd已释放, 恢复因fd耗尽而暂停的监听
+        if (!mBrokenTuns.empty())
         {
-            reclaimTunnel(*it);
+            while (!mBrokenTuns.empty())
+            {
+                reclaimTunnel(mBrokenTuns.pop());
+            }
+            Listener::recoverStarved();
+        }
+
+        if (now - mLastPoolTime >= POOL_ADJUST_INTERVAL*1000)
+        {
+            mLastPoolTime = now;
+            adjustTunnelPool();
+            publishStats();
+
+            // fd也可能由隧道以外的连接释放, 定期重试
+            Listener::recoverStarved();
+        }
+
+        // 回收已关闭的HTTP/2会话
+        mH2Pool->reap();
+
+        // 释放隧道已全部结束的旧路由
+        reapRoutes();
+
+        // 已交给新进程, 隧道全部结束或超时后退出
+        if (mbDraining)
+        {
+            uint64 active = getActiveTunnels();
+            if (0 == active || now >= mDrainDeadline)
+            {
+                InfoPrint("[ProxyClient::runLoop] drain finished, %llu tunnel(s) left.", active);
+                mbLoop = false;
+            }
+        }
+
+        // 定期输出统计信息
+        if (now - mLastStatsTime >= STATS_INTERVAL*1000)
+        {
+            mLastStatsTime = now;
+            dumpStats();
         }
-        mBrokenTuns.clear();
     }
 }
 
@@ -119,42 +514,93 @@ void ProxyClient::exitLoop()
     mbLoop = false;
 }
 
-void ProxyClient::onAccept(int connfd)
+void ProxyClient::dumpStats()
 {
+    RouteList::iterator it = mRoutes.begin();
+    for (; it != mRoutes.end(); ++it)
+    {
+        const RouteConfig &conf = (*it)->getConfig();
+        const RouteStats &stats = (*it)->getStats();
+
+        InfoPrint("[stats] %s -> %s:%d accepted=%llu active=%llu closed=%llu failed=%llu retried=%llu paused=%llu shed=%llu",
+                  getListenName(conf).c_str(), conf.destHost, conf.destPort,
+                  stats.accepted, stats.active, stats.closed, stats.failed, stats.retried,
+                  stats.paused, stats.shed);
+    }
+
+    InfoPrint("[stats] tunnel pool free=%u target=%u",
+              (uint)mFreeTuns.size(), (uint)mFreeTarget);
+    gMemoryBudget.dumpStats();
+    gChunkPool.dumpStats();
+    gSpillBufPool.dumpStats();
+    gSpillStore.dumpStats();
+    gSpillIo.dumpStats();
+}
+
+void ProxyClient::onAccept(Route *route, int connfd)
+{
+    const RouteConfig &conf = route->getConfig();
+    RouteStats &stats = route->getStats();
+
     ProxyTunnel *tun = newTunnel();
     if (!tun)
     {
         ErrorPrint("[ProxyClient::onAccept] create tunnel failed. fd=%d", connfd);
+        ++stats.failed;
         close(connfd);
         return;
     }
 
-    if (!tun->setDestServer(mDestHost, mDestPort))
+    tun->setMode(conf.mode);
+    if (RouteMode_Socks5 == conf.mode)
+    {
+        tun->setSocksCredential(conf.socksUser, conf.socksPass);
+    }
+    if (RouteMode_Transparent == conf.mode && !setOriginalDst(route, tun, connfd))
+    {
+        ++stats.failed;
+        close(connfd);
+        reclaimTunnel(tun);
+        return;
+    }
+    if (RouteMode_Fixed == conf.mode && !tun->setDestServer(conf.destHost, conf.destPort))
     {
         ErrorPrint("[ProxyClient::onAccept] set dest server failed(%s:%d). fd=%d",
-                   mDestHost, mDestPort, connfd);
+                   conf.destHost, conf.destPort, connfd);
+        ++stats.failed;
         close(connfd);
         reclaimTunnel(tun);
         return;
     }
 
-    if (!tun->setProxyServer(mProxyIp, mProxyPort))
+    const Upstream &up = route->nextUpstream();
+    if (!tun->setUpstream(up, up.h2 ? mH2Pool : NULL))
     {
         ErrorPrint("[ProxyClient::onAccept] set proxy server failed(%s:%d). fd=%d",
-                   mProxyIp, mProxyPort, connfd);
+                   up.ip, up.port, connfd);
+        ++stats.failed;
         close(connfd);
         reclaimTunnel(tun);
         return;
     }
+    tun->setTimeouts(conf.connectTimeout, conf.handshakeTimeout, conf.retries);
+    tun->setIdleTimeout(conf.idleTimeout);
+    tun->setRequestTimeout(conf.requestTimeout);
+    // Unix域套接字没有TCP保活
+    tun->setKeepAlive(*conf.listenUnix ? KeepAliveConfig() : conf.keepaliveLocal, conf.keepaliveProxy);
 
     if (!tun->acceptLocal(connfd))
     {
         ErrorPrint("[ProxyClient::onAccept] accept local conn failed. fd=%d", connfd);
+        ++stats.failed;
         close(connfd);
-        mBrokenTuns.insert(tun);
+        mBrokenTuns.push(tun);
         return;
     }
 
+    ++stats.active;
+    tun->setRoute(route);
+
     DebugPrint("[ProxyClient::onAccept] tun:%p created", tun);
     tun->setHandler(this);
 }
@@ -164,7 +610,17 @@ void ProxyClient::onClosed(ProxyTunnel *tun)
     DebugPrint("[ProxyClient::onClosed] tun:%p closed", tun);
     tun->cleanup();
 
-    mBrokenTuns.insert(tun);
+    Route *route = tun->getRoute();
+    if (route)
+    {
+        RouteStats &stats = route->getStats();
+        ++stats.closed;
+        --stats.active;
+        tun->setRoute(NULL);
+        route->checkAdmission();
+    }
+
+    mBrokenTuns.push(tun);
 }
 
 void ProxyClient::onError(ProxyTunnel *tun)
@@ -172,18 +628,96 @@ void ProxyClient::onError(ProxyTunnel *tun)
     WarningPrint("[ProxyClient::onError] tun:%p error", tun);
     tun->cleanup();
 
-    mBrokenTuns.insert(tun);
+    Route *route = tun->getRoute();
+    if (route)
+    {
+        RouteStats &stats = route->getStats();
+        ++stats.failed;
+        --stats.active;
+        tun->setRoute(NULL);
+        route->checkAdmission();
+    }
+
+    mBrokenTuns.push(tun);
+}
+
+bool ProxyClient::onRetry(ProxyTunnel *tun)
+{
+    Route *route = tun->getRoute();
+    if (!route)
+    {
+        return false;
+    }
+
+    const Upstream &up = route->nextUpstream();
+    ++route->getStats().retried;
+
+    InfoPrint("[ProxyClient::onRetry] tun:%p retry via %s:%d", tun, up.ip, up.port);
+    return tun->setUpstream(up, up.h2 ? mH2Pool : NULL);
+}
+
+void ProxyClient::collectListeners(HotUpgrade::ListenerFdList &fds)
+{
+    RouteList::iterator it = mRoutes.begin();
+    for (; it != mRoutes.end(); ++it)
+    {
+        int fd = (*it)->getListenerFd();
+        if (fd >= 0)
+        {
+            fds.push_back(std::make_pair(getListenName((*it)->getConfig()), fd));
+        }
+    }
+}
+
+void ProxyClient::onHandedOver()
+{
+    InfoPrint("[ProxyClient::onHandedOver] listeners handed over, drain tunnels in %ds.", mDrainTimeout);
+
+    // 新进程持有同一监听套接字, 这里关闭只是停止接入
+    RouteList::iterator it = mRoutes.begin();
+    for (; it != mRoutes.end(); ++it)
+    {
+        (*it)->finalise();
+    }
+
+    mbDraining = true;
+    mDrainDeadline = getClock64() + (uint64)mDrainTimeout * 1000;
+}
+
+bool ProxyClient::setOriginalDst(Route *route, ProxyTunnel *tun, int connfd)
+{
+    const RouteConfig &conf = route->getConfig();
+    char host[ADDR_SIZE];
+    int port = 0;
+
+    if (!getOriginalDst(connfd, host, sizeof(host), &port))
+    {
+        ErrorPrint("[ProxyClient::setOriginalDst] get original dst failed. fd=%d", connfd);
+        return false;
+    }
+
+    // 未被重定向的连接, 原始目标即为本监听地址, 转发会形成回环
+    if (port == conf.listenPort &&
+        (strcmp(host, conf.listenIp) == 0 || strcmp(conf.listenIp, "0.0.0.0") == 0))
+    {
+        WarningPrint("[ProxyClient::setOriginalDst] connection not redirected(%s:%d). fd=%d",
+                     host, port, connfd);
+        return false;
+    }
+
+    return tun->setDestServer(host, port);
 }
 
 ProxyTunnel *ProxyClient::newTunnel()
 {
+    ++mTunDemand;
+
     if (mFreeTuns.empty())
     {
-        return new ProxyTunnel(mEventPoller);
+        return allocTunnel();
     }
 
-    ProxyTunnel *t = mFreeTuns.front(); assert(t && "get from free tunlist");
-    mFreeTuns.pop_front();
+    ProxyTunnel *t = mFreeTuns.pop(); assert(t && "get from free tunlist");
 
     return t;
 }
@@ -195,13 +729,64 @@ void ProxyClient::reclaimTunnel(ProxyTunnel *tun)
         return;
     }
 
-    if (mFreeTuns.size() >= CACHE_TUN_SIZE)
+    // 突发期间先全部留下, 多出目标的部分由adjustTunnelPool逐步释放
+    if (mFreeTuns.size() >= CACHE_TUN_MAX)
     {
-        delete tun;
+        destroyTunnel(tun);
         return;
     }
 
-    mFreeTuns.push_back(tun);
+    mFreeTuns.push(tun);
+}
+
+ProxyTunnel *ProxyClient::allocTunnel()
+{
+#ifdef _USE_KMEM
+    if (mTunSlab)
+    {
+        void *p = ikmem_cache_alloc(mTunSlab);
+        if (!p)
+        {
+            return NULL;
+        }
+        return new (p) ProxyTunnel(mEventPoller, &mTimerWheel);
+    }
+#endif
+
+    return new ProxyTunnel(mEventPoller, &mTimerWheel);
+}
+
+void ProxyClient::destroyTunnel(ProxyTunnel *tun)
+{
+#ifdef _USE_KMEM
+    if (mTunSlab)
+    {
+        tun->~ProxyTunnel();
+        ikmem_cache_free(mTunSlab, tun);
+        return;
+    }
+#endif
+
+    delete tun;
+}
+
+void ProxyClient::adjustTunnelPool()
+{
+    // 目标长度取每周期新建数的平滑值, 稳定的连接频率下新建隧道都能从空闲链表取到
+    size_t target = (mFreeTarget * 3 + mTunDemand) / 4;
+    mTunDemand = 0;
+
+    mFreeTarget = min(max(target, (size_t)CACHE_TUN_MIN), (size_t)CACHE_TUN_MAX);
+
+    // 每次释放一半的多余部分, 避免突发刚过就把空闲隧道全部释放
+    if (mFreeTuns.size() > mFreeTarget)
+    {
+        size_t n = (mFreeTuns.size() - mFreeTarget + 1) / 2;
+        while (n-- > 0)
+        {
+            destroyTunnel(mFreeTuns.pop());
+        }
+    }
 }
 
 NAMESPACE_END // proxy
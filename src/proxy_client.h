@@ -2,67 +2,222 @@
 #define __PROXY_CLIENT_H__
 
 #include "proxy_common.h"
-#include "listener.h"
+#include "route.h"
 #include "proxy_tunnel.h"
+#include "timer_wheel.h"
+#include "hot_upgrade.h"
+#include "prefork.h"
+
+#ifdef _USE_KMEM
+# include "kmem/imembase.h"
+#endif
 
 #define PER_FRAME_TIME 1 // 每个逻辑帧最多停留1s
-#define CACHE_TUN_SIZE 64
+#define CACHE_TUN_MIN  64   // 空闲隧道链表的最小目标长度
+#define CACHE_TUN_MAX  4096 // 空闲隧道链表的最大长度
+#define POOL_ADJUST_INTERVAL 1 // 按新建速率调整空闲链表目标长度的间隔(s)
+#define STATS_INTERVAL 60 // 统计信息输出间隔(s)
+#define DEFAULT_DRAIN_TIMEOUT 300 // 热升级后旧进程等待已有隧道结束的最长时间(s)
 
 NAMESPACE_BEG(proxy)
 
-class ProxyClient : public Listener::Handler, public ProxyTunnel::Handler
+/*
+ * 以ProxyTunnel自身的链表节点串起的单链表(LIFO), 一个隧道同时只能在一条链表中
+ */
+class TunnelChain
+{
+  public:
+    TunnelChain() : mHead(NULL), mSize(0)
+    {}
+
+    // 已在链表中的隧道不重复加入
+    inline void push(ProxyTunnel *tun)
+    {
+        if (tun->isLinked())
+            return;
+
+        tun->setNextLink(mHead, true);
+        mHead = tun;
+        ++mSize;
+    }
+
+    inline ProxyTunnel *pop()
+    {
+        ProxyTunnel *tun = mHead;
+        if (tun)
+        {
+            mHead = tun->getNextLink();
+            tun->setNextLink(NULL, false);
+            --mSize;
+        }
+        return tun;
+    }
+
+    inline bool empty() const
+    {
+        return NULL == mHead;
+    }
+
+    inline size_t size() const
+    {
+        return mSize;
+    }
+
+  private:
+    ProxyTunnel *mHead;
+    size_t mSize;
+};
+
+class ProxyClient : public Route::Handler, public ProxyTunnel::Handler, public HotUpgrade::Handler
+                  , public InputNotificationHandler
 {
-    typedef std::list<ProxyTunnel *> TunnelList;
-    typedef std::set<ProxyTunnel *> TunnelSet;
+    typedef std::vector<Route *> RouteList;
+    typedef std::vector<RouteConfig> RouteConfigList;
   public:
     ProxyClient():mEventPoller(NULL)
-                 ,mListener(NULL)
+                 ,mRoutes()
+                 ,mRetiredRoutes()
+                 ,mConfigFile()
+                 ,mStaticRoutes()
+                 ,mH2Pool(NULL)
+                 ,mTimerWheel()
                  ,mInited(false)
                  ,mbLoop(false)
+                 ,mTunSlab(NULL)
                  ,mFreeTuns()
                  ,mBrokenTuns()
+                 ,mFreeTarget(CACHE_TUN_MIN)
+                 ,mTunDemand(0)
+                 ,mLastPoolTime(0)
+                 ,mUpgrade(NULL)
+                 ,mbDraining(false)
+                 ,mDrainTimeout(DEFAULT_DRAIN_TIMEOUT)
+                 ,mDrainDeadline(0)
+                 ,mSharedStats(NULL)
+                 ,mRemovedStats()
+                 ,mLastStatsTime(0)
     {
-        *mDestHost = '\0';
-        mDestPort = 0;
-        *mProxyIp = '\0';
-        mProxyPort = 0;
+        mSignalPipe[0] = mSignalPipe[1] = -1;
     }
 
     virtual ~ProxyClient();
 
-    bool initialise(const char *ip, int port);
+    bool initialise();
     void finalise();
 
-    bool setDestServer(const char *hostname, int port);
-    bool setProxyServer(const char *ip, int port);
+    /*
+     * 热升级: 在addRoute之前从path上的旧进程接过监听fd, 没有旧进程时正常启动
+     * 添加完路由后调用serveUpgrade确认接管, 并在path上等待下一次升级
+     * drainTimeout为本进程被升级后等待已有隧道结束的最长时间(s)
+     */
+    bool takeoverListeners(const char *path, int drainTimeout);
+    bool serveUpgrade(const char *path);
+
+    // 添加一条路由, 所有路由共享同一个事件循环与隧道池
+    bool addRoute(const RouteConfig &conf);
+
+    /*
+     * 路由来自命令行(staticRoutes)及配置文件(configFile, 可为NULL)
+     * 由reloadConfig()加载, 收到SIGHUP时重新加载
+     */
+    void setConfig(const char *configFile, const std::vector<RouteConfig> &staticRoutes);
+
+    /*
+     * 按配置增删监听, 已有路由原地更新, 已建立的隧道不受影响
+     * 配置文件有误时保持当前配置不变
+     */
+    bool reloadConfig();
+
+    // 在信号处理函数中调用, 只写管道, 由事件循环处理
+    void notifySignal(int signo);
+
+    // 多进程模式下把计数发布到共享内存, 供主进程汇总
+    inline void setSharedStats(WorkerStats *stats)
+    {
+        mSharedStats = stats;
+    }
 
     void runLoop();
     void exitLoop();
 
-    virtual void onAccept(int connfd);
+    void dumpStats();
+
+    virtual void onAccept(Route *route, int connfd);
 
     virtual void onClosed(ProxyTunnel *tun);
     virtual void onError(ProxyTunnel *tun);
+    virtual bool onRetry(ProxyTunnel *tun);
+
+    // HotUpgrade::Handler
+    virtual void collectListeners(HotUpgrade::ListenerFdList &fds);
+    virtual void onHandedOver();
+
+    // InputNotificationHandler, 处理经管道转来的信号
+    virtual int handleInputNotification(int fd);
 
   private:
+    // 透明代理模式下从套接字取原始目标地址
+    bool setOriginalDst(Route *route, ProxyTunnel *tun, int connfd);
+
+    bool applyRoutes(const RouteConfigList &confs);
+    // 创建路由并开始监听, listenFd>=0时接管该监听fd, 失败返回NULL
+    Route *createRoute(const RouteConfig &conf, int listenFd);
+
+    // 停止接入, 隧道全部结束后再释放路由
+    void retireRoute(Route *route);
+    void reapRoutes();
+    void deleteRoute(Route *route);
+
+    uint64 getActiveTunnels() const;
+    void publishStats();
+
     ProxyTunnel *newTunnel();
     void reclaimTunnel(ProxyTunnel *tun);
 
+    // 从slab分配/释放隧道对象
+    ProxyTunnel *allocTunnel();
+    void destroyTunnel(ProxyTunnel *tun);
+
+    // 按最近的新建速率调整空闲链表目标长度, 并逐步释放多余的空闲隧道
+    void adjustTunnelPool();
+
   private:
     EventPoller *mEventPoller;
-    Listener *mListener;
+    RouteList mRoutes;
+    RouteList mRetiredRoutes; // 已从配置中删除, 等待其隧道结束
+
+    std::string mConfigFile;
+    RouteConfigList mStaticRoutes;
+
+    int mSignalPipe[2];
+
+    H2SessionPool *mH2Pool; // 到HTTP/2上游代理的会话
+    TimerWheel mTimerWheel; // 隧道的超时检测
 
     bool mInited;
     bool mbLoop;
 
-    TunnelList mFreeTuns; // 空闲代理隧道
-    TunnelSet mBrokenTuns; // 已断开的代理隧道
+#ifdef _USE_KMEM
+    imemcache_t *mTunSlab; // ProxyTunnel专用slab
+#else
+    void *mTunSlab;
+#endif
+    TunnelChain mFreeTuns; // 空闲代理隧道
+    TunnelChain mBrokenTuns; // 已断开的代理隧道
+
+    size_t mFreeTarget; // 空闲链表目标长度
+    size_t mTunDemand;  // 本周期内新建隧道的请求数
+    uint64 mLastPoolTime;
+
+    HotUpgrade *mUpgrade;
+    bool mbDraining; // 监听已交给新进程, 等待已有隧道结束
+    int mDrainTimeout;
+    uint64 mDrainDeadline;
 
-    char mDestHost[ADDR_SIZE];
-    int mDestPort;
+    WorkerStats *mSharedStats;
+    RouteStats mRemovedStats; // 已释放路由的累计计数
 
-    char mProxyIp[IPv4_SIZE];
-    int mProxyPort;
+    uint64 mLastStatsTime;
 };
 
 extern ProxyClient gProxyClient;
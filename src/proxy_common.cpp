@@ -1,5 +1,10 @@
 #include "proxy_common.h"
 
+// linux/netfilter_ipv4.h与netinet/in.h冲突, 直接定义
+#ifndef SO_ORIGINAL_DST
+# define SO_ORIGINAL_DST 80
+#endif
+
 NAMESPACE_BEG(proxy)
 
 bool setNonblocking(int fd)
@@ -14,6 +19,47 @@ bool setNonblocking(int fd)
     return true;
 }
 
+int createTempFile(const char *prefix)
+{
+    const char *dir = getenv("TMPDIR");
+    if (NULL == dir || '\0' == *dir)
+        dir = P_tmpdir;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%sXXXXXX", dir, prefix);
+
+    int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        ErrorPrint("[createTempFile] create %s failed! %s", path, strerror(errno));
+        return -1;
+    }
+
+    // 进程退出后自动回收
+    unlink(path);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+bool getOriginalDst(int fd, char *host, size_t hostlen, int *port)
+{
+    // 监听只绑定IPv4地址, 不存在IPv6的重定向连接
+    sockaddr_in local, orig;
+    socklen_t locallen = sizeof(local), origlen = sizeof(orig);
+
+    if (::getsockname(fd, (sockaddr *)&local, &locallen) < 0 || AF_INET != local.sin_family)
+        return false;
+
+    // REDIRECT: 从conntrack中取原始目标地址
+    // TPROXY: 套接字的本地地址即为原始目标地址
+    memset(&orig, 0, sizeof(orig));
+    if (getsockopt(fd, SOL_IP, SO_ORIGINAL_DST, &orig, &origlen) < 0)
+        orig = local;
+
+    *port = ntohs(orig.sin_port);
+    return inet_ntop(AF_INET, &orig.sin_addr, host, hostlen) != NULL;
+}
+
 uint64 getClock64()
 {
 #if defined (__WIN32__) || defined(_WIN32) || defined(WIN32)
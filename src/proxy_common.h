@@ -106,7 +106,6 @@
 # define min(a, b) ((b) < (a) ? (b) : (a))
 #endif
 
-#define LISTENQ 32
 #define IPv4_SIZE sizeof("255.255.255.255")
 #define ADDR_SIZE 256
 //--------------------------------------------------------------------------
@@ -253,6 +252,18 @@ NAMESPACE_BEG(proxy)
  */
 bool setNonblocking(int fd);
 
+/*
+ * 在$TMPDIR(默认/tmp)下创建以prefix开头的临时文件, 创建后立即unlink, 只能通过返回的fd访问
+ * return 文件fd, 失败返回-1
+ */
+int createTempFile(const char *prefix);
+
+/*
+ * 获取被iptables REDIRECT/TPROXY重定向前的原始目标地址
+ * return true 获取成功 false 获取失败(连接未被重定向)
+ */
+bool getOriginalDst(int fd, char *host, size_t hostlen, int *port);
+
 /*
  * 获取64位计算机时钟
  */
@@ -9,37 +9,224 @@ ProxyTunnel::~ProxyTunnel()
 
 bool ProxyTunnel::acceptLocal(int connfd)
 {
-    if (!mLocalConn.acceptConnection(connfd))
+    // Listener接入的fd已是非阻塞的
+    if (!mLocalConn.acceptConnection(connfd, true))
     {
         WarningPrint("[ProxyTunnel::acceptLocal] accept failed.");
         return false;
     }
     mLocalConn.setEventHandler(this);
+    // 隧道对象会被复用, 不能带着上一个客户端的数据
+    mLocalCache->clear();
+    if (mKeepAliveLocal.idle > 0)
+    {
+        mLocalConn.setKeepAlive(mKeepAliveLocal.idle, mKeepAliveLocal.interval, mKeepAliveLocal.count);
+    }
+
+    if (RouteMode_HttpConnect == mMode || RouteMode_Socks5 == mMode) // 等待本地客户端指定目标服务器
+    {
+        mProxyStatus = ProxyStatus_WaitRequest;
+        mRequestParser.reset();
+        mSocks5.reset();
+        // 请求阶段的期限从接入时算起, 收到数据不顺延, 防止客户端迟迟不发完请求占着隧道
+        mTimerWheel->schedule(&mTimer, mRequestTimeout * 1000);
+        return true;
+    }
+
+    if (!connectProxy())
+    {
+        mLocalConn.setEventHandler(NULL);
+        mLocalConn.shutdown();
+        return false;
+    }
+
+    return true;
+}
 
+bool ProxyTunnel::connectProxy()
+{
     // 连接代理服务器
     mProxyStatus = ProxyStatus_Closed;
+    if (mH2Pool)
+    {
+        mTimerWheel->schedule(&mTimer, (mConnectTimeout + mHandshakeTimeout) * 1000);
+        return connectH2Proxy();
+    }
+
+    mProxyStatus = ProxyStatus_Dialing;
+    mTimerWheel->schedule(&mTimer, mConnectTimeout * 1000);
     mProxyConn.setEventHandler(this);
     if (!mProxyConn.connect((const sockaddr *)&mProxySvrAddr, (socklen_t)sizeof(mProxySvrAddr)))
     {
-        mLocalConn.setEventHandler(NULL);
-        mLocalConn.shutdown();
+        mTimer.cancel();
+        mProxyStatus = ProxyStatus_Closed;
         mProxyConn.setEventHandler(NULL);
-        WarningPrint("[ProxyTunnel::acceptLocal] connect proxy server error.");
+        WarningPrint("[ProxyTunnel::connectProxy] connect proxy server error.");
+        return false;
+    }
+
+    if (mKeepAliveProxy.idle > 0)
+    {
+        mProxyConn.setKeepAlive(mKeepAliveProxy.idle, mKeepAliveProxy.interval, mKeepAliveProxy.count);
+    }
+
+    return true;
+}
+
+bool ProxyTunnel::connectH2Proxy()
+{
+    H2Session *session = mH2Pool->acquire(mProxySvrAddr);
+    if (!session)
+    {
+        mTimer.cancel();
+        WarningPrint("[ProxyTunnel::connectH2Proxy] connect proxy server error.");
+        return false;
+    }
+
+    // 流的CONNECT到达第一个目标, 之后各跳的CONNECT作为流数据发出
+    const char *host = NULL;
+    int port = 0;
+    char authority[ADDR_SIZE + 8];
+    char auth[HTTP_LINE_SIZE];
+
+    getHopTarget(0, &host, &port);
+    snprintf(authority, sizeof(authority), "%s:%d", host, port);
+    bool hasAuth = buildBasicAuth(auth, sizeof(auth));
+
+    uint32 id = session->openStream(authority, hasAuth ? auth : NULL, this);
+    if (0 == id)
+    {
+        mTimer.cancel();
+        WarningPrint("[ProxyTunnel::connectH2Proxy] open stream to %s failed.", authority);
+        return false;
+    }
+
+    mH2Session = session;
+    mStreamId = id;
+    mProxyStatus = ProxyStatus_Connecting;
+    mHopIndex = 0;
+    mResponseParser.reset();
+
+    sendConnectRequests(1);
+
+    return true;
+}
+
+bool ProxyTunnel::buildBasicAuth(char *buf, size_t buflen) const
+{
+    if (mUsername == "")
+    {
         return false;
     }
 
+    char cred[HTTP_LINE_SIZE];
+    char encBuf[HTTP_LINE_SIZE] = {0};
+
+    snprintf(cred, sizeof(cred), "%s:%s", mUsername.c_str(), mPassword.c_str());
+    Base64Encode((unsigned char *)cred, strlen(cred), (unsigned char *)encBuf, sizeof(encBuf) - 1);
+    snprintf(buf, buflen, "Basic %s", encBuf);
+
     return true;
 }
 
+void ProxyTunnel::getHopTarget(size_t i, const char **host, int *port) const
+{
+    if (i < mHops.size())
+    {
+        *host = mHops[i].host;
+        *port = mHops[i].port;
+    }
+    else
+    {
+        *host = mDestSvrHost;
+        *port = mDestSvrPort;
+    }
+}
+
+void ProxyTunnel::sendConnectRequests(size_t first)
+{
+    std::string requests;
+
+    for (size_t i = first; i <= mHops.size(); ++i)
+    {
+        char header[HTTP_HEADER_SIZE] = {0};
+        char auth[HTTP_LINE_SIZE];
+        const char *host = NULL;
+        int port = 0;
+
+        getHopTarget(i, &host, &port);
+
+        // 认证信息只发给第一跳代理
+        if (i > 0 || !buildBasicAuth(auth, sizeof(auth)))
+        {
+            snprintf(header, sizeof(header),
+                     HTTP_METHOD_CONNECT "\r\n"
+                     HTTP_FIELD_HOST "\r\n"
+                     "\r\n",
+                     host, port,
+                     host, port);
+        }
+        else
+        {
+            snprintf(header, sizeof(header),
+                     HTTP_METHOD_CONNECT "\r\n"
+                     HTTP_FIELD_HOST "\r\n"
+                     PROXY_AUTHORIZATION "\r\n"
+                     "\r\n",
+                     host, port,
+                     host, port,
+                     auth);
+        }
+
+        requests.append(header);
+    }
+
+    if (!requests.empty())
+    {
+        sendProxy(requests.data(), requests.size());
+    }
+}
+
+void ProxyTunnel::sendProxy(const void *data, size_t datalen)
+{
+    if (mH2Session)
+        mH2Session->queueData(mStreamId, data, datalen);
+    else
+        mProxyConn.send(data, datalen);
+}
+
+void ProxyTunnel::shutdownProxy(bool graceful)
+{
+    if (mH2Session)
+    {
+        if (graceful)
+            mH2Session->closeStream(mStreamId);
+        else
+            mH2Session->resetStream(mStreamId);
+
+        mH2Session = NULL;
+        mStreamId = 0;
+    }
+
+    mProxyConn.shutdown();
+}
+
 void ProxyTunnel::cleanup()
 {
+    mTimer.cancel();
+    mRetries = 0;
     mLocalCache->clear();
+    mRequestParser.reset();
+    mSocks5.reset();
+    mHops.clear();
+    mHopIndex = 0;
+    mResponseParser.reset();
     mLocalConn.setEventHandler(NULL);
     mLocalConn.shutdown();
 
     mProxyStatus = ProxyStatus_Closed;
     mProxyConn.setEventHandler(NULL);
-    mProxyConn.shutdown();
+    shutdownProxy(false);
 }
 
 bool ProxyTunnel::setProxyServer(const char *ip, int port)
@@ -57,12 +244,35 @@ bool ProxyTunnel::setProxyServer(const char *ip, int port)
 
 bool ProxyTunnel::setDestServer(const char *hostname, int port)
 {
-    snprintf(mDestSvrHost, sizeof(mDestSvrHost), "%s", hostname);
+    if (strchr(hostname, ':') && *hostname != '[') // IPv6字面地址需加方括号
+        snprintf(mDestSvrHost, sizeof(mDestSvrHost), "[%s]", hostname);
+    else
+        snprintf(mDestSvrHost, sizeof(mDestSvrHost), "%s", hostname);
     mDestSvrPort = port;
 
     return true;
 }
 
+bool ProxyTunnel::setUpstream(const Upstream &up, H2SessionPool *pool)
+{
+    if (!setProxyServer(up.ip, up.port))
+    {
+        return false;
+    }
+
+    mHops = up.hops;
+    mH2Pool = pool;
+    return true;
+}
+
+void ProxyTunnel::setTimeouts(int connectTimeout, int handshakeTimeout, int retries)
+{
+    mConnectTimeout = connectTimeout;
+    mHandshakeTimeout = handshakeTimeout;
+    mMaxRetries = retries;
+    mRetries = 0;
+}
+
 void ProxyTunnel::setHandler(Handler *h)
 {
     mHandler = h;
@@ -72,38 +282,13 @@ void ProxyTunnel::onConnected(Connection *pConn)
 {
     if (pConn == &mProxyConn) // 与代理服务器连接成功
     {
-        char header[HTTP_HEADER_SIZE] = {0};
-
-        if (mUsername == "")
-        {
-            snprintf(header, sizeof(header),
-                     HTTP_METHOD_CONNECT "\r\n"
-                     HTTP_FIELD_HOST "\r\n"
-                     "\r\n",
-                     mDestSvrHost, mDestSvrPort,
-                     mDestSvrHost, mDestSvrPort);
-        }
-        else
-        {
-            char buf[HTTP_LINE_SIZE];
-            char encBuf[HTTP_LINE_SIZE] = {0};
-
-            snprintf(buf, sizeof(buf), "%s:%s", mUsername.c_str(), mPassword.c_str());
-            Base64Encode((unsigned char *)buf, strlen(buf), (unsigned char *)encBuf, sizeof(encBuf) - 1);
-
-            snprintf(header, sizeof(header),
-                     HTTP_METHOD_CONNECT "\r\n"
-                     HTTP_FIELD_HOST "\r\n"
-                     BASIC_PROXY_AUTHORIZATION "\r\n"
-                     "\r\n",
-                     mDestSvrHost, mDestSvrPort,
-                     mDestSvrHost, mDestSvrPort,
-                     encBuf);
-        }
-
         mProxyStatus = ProxyStatus_Connecting;
-        *mHttpHeader = '\0';
-        mProxyConn.send(header, strlen(header));
+        mHopIndex = 0;
+        mResponseParser.reset();
+        mTimerWheel->schedule(&mTimer, mHandshakeTimeout * 1000);
+
+        // 代理链上各跳的CONNECT一次性发出, 响应按序解析
+        sendConnectRequests(0);
     }
     else
     {
@@ -122,18 +307,14 @@ void ProxyTunnel::onDisconnected(Connection *pConn)
             flushLocal();
         }
         mProxyStatus = ProxyStatus_Closed;
-        mProxyConn.shutdown();
+        shutdownProxy(true);
 
         _onClose();
     }
     else if (pConn == &mProxyConn) // 与代理服务器连接断开
     {
         mProxyConn.shutdown();
-
-        mLocalCache->clear();
-        mLocalConn.shutdown();
-
-        _onClose();
+        onProxyClosed();
     }
     else
     {
@@ -143,15 +324,39 @@ void ProxyTunnel::onDisconnected(Connection *pConn)
 
 void ProxyTunnel::onRecv(Connection *pConn, const void *data, size_t datalen)
 {
+    mLastActive = mTimerWheel->getCurrentTick();
+
     if (pConn == &mLocalConn) // 收到来自本地客户端的数据
     {
         if (ProxyStatus_Connected == mProxyStatus) // 已与代理建立连接
         {
-            mProxyConn.send(data, datalen);
+            if (mLocalCache->empty())
+            {
+                // 发不出去的部分留在缓存中(可溢出到磁盘), 等可写时再发
+                // 发送出错时隧道已在回调中清理, 状态不再是Connected
+                ssize_t sent = onFlushLocal(data, datalen);
+                if (sent >= 0 && (size_t)sent < datalen && ProxyStatus_Connected == mProxyStatus &&
+                    !mLocalCache->cache((const char *)data + sent, datalen - sent))
+                {
+                    onCacheError();
+                }
+            }
+            else if (!mLocalCache->cache(data, datalen)) // 缓存的数据还未发完(等待读盘或可写), 排在其后
+            {
+                onCacheError();
+            }
+            else
+            {
+                flushLocal();
+            }
+        }
+        else if (ProxyStatus_WaitRequest == mProxyStatus) // 代理请求尚未解析完
+        {
+            onLocalRequest(data, datalen);
         }
-        else
+        else if (!mLocalCache->cache(data, datalen)) // 先缓存起来
         {
-            mLocalCache->cache(data, datalen); // 先缓存起来
+            onCacheError();
         }
     }
     else if (pConn == &mProxyConn) // 收到来自代理服务器的数据
@@ -159,24 +364,7 @@ void ProxyTunnel::onRecv(Connection *pConn, const void *data, size_t datalen)
         switch (mProxyStatus)
         {
         case ProxyStatus_Connecting: // 已向代理服务器发送CONNECT消息
-            {
-                char *ptr = mHttpHeader + strlen(mHttpHeader);
-                char *endptr = mHttpHeader + sizeof(mHttpHeader) - 1;
-
-                if (datalen > size_t(endptr - ptr))
-                {
-                    ErrorPrint("[ProxyTunnel::onRecv] buf overflow. datalen=%u", datalen);
-                    mProxyConn.setEventHandler(NULL);
-                    _onError();
-                    return;
-                }
-
-                memcpy(ptr, data, datalen);
-                ptr += datalen;
-                *ptr = '\0';
-
-                parseHttpHeader();
-            }
+            onProxyHandshake(data, datalen);
             break;
         case ProxyStatus_Connected: // 已建立代理隧道
             {
@@ -216,7 +404,7 @@ void ProxyTunnel::onError(Connection *pConn)
         }
         mProxyStatus = ProxyStatus_Closed;
         mProxyConn.setEventHandler(NULL);
-        mProxyConn.shutdown();
+        shutdownProxy(true);
 
         WarningPrint("connection with local occur error. reason:%s", strerror(errno));
         _onError();
@@ -226,12 +414,8 @@ void ProxyTunnel::onError(Connection *pConn)
         mProxyConn.setEventHandler(NULL);
         mProxyConn.shutdown();
 
-        mLocalCache->clear();
-        mLocalConn.setEventHandler(NULL);
-        mLocalConn.shutdown();
-
         WarningPrint("connection with proxy occur error. reason:%s", strerror(errno));
-        _onError();
+        onProxyError();
     }
     else
     {
@@ -239,37 +423,387 @@ void ProxyTunnel::onError(Connection *pConn)
     }
 }
 
-void ProxyTunnel::parseHttpHeader()
+void ProxyTunnel::onWritable(Connection *pConn)
 {
-    char *line_head = NULL, *line_tail = NULL;
-    bool full_header = false;
+    // sendfile未发完的溢出数据从断点继续
+    if (pConn == &mProxyConn && !mLocalCache->empty())
+    {
+        flushLocal();
+    }
+}
 
-    line_head = mHttpHeader;
-    while ((line_tail = strstr(line_head, "\r\n")))
+void ProxyTunnel::onStreamResponse(uint32 id, int status)
+{
+    if (status >= 200 && status < 300)
     {
-        if (line_tail == line_head)
+        if (++mHopIndex <= mHops.size()) // 等待后续各跳的响应
         {
-            full_header = true;
-            break;
+            return;
         }
 
-        line_head = line_tail + 2;
+        mProxyStatus = ProxyStatus_Connected; // 代理隧道建立成功
+        armIdleTimer();
+        replyLocal(true);
+        flushLocal();
+        return;
+    }
+
+    InfoPrint("build h2 tunnel to %s:%d failed. status:%d", mDestSvrHost, mDestSvrPort, status);
+    replyLocal(false);
+    mProxyStatus = ProxyStatus_Error;
+    shutdownProxy(false);
+    _onError();
+}
+
+void ProxyTunnel::onStreamData(uint32 id, const void *data, size_t datalen)
+{
+    mLastActive = mTimerWheel->getCurrentTick();
+
+    if (ProxyStatus_Connecting == mProxyStatus && mHopIndex > 0) // 代理链后续各跳的响应
+    {
+        onProxyHandshake(data, datalen);
+        return;
     }
 
-    if (full_header)
+    if (ProxyStatus_Connected != mProxyStatus || !mLocalConn.isConnected())
     {
-        if (strstrICase(mHttpHeader, mHttpHeader + strlen(mHttpHeader), SSL_CONNECTION_RESPONSE_OK))
+        ErrorPrint("[ProxyTunnel::onStreamData] unexpected data. proxy status(%d).", mProxyStatus);
+        shutdownProxy(false);
+        _onError();
+        return;
+    }
+
+    mLocalConn.send(data, datalen);
+}
+
+void ProxyTunnel::onStreamWritable(uint32 id)
+{
+    if (!mLocalCache->empty())
+    {
+        flushLocal();
+    }
+}
+
+void ProxyTunnel::onStreamClosed(uint32 id, bool error)
+{
+    // 流已由会话回收
+    mH2Session = NULL;
+    mStreamId = 0;
+
+    if (error)
+    {
+        WarningPrint("h2 stream to %s:%d reset by proxy.", mDestSvrHost, mDestSvrPort);
+        onProxyError();
+    }
+    else
+    {
+        onProxyClosed();
+    }
+}
+
+void ProxyTunnel::onProxyClosed()
+{
+    if (tryRetry())
+    {
+        return;
+    }
+
+    if (ProxyStatus_Connected != mProxyStatus)
+    {
+        replyLocal(false);
+    }
+    mLocalCache->clear();
+    mLocalConn.shutdown();
+
+    _onClose();
+}
+
+void ProxyTunnel::onProxyError()
+{
+    if (tryRetry())
+    {
+        return;
+    }
+
+    if (ProxyStatus_Connected != mProxyStatus)
+    {
+        replyLocal(false);
+    }
+    mLocalCache->clear();
+    mLocalConn.setEventHandler(NULL);
+    mLocalConn.shutdown();
+
+    _onError();
+}
+
+void ProxyTunnel::onCacheError()
+{
+    ErrorPrint("[ProxyTunnel::onCacheError] cache local data failed, tunnel to %s:%d closed.",
+               mDestSvrHost, mDestSvrPort);
+    if (ProxyStatus_Connected != mProxyStatus)
+    {
+        replyLocal(false);
+    }
+    mProxyStatus = ProxyStatus_Error;
+    mLocalConn.setEventHandler(NULL);
+    _onError();
+}
+
+void ProxyTunnel::onTimeout(Timer *timer)
+{
+    switch (mProxyStatus)
+    {
+    case ProxyStatus_Dialing:
+    case ProxyStatus_Connecting:
+        WarningPrint("[ProxyTunnel::onTimeout] %s timeout. dest=%s:%d retries=%d",
+                     ProxyStatus_Dialing == mProxyStatus ? "connect proxy" : "proxy handshake",
+                     mDestSvrHost, mDestSvrPort, mRetries);
+        mProxyConn.setEventHandler(NULL);
+        onProxyError();
+        break;
+    case ProxyStatus_Retrying:
+        if (!mHandler || !mHandler->onRetry(this) || !connectProxy())
         {
-            mProxyStatus = ProxyStatus_Connected; // 代理隧道建立成功
-            flushLocal(); // 先将缓存的本地客户端发送上来的数据发送出去
+            replyLocal(false);
+            mProxyStatus = ProxyStatus_Error;
+            _onError();
         }
-        else
+        break;
+    case ProxyStatus_WaitRequest:
+        InfoPrint("[ProxyTunnel::onTimeout] no complete proxy request from local client in %ds, closed.",
+                  mRequestTimeout);
+        _onClose();
+        break;
+    case ProxyStatus_Connected:
+        checkIdle();
+        break;
+    default:
+        break;
+    }
+}
+
+void ProxyTunnel::armIdleTimer()
+{
+    if (mIdleTimeout <= 0)
+    {
+        mTimer.cancel();
+        return;
+    }
+
+    mLastActive = mTimerWheel->getCurrentTick();
+    mTimerWheel->schedule(&mTimer, mIdleTimeout * 1000);
+}
+
+void ProxyTunnel::checkIdle()
+{
+    uint64 idleTicks = (uint64)mIdleTimeout * 1000 / TIMER_WHEEL_TICK;
+    uint64 elapsed = mTimerWheel->getCurrentTick() - mLastActive;
+
+    if (elapsed < idleTicks) // 期间有过数据, 按剩余时间重新调度
+    {
+        mTimerWheel->schedule(&mTimer, (idleTicks - elapsed) * TIMER_WHEEL_TICK);
+        return;
+    }
+
+    InfoPrint("[ProxyTunnel::checkIdle] tunnel to %s:%d idle for %ds, closed.",
+              mDestSvrHost, mDestSvrPort, mIdleTimeout);
+    _onClose();
+}
+
+bool ProxyTunnel::tryRetry()
+{
+    if ((ProxyStatus_Dialing != mProxyStatus && ProxyStatus_Connecting != mProxyStatus) ||
+        mRetries >= mMaxRetries || !mLocalConn.isConnected())
+    {
+        return false;
+    }
+
+    ++mRetries;
+    mProxyConn.setEventHandler(NULL);
+    shutdownProxy(false);
+    mResponseParser.reset();
+    mHopIndex = 0;
+
+    // 到下一个tick再重连, 避免在代理连接自身的回调中重建套接字
+    mProxyStatus = ProxyStatus_Retrying;
+    mTimerWheel->schedule(&mTimer, 0);
+
+    return true;
+}
+
+void ProxyTunnel::onLocalRequest(const void *data, size_t datalen)
+{
+    const char *ptr = (const char *)data;
+    size_t n = 0;
+
+    if (RouteMode_Socks5 == mMode)
+    {
+        n = mSocks5.feed(ptr, datalen);
+        if (mSocks5.getReplyLen() > 0)
+        {
+            mLocalConn.send(mSocks5.getReply(), mSocks5.getReplyLen());
+        }
+
+        if (mSocks5.isError())
         {
-            InfoPrint("build http tunnel failed. resp:%s", mHttpHeader);
+            InfoPrint("[ProxyTunnel::onLocalRequest] socks5 handshake failed.");
+            mProxyStatus = ProxyStatus_Error;
+            mLocalConn.setEventHandler(NULL);
+            _onError();
+            return;
+        }
+
+        if (!mSocks5.isDone())
+        {
+            return;
+        }
+
+        setDestServer(mSocks5.getHost(), mSocks5.getPort());
+    }
+    else
+    {
+        n = mRequestParser.feed(ptr, datalen);
+        if (mRequestParser.isError())
+        {
+            InfoPrint("[ProxyTunnel::onLocalRequest] bad proxy request from local client.");
+            mLocalConn.send(HTTP_RESPONSE_BAD_REQUEST, strlen(HTTP_RESPONSE_BAD_REQUEST));
+            mProxyStatus = ProxyStatus_Error;
+            mLocalConn.setEventHandler(NULL);
+            _onError();
+            return;
+        }
+
+        if (!mRequestParser.isDone())
+        {
+            return;
+        }
+
+        setDestServer(mRequestParser.getHost(), mRequestParser.getPort());
+
+        if (!mRequestParser.isConnect()) // absolute-URI请求, 改写请求行后转发
+        {
+            char line[HTTP_URI_SIZE + HTTP_LINE_SIZE];
+            int linelen = mRequestParser.buildRequestLine(line, sizeof(line));
+            if (linelen <= 0)
+            {
+                mLocalConn.send(HTTP_RESPONSE_BAD_REQUEST, strlen(HTTP_RESPONSE_BAD_REQUEST));
+                mProxyStatus = ProxyStatus_Error;
+                mLocalConn.setEventHandler(NULL);
+                _onError();
+                return;
+            }
+            if (!mLocalCache->cache(line, linelen))
+            {
+                onCacheError();
+                return;
+            }
+        }
+    }
+
+    if (n < datalen && !mLocalCache->cache(ptr + n, datalen - n)) // 请求之后的数据先缓存起来
+    {
+        onCacheError();
+        return;
+    }
+
+    DebugPrint("[ProxyTunnel::onLocalRequest] tunnel to %s:%d", mDestSvrHost, mDestSvrPort);
+
+    if (!connectProxy())
+    {
+        replyLocal(false);
+        mProxyStatus = ProxyStatus_Error;
+        mLocalConn.setEventHandler(NULL);
+        _onError();
+    }
+}
+
+void ProxyTunnel::replyLocal(bool established)
+{
+    if (!mLocalConn.isConnected())
+    {
+        return;
+    }
+
+    switch (mMode)
+    {
+    case RouteMode_HttpConnect:
+        if (!established)
+        {
+            mLocalConn.send(HTTP_RESPONSE_BAD_GATEWAY, strlen(HTTP_RESPONSE_BAD_GATEWAY));
+        }
+        else if (mRequestParser.isConnect())
+        {
+            mLocalConn.send(HTTP_RESPONSE_ESTABLISHED, strlen(HTTP_RESPONSE_ESTABLISHED));
+        }
+        break;
+    case RouteMode_Socks5:
+        {
+            char reply[SOCKS5_REPLY_MAX];
+            int replylen = Socks5Handshake::buildReply(established ? SOCKS5_REP_SUCCEEDED : SOCKS5_REP_GENERAL_FAILURE,
+                                                       reply, sizeof(reply));
+            if (replylen > 0)
+            {
+                mLocalConn.send(reply, replylen);
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void ProxyTunnel::onProxyHandshake(const void *data, size_t datalen)
+{
+    const char *ptr = (const char *)data;
+
+    // 代理链各跳的响应依次排列, 逐个解析
+    while (ProxyStatus_Connecting == mProxyStatus)
+    {
+        size_t n = mResponseParser.feed(ptr, datalen);
+        ptr += n;
+        datalen -= n;
+
+        if (mResponseParser.isError())
+        {
+            ErrorPrint("[ProxyTunnel::onProxyHandshake] bad response at hop %u. resp:%s",
+                       (uint)mHopIndex, mResponseParser.getStatusLine());
+            replyLocal(false);
             mProxyStatus = ProxyStatus_Error;
             mProxyConn.setEventHandler(NULL);
             _onError();
+            return;
+        }
+
+        if (!mResponseParser.isDone())
+        {
+            return;
         }
+
+        if (!mResponseParser.isSuccess())
+        {
+            InfoPrint("build http tunnel failed at hop %u. resp:%s",
+                      (uint)mHopIndex, mResponseParser.getStatusLine());
+            replyLocal(false);
+            mProxyStatus = ProxyStatus_Error;
+            mProxyConn.setEventHandler(NULL);
+            _onError();
+            return;
+        }
+
+        mResponseParser.reset();
+        if (++mHopIndex <= mHops.size())
+        {
+            continue;
+        }
+
+        mProxyStatus = ProxyStatus_Connected; // 代理隧道建立成功
+        armIdleTimer();
+        replyLocal(true);
+        if (datalen > 0) // 紧随响应头的数据来自目标服务器
+        {
+            mLocalConn.send(ptr, datalen);
+        }
+        flushLocal(); // 先将缓存的本地客户端发送上来的数据发送出去
     }
 }
 
@@ -281,10 +815,34 @@ void ProxyTunnel::flushLocal()
     }
 }
 
-bool ProxyTunnel::onFlushLocal(const void *data, size_t datalen)
+ssize_t ProxyTunnel::onFlushLocal(const void *data, size_t datalen)
 {
-    mProxyConn.send(data, datalen);
-    return true;
+    // h2会话只接受流控窗口内的部分, 其余留在缓存中, 窗口打开后回调onStreamWritable()
+    if (mH2Session)
+    {
+        return mH2Session->sendData(mStreamId, data, datalen);
+    }
+
+    return mProxyConn.trySend(data, datalen);
+}
+
+ssize_t ProxyTunnel::onFlushLocalv(const struct iovec *iov, int iovcnt)
+{
+    // 流已关闭或发送出错时返回-1, 出错时隧道已在回调中清理
+    if (mH2Session)
+    {
+        return mH2Session->sendData(mStreamId, iov, iovcnt);
+    }
+
+    return mProxyConn.trySendv(iov, iovcnt);
+}
+
+ssize_t ProxyTunnel::onFlushLocalFile(int fd, off_t off, size_t len)
+{
+    if (mH2Session || !mProxyConn.isConnected())
+        return -1;
+
+    return mProxyConn.sendfile(fd, off, len);
 }
 
 void ProxyTunnel::_onClose()
@@ -5,6 +5,12 @@
 #include "event_poller.h"
 #include "connection.h"
 #include "cache.h"
+#include "route.h"
+#include "http_request_parser.h"
+#include "http_response_parser.h"
+#include "socks5_handshake.h"
+#include "h2_session.h"
+#include "timer_wheel.h"
 
 #define HTTP_HEADER_SIZE           1024
 #define HTTP_LINE_SIZE             256
@@ -12,25 +18,36 @@
 #define HTTP_METHOD_CONNECT        "CONNECT %s:%d HTTP/1.1"
 #define HTTP_FIELD_HOST            "Host: %s:%d"
 
-#define SSL_CONNECTION_RESPONSE_OK "200 Connection established"        // "HTTP/1.0 200 Connection established"
-
 // 认证相关
 #define AUTHENTICATION_REQUIRED    "407 Proxy Authentication Required" // "HTTP/1.1 407 Proxy Authentication Required"
-#define BASIC_PROXY_AUTHORIZATION  "Proxy-Authorization: Basic %s"
+#define PROXY_AUTHORIZATION        "Proxy-Authorization: %s"
+
+// 回复本地客户端的HTTP代理响应
+#define HTTP_RESPONSE_ESTABLISHED  "HTTP/1.1 200 Connection established\r\n\r\n"
+#define HTTP_RESPONSE_BAD_REQUEST  "HTTP/1.1 400 Bad Request\r\n\r\n"
+#define HTTP_RESPONSE_BAD_GATEWAY  "HTTP/1.1 502 Bad Gateway\r\n\r\n"
 
 NAMESPACE_BEG(proxy)
 
-class ProxyTunnel : public Connection::Handler
+class ProxyTunnel : public Connection::Handler, public H2Session::StreamHandler, public Timer::Handler
 {
     enum EProxyStatus // 当前代理连接状态
     {
         ProxyStatus_Closed = 0,
         ProxyStatus_Error,
+        ProxyStatus_WaitRequest, // 等待本地客户端的代理请求
+        ProxyStatus_Dialing,     // 正在与代理服务器建立TCP连接
+        ProxyStatus_Retrying,    // 等待换上游重试
         ProxyStatus_Connecting,
         ProxyStatus_Connected,
     };
 
-    typedef Cache<ProxyTunnel> MyCache;
+    // 溢出数据默认经I/O线程读写, 编译时定义_USE_MMAP_SPILL则写入mmap映射段
+#ifdef _USE_MMAP_SPILL
+    typedef Cache<ProxyTunnel, 256*1024, MmapDiskCache> MyCache;
+#else
+    typedef Cache<ProxyTunnel, 256*1024, AsyncDiskCache> MyCache;
+#endif
 
   public:
     class Handler
@@ -40,25 +57,53 @@ class ProxyTunnel : public Connection::Handler
 
         virtual void onClosed(ProxyTunnel *tun) = 0;
         virtual void onError(ProxyTunnel *tun) = 0;
+
+        // 建立隧道超时/失败, 为隧道换一个上游, 返回false则放弃重试
+        virtual bool onRetry(ProxyTunnel *tun) = 0;
     };
     
-    ProxyTunnel(EventPoller *poller)
+    ProxyTunnel(EventPoller *poller, TimerWheel *wheel)
             :mEventPoller(poller)
+            ,mTimerWheel(wheel)
+            ,mTimer()
+            ,mConnectTimeout(DEFAULT_CONNECT_TIMEOUT)
+            ,mHandshakeTimeout(DEFAULT_HANDSHAKE_TIMEOUT)
+            ,mMaxRetries(DEFAULT_RETRIES)
+            ,mRetries(0)
+            ,mIdleTimeout(DEFAULT_IDLE_TIMEOUT)
+            ,mRequestTimeout(DEFAULT_REQUEST_TIMEOUT)
+            ,mLastActive(0)
+            ,mKeepAliveLocal()
+            ,mKeepAliveProxy()
             ,mHandler(NULL)
+            ,mRoute(NULL)
             ,mLocalConn(poller)             
             ,mProxyConn(poller)
+            ,mH2Pool(NULL)
+            ,mH2Session(NULL)
+            ,mStreamId(0)
             ,mLocalCache(NULL)
+            ,mHops()
+            ,mHopIndex(0)
             ,mProxyStatus(ProxyStatus_Closed)
+            ,mResponseParser()
+            ,mMode(RouteMode_Fixed)
+            ,mRequestParser()
+            ,mSocks5()
             ,mUsername("")
             ,mPassword("")
+            ,mNextLink(NULL)
+            ,mbLinked(false)
     {
         memset(&mProxySvrAddr, 0, sizeof(mProxySvrAddr));
         *mDestSvrHost = '\0';
         mDestSvrPort = 0;
-        *mHttpHeader = '\0';
 
-        mLocalCache = new MyCache(this, &ProxyTunnel::onFlushLocal);
+        mLocalCache = new MyCache(this, &ProxyTunnel::onFlushLocal, &ProxyTunnel::onFlushLocalFile,
+                                  &ProxyTunnel::onFlushLocalv);
         assert(mLocalCache && "new local cache failed.");
+
+        mTimer.setHandler(this);
     }
 
     virtual ~ProxyTunnel();
@@ -72,20 +117,133 @@ class ProxyTunnel : public Connection::Handler
     bool setProxyServer(const char *ip, int port);
     bool setDestServer(const char *hostname, int port);
 
+    // 设置上游代理(含代理链), h2上游经由pool中的会话连接
+    bool setUpstream(const Upstream &up, H2SessionPool *pool);
+
+    // 连接/握手超时(s)及换上游重试的次数
+    void setTimeouts(int connectTimeout, int handshakeTimeout, int retries);
+
+    // 空闲超时(s), 0为不限
+    inline void setIdleTimeout(int idleTimeout)
+    {
+        mIdleTimeout = idleTimeout;
+    }
+
+    // 等待本地客户端发完代理请求的超时(s), 与空闲超时无关, 总是生效
+    inline void setRequestTimeout(int requestTimeout)
+    {
+        mRequestTimeout = requestTimeout;
+    }
+
+    // 两侧连接的TCP保活
+    inline void setKeepAlive(const KeepAliveConfig &local, const KeepAliveConfig &proxy)
+    {
+        mKeepAliveLocal = local;
+        mKeepAliveProxy = proxy;
+    }
+
     void setHandler(Handler *h);
 
+    // 目标服务器的确定方式
+    inline void setMode(ERouteMode mode)
+    {
+        mMode = mode;
+    }
+
+    // SOCKS5前端的认证信息
+    inline void setSocksCredential(const char *user, const char *pass)
+    {
+        mSocks5.setCredential(user, pass);
+    }
+
+    // 隧道所属的路由
+    inline void setRoute(Route *route)
+    {
+        mRoute = route;
+    }
+
+    inline Route *getRoute() const
+    {
+        return mRoute;
+    }
+
+    // 侵入式链表节点, 供ProxyClient串起空闲/断开的隧道, 回收时无需分配链表节点
+    inline ProxyTunnel *getNextLink() const
+    {
+        return mNextLink;
+    }
+
+    inline void setNextLink(ProxyTunnel *next, bool linked)
+    {
+        mNextLink = next;
+        mbLinked = linked;
+    }
+
+    inline bool isLinked() const
+    {
+        return mbLinked;
+    }
+
     virtual void onConnected(Connection *pConn);
     virtual void onDisconnected(Connection *pConn);
 
     virtual void onRecv(Connection *pConn, const void *data, size_t datalen);
     virtual void onError(Connection *pConn);
+    virtual void onWritable(Connection *pConn);
+
+    // H2Session::StreamHandler
+    virtual void onStreamResponse(uint32 id, int status);
+    virtual void onStreamData(uint32 id, const void *data, size_t datalen);
+    virtual void onStreamClosed(uint32 id, bool error);
+    virtual void onStreamWritable(uint32 id);
+
+    // Timer::Handler
+    virtual void onTimeout(Timer *timer);
 
   private:
-    void parseHttpHeader();
+    bool connectProxy();
+    bool connectH2Proxy();
+
+    // 生成Basic认证串, 未配置认证时返回false
+    bool buildBasicAuth(char *buf, size_t buflen) const;
+
+    // 第i跳CONNECT的目标: 下一跳代理, 最后一跳为目标服务器
+    void getHopTarget(size_t i, const char **host, int *port) const;
+    // 从第first跳起连续发出各跳的CONNECT请求, 不等待前一跳的响应
+    void sendConnectRequests(size_t first);
+
+    // 向代理发送数据/关闭代理侧, 屏蔽HTTP/1.1连接与HTTP/2流的差异
+    void sendProxy(const void *data, size_t datalen);
+    void shutdownProxy(bool graceful);
+
+    // 代理侧关闭/出错
+    void onProxyClosed();
+    void onProxyError();
+    // 本地客户端的数据缓存失败, 数据流已不完整, 不能重试, 只能关闭隧道
+    void onCacheError();
+
+    // 隧道建立前代理侧失败时, 在预算内安排换上游重试
+    bool tryRetry();
+
+    // 空闲检测: 数据通路只记录活跃时间, 定时器到期时再判断是否真的空闲
+    void armIdleTimer();
+    void checkIdle();
+
+    // 解析本地客户端的代理请求(HTTP/SOCKS5)
+    void onLocalRequest(const void *data, size_t datalen);
+    // 向本地客户端回复隧道建立结果
+    void replyLocal(bool established);
+
+    // 处理代理链上各跳的CONNECT响应
+    void onProxyHandshake(const void *data, size_t datalen);
 
     // 将缓存的本地客户端发上来的数据发送到代理服务器
+    // 只发送socket(或h2流控窗口)能接收的部分, 其余留在mLocalCache中, 可写时(onWritable/onStreamWritable)继续
     void flushLocal();
-    bool onFlushLocal(const void *data, size_t datalen);       
+    ssize_t onFlushLocal(const void *data, size_t datalen);
+    ssize_t onFlushLocalv(const struct iovec *iov, int iovcnt);
+    // 溢出文件中的数据直接sendfile给代理服务器, h2上游返回-1改从内存发送
+    ssize_t onFlushLocalFile(int fd, off_t off, size_t len);
 
     void _onClose();
     void _onError();    
@@ -93,22 +251,50 @@ class ProxyTunnel : public Connection::Handler
   private:
     EventPoller *mEventPoller;
 
+    TimerWheel *mTimerWheel;
+    Timer mTimer; // 等待请求/连接/握手超时, 隧道建立后用于空闲检测
+    int mConnectTimeout;
+    int mHandshakeTimeout;
+    int mMaxRetries;
+    int mRetries;
+    int mIdleTimeout;
+    int mRequestTimeout;
+    uint64 mLastActive; // 最近一次收到数据的tick
+
+    KeepAliveConfig mKeepAliveLocal;
+    KeepAliveConfig mKeepAliveProxy;
+
     Handler *mHandler;
+    Route *mRoute;
 
     Connection mLocalConn;
     Connection mProxyConn;
 
+    H2SessionPool *mH2Pool; // 为NULL时每个隧道独占一条HTTP/1.1连接
+    H2Session *mH2Session; // 承载本隧道的HTTP/2会话
+    uint32 mStreamId;
+
     MyCache *mLocalCache;
 
     sockaddr_in mProxySvrAddr; // 代理服务器地址
     char mDestSvrHost[ADDR_SIZE]; // 目标服务器地址
     int mDestSvrPort; // 目标服务器端口
 
+    ProxyHopList mHops;
+    size_t mHopIndex; // 已建立的跳数
+
     EProxyStatus mProxyStatus;
-    char mHttpHeader[HTTP_HEADER_SIZE];
+    HttpResponseParser mResponseParser;
+
+    ERouteMode mMode;
+    HttpRequestParser mRequestParser;
+    Socks5Handshake mSocks5;
 
     std::string mUsername;
     std::string mPassword;
+
+    ProxyTunnel *mNextLink;
+    bool mbLinked; // 已在某条链表中
 };
 
 NAMESPACE_END // proxy
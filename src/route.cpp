@@ -0,0 +1,383 @@
+#include "route.h"
+
+NAMESPACE_BEG(proxy)
+
+Route::~Route()
+{
+    finalise();
+}
+
+bool Route::initialise(int listenFd)
+{
+    if (mConf.upstreams.empty())
+    {
+        ErrorPrint("[Route::initialise] no upstream for %s.", getListenName(mConf).c_str());
+        if (listenFd >= 0)
+            close(listenFd);
+        return false;
+    }
+
+    mListener.setTransparent(RouteMode_Transparent == mConf.mode);
+    mListener.setBacklog(mConf.backlog);
+    mListener.setAcceptBudget(mConf.acceptBudget);
+    mListener.setDeferAccept(mConf.deferAccept);
+    if (listenFd >= 0)
+    {
+        if (!mListener.attach(listenFd))
+        {
+            ErrorPrint("[Route::initialise] attach inherited listener %s failed.", getListenName(mConf).c_str());
+            return false;
+        }
+    }
+    else if (*mConf.listenUnix ? !mListener.initialiseUnix(mConf.listenUnix)
+                               : !mListener.initialise(mConf.listenIp, mConf.listenPort))
+    {
+        ErrorPrint("[Route::initialise] bind %s failed.", getListenName(mConf).c_str());
+        return false;
+    }
+    mListener.setEventHandler(this);
+
+    return true;
+}
+
+void Route::finalise()
+{
+    mListener.setEventHandler(NULL);
+    mListener.finalise();
+}
+
+const Upstream &Route::nextUpstream()
+{
+    assert(!mConf.upstreams.empty() && "Route::nextUpstream() no upstream");
+
+    if (mNextUpstream >= mConf.upstreams.size())
+        mNextUpstream = 0;
+
+    return mConf.upstreams[mNextUpstream++];
+}
+
+bool Route::canReconfigure(const RouteConfig &conf) const
+{
+    // 透明属性, backlog和TCP_DEFER_ACCEPT在listen时设置, 不能原地修改
+    return strcmp(conf.listenIp, mConf.listenIp) == 0 &&
+           conf.listenPort == mConf.listenPort &&
+           strcmp(conf.listenUnix, mConf.listenUnix) == 0 &&
+           (RouteMode_Transparent == conf.mode) == (RouteMode_Transparent == mConf.mode) &&
+           conf.backlog == mConf.backlog &&
+           conf.deferAccept == mConf.deferAccept;
+}
+
+void Route::reconfigure(const RouteConfig &conf)
+{
+    mConf = conf;
+    mNextUpstream = 0;
+
+    mListener.setAcceptBudget(mConf.acceptBudget);
+    checkAdmission();
+}
+
+void Route::checkAdmission()
+{
+    bool full = mConf.maxTunnels > 0 && mStats.active >= (uint64)mConf.maxTunnels;
+
+    if (full && !mListener.isPaused())
+    {
+        ++mStats.paused;
+        DebugPrint("[Route::checkAdmission] %s reach max tunnels(%d), pause accepting.",
+                   getListenName(mConf).c_str(), mConf.maxTunnels);
+        mListener.pause();
+    }
+    else if (!full && mListener.isPaused())
+    {
+        mListener.resume();
+    }
+}
+
+void Route::onAccept(int connfd)
+{
+    ++mStats.accepted;
+
+    if (mHandler)
+    {
+        mHandler->onAccept(this, connfd);
+    }
+    else
+    {
+        close(connfd);
+    }
+
+    checkAdmission();
+}
+
+void Route::onOverload()
+{
+    ++mStats.shed;
+}
+
+std::string getListenName(const RouteConfig &conf)
+{
+    char name[UNIX_PATH_SIZE + sizeof(LISTEN_UNIX_PREFIX)];
+    if (*conf.listenUnix)
+        snprintf(name, sizeof(name), LISTEN_UNIX_PREFIX "%s", conf.listenUnix);
+    else
+        snprintf(name, sizeof(name), "%s:%d", conf.listenIp, conf.listenPort);
+    return name;
+}
+
+bool parseHostPort(const char *str, char *host, size_t hostlen, int *port)
+{
+    std::vector<std::string> v;
+    split(std::string(str), ':', v);
+
+    if (v.size() != 2)
+    {
+        return false;
+    }
+
+    *port = atoi(v[1].c_str());
+    if (!isValidPort(*port))
+    {
+        return false;
+    }
+
+    snprintf(host, hostlen, "%s", v[0].c_str());
+    return true;
+}
+
+bool parseRouteSpec(const char *spec, RouteConfig &conf)
+{
+    std::string s(spec);
+    std::string::size_type eq = s.find('=');
+    std::string::size_type at = (eq == std::string::npos) ? eq : s.find('@', eq);
+
+    if (eq == std::string::npos || at == std::string::npos)
+    {
+        return false;
+    }
+
+    std::string listen = s.substr(0, eq);
+    if (listen.compare(0, strlen(LISTEN_UNIX_PREFIX), LISTEN_UNIX_PREFIX) == 0)
+    {
+        std::string path = listen.substr(strlen(LISTEN_UNIX_PREFIX));
+        if (path.empty() || path == "@" || path.size() >= sizeof(conf.listenUnix))
+        {
+            return false;
+        }
+        snprintf(conf.listenUnix, sizeof(conf.listenUnix), "%s", path.c_str());
+    }
+    else if (!parseHostPort(listen.c_str(), conf.listenIp, sizeof(conf.listenIp), &conf.listenPort) ||
+             !isValidIp(conf.listenIp))
+    {
+        return false;
+    }
+
+    std::string dest = s.substr(eq + 1, at - eq - 1);
+    if (dest == "http")
+    {
+        conf.mode = RouteMode_HttpConnect;
+        snprintf(conf.destHost, sizeof(conf.destHost), "%s", dest.c_str());
+        conf.destPort = 0;
+    }
+    else if (dest == "transparent" && !*conf.listenUnix)
+    {
+        conf.mode = RouteMode_Transparent;
+        snprintf(conf.destHost, sizeof(conf.destHost), "%s", dest.c_str());
+        conf.destPort = 0;
+    }
+    else if (dest.compare(0, 6, "socks5") == 0 && (dest.size() == 6 || dest[6] == ':'))
+    {
+        conf.mode = RouteMode_Socks5;
+        snprintf(conf.destHost, sizeof(conf.destHost), "socks5");
+        conf.destPort = 0;
+
+        if (dest.size() > 6) // socks5:user:pass
+        {
+            std::string::size_type sep = dest.find(':', 7);
+            if (sep == std::string::npos || sep == 7)
+            {
+                return false;
+            }
+            snprintf(conf.socksUser, sizeof(conf.socksUser), "%s", dest.substr(7, sep - 7).c_str());
+            snprintf(conf.socksPass, sizeof(conf.socksPass), "%s", dest.substr(sep + 1).c_str());
+        }
+    }
+    else
+    {
+        conf.mode = RouteMode_Fixed;
+        if (!parseHostPort(dest.c_str(), conf.destHost, sizeof(conf.destHost), &conf.destPort))
+        {
+            return false;
+        }
+    }
+
+    std::vector<std::string> vopt;
+    split(s.substr(at + 1), ROUTE_OPTION_SEP, vopt);
+    if (vopt.empty())
+    {
+        return false;
+    }
+
+    for (size_t i = 1; i < vopt.size(); ++i)
+    {
+        if (!parseRouteOption(vopt[i], conf))
+        {
+            return false;
+        }
+    }
+
+    std::vector<std::string> vproxy;
+    split(vopt[0], ',', vproxy);
+    if (vproxy.empty())
+    {
+        return false;
+    }
+
+    conf.upstreams.clear();
+    for (size_t i = 0; i < vproxy.size(); ++i)
+    {
+        std::vector<std::string> vhop;
+        split(vproxy[i], UPSTREAM_HOP_SEP, vhop);
+        if (vhop.empty() || vhop.size() > PROXY_CHAIN_MAX + 1)
+        {
+            return false;
+        }
+
+        Upstream up;
+        std::string addr = vhop[0];
+        if (addr.compare(0, strlen(UPSTREAM_H2_PREFIX), UPSTREAM_H2_PREFIX) == 0)
+        {
+            up.h2 = true;
+            addr = addr.substr(strlen(UPSTREAM_H2_PREFIX));
+        }
+
+        if (!parseHostPort(addr.c_str(), up.ip, sizeof(up.ip), &up.port) ||
+            !isValidIp(up.ip))
+        {
+            return false;
+        }
+
+        for (size_t j = 1; j < vhop.size(); ++j)
+        {
+            ProxyHop hop;
+            if (!parseHostPort(vhop[j].c_str(), hop.host, sizeof(hop.host), &hop.port))
+            {
+                return false;
+            }
+            up.hops.push_back(hop);
+        }
+        conf.upstreams.push_back(up);
+    }
+
+    return true;
+}
+
+static bool parseKeepAlive(const std::string &value, KeepAliveConfig &ka)
+{
+    int v[3] = {0, 0, 0};
+    std::vector<std::string> vs;
+    split(value, ':', vs);
+    if (vs.empty() || vs.size() > 3)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < vs.size(); ++i)
+    {
+        char *end = NULL;
+        long n = strtol(vs[i].c_str(), &end, 10);
+        if (*end != '\0' || n < 0 || n > 86400)
+        {
+            return false;
+        }
+        v[i] = (int)n;
+    }
+
+    ka.idle = v[0];
+    ka.interval = v[1];
+    ka.count = v[2];
+    return true;
+}
+
+bool parseRouteOption(const std::string &opt, RouteConfig &conf)
+{
+    std::string::size_type eq = opt.find('=');
+    if (eq == std::string::npos)
+    {
+        return false;
+    }
+
+    std::string key = opt.substr(0, eq);
+    std::string value = opt.substr(eq + 1);
+
+    if (key == "keepalive_local")
+        return parseKeepAlive(value, conf.keepaliveLocal);
+    if (key == "keepalive_proxy")
+        return parseKeepAlive(value, conf.keepaliveProxy);
+
+    char *end = NULL;
+    long n = strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || n < 0 || n > 86400)
+    {
+        return false;
+    }
+
+    if (key == "connect_timeout" && n > 0)
+        conf.connectTimeout = (int)n;
+    else if (key == "handshake_timeout" && n > 0)
+        conf.handshakeTimeout = (int)n;
+    else if (key == "retries")
+        conf.retries = (int)n;
+    else if (key == "idle_timeout")
+        conf.idleTimeout = (int)n;
+    else if (key == "request_timeout" && n > 0)
+        conf.requestTimeout = (int)n;
+    else if (key == "max_tunnels")
+        conf.maxTunnels = (int)n;
+    else if (key == "backlog" && n > 0)
+        conf.backlog = (int)n;
+    else if (key == "accept_budget" && n > 0)
+        conf.acceptBudget = (int)n;
+    else if (key == "defer_accept")
+        conf.deferAccept = (int)n;
+    else
+        return false;
+
+    return true;
+}
+
+bool parseRouteFile(const char *path, std::vector<RouteConfig> &routes)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        ErrorPrint("[parseRouteFile] open %s failed! %s", path, strerror(errno));
+        return false;
+    }
+
+    std::string line;
+    int lineno = 0;
+    while (std::getline(in, line))
+    {
+        ++lineno;
+
+        std::string::size_type beg = line.find_first_not_of(" \t\r");
+        if (beg == std::string::npos || '#' == line[beg])
+        {
+            continue;
+        }
+        std::string::size_type end = line.find_last_not_of(" \t\r");
+        std::string spec = line.substr(beg, end - beg + 1);
+
+        RouteConfig conf;
+        if (!parseRouteSpec(spec.c_str(), conf))
+        {
+            ErrorPrint("[parseRouteFile] %s:%d route format error: %s", path, lineno, spec.c_str());
+            return false;
+        }
+        routes.push_back(conf);
+    }
+
+    return true;
+}
+
+NAMESPACE_END // namespace proxy
@@ -0,0 +1,254 @@
+#ifndef __ROUTE_H__
+#define __ROUTE_H__
+
+#include "proxy_common.h"
+#include "listener.h"
+
+NAMESPACE_BEG(proxy)
+
+#define UPSTREAM_H2_PREFIX "h2://"
+#define UPSTREAM_HOP_SEP   '>'
+#define PROXY_CHAIN_MAX    8 // 代理链最多跳数(不含第一跳)
+#define ROUTE_OPTION_SEP   '+'
+#define LISTEN_UNIX_PREFIX "unix:"
+#define UNIX_PATH_SIZE     108 // sockaddr_un::sun_path
+
+#define DEFAULT_CONNECT_TIMEOUT   10 // 连接上游代理超时(s)
+#define DEFAULT_HANDSHAKE_TIMEOUT 10 // 等待CONNECT响应超时(s)
+#define DEFAULT_RETRIES           2  // 超时/连接失败后换上游重试的次数
+#define DEFAULT_IDLE_TIMEOUT      0  // 隧道空闲超时(s), 0为不限
+#define DEFAULT_REQUEST_TIMEOUT   10 // 等待客户端发完代理请求(CONNECT/SOCKS5)的超时(s)
+
+// 代理链中第一跳之后的代理, 经由前一跳CONNECT到达
+struct ProxyHop
+{
+    char host[ADDR_SIZE];
+    int port;
+
+    ProxyHop() : port(0)
+    {
+        *host = '\0';
+    }
+};
+
+typedef std::vector<ProxyHop> ProxyHopList;
+
+// 上游代理服务器地址
+struct Upstream
+{
+    char ip[IPv4_SIZE];
+    int port;
+    bool h2; // 经由HTTP/2(h2c)多路复用连接该代理
+
+    ProxyHopList hops; // 其后依次经过的代理
+
+    Upstream() : port(0), h2(false), hops()
+    {
+        *ip = '\0';
+    }
+};
+
+typedef std::vector<Upstream> UpstreamList;
+
+// TCP保活参数(s), idle为0时不开启
+struct KeepAliveConfig
+{
+    int idle;
+    int interval;
+    int count;
+
+    KeepAliveConfig() : idle(0), interval(0), count(0)
+    {}
+};
+
+// 路由模式: 目标服务器的确定方式
+enum ERouteMode
+{
+    RouteMode_Fixed = 0,   // 目标服务器固定
+    RouteMode_HttpConnect, // 本地客户端通过HTTP代理请求(CONNECT/absolute-URI)指定目标
+    RouteMode_Socks5,      // 本地客户端通过SOCKS5请求指定目标
+    RouteMode_Transparent, // 透明代理, 目标为被iptables重定向前的原始地址
+};
+
+// 路由配置: 监听地址 -> 目标服务器, 经由一组上游代理
+struct RouteConfig
+{
+    char listenIp[IPv4_SIZE];
+    int listenPort;
+    char listenUnix[UNIX_PATH_SIZE]; // 非空时监听Unix域套接字, 以'@'开头为抽象命名空间
+
+    ERouteMode mode;
+    char destHost[ADDR_SIZE];
+    int destPort;
+
+    UpstreamList upstreams;
+
+    // SOCKS5前端认证用的用户名/密码, 用户名为空时不要求认证
+    char socksUser[256];
+    char socksPass[256];
+
+    int connectTimeout;
+    int handshakeTimeout;
+    int retries;
+    int idleTimeout;
+    int requestTimeout;
+    int maxTunnels; // 并发隧道数上限, 0为不限
+
+    int backlog;      // listen的backlog
+    int acceptBudget; // 每次可读事件最多accept的连接数
+    int deferAccept;  // TCP_DEFER_ACCEPT等待时间(s), 0为关闭
+
+    KeepAliveConfig keepaliveLocal; // 本地客户端连接的TCP保活
+    KeepAliveConfig keepaliveProxy; // 上游代理连接的TCP保活
+
+    RouteConfig() : listenPort(0), mode(RouteMode_Fixed), destPort(0), upstreams()
+                  , connectTimeout(DEFAULT_CONNECT_TIMEOUT)
+                  , handshakeTimeout(DEFAULT_HANDSHAKE_TIMEOUT)
+                  , retries(DEFAULT_RETRIES)
+                  , idleTimeout(DEFAULT_IDLE_TIMEOUT)
+                  , requestTimeout(DEFAULT_REQUEST_TIMEOUT)
+                  , maxTunnels(0)
+                  , backlog(DEFAULT_LISTEN_BACKLOG)
+                  , acceptBudget(DEFAULT_ACCEPT_BUDGET)
+                  , deferAccept(0)
+                  , keepaliveLocal()
+                  , keepaliveProxy()
+    {
+        *listenIp = '\0';
+        *listenUnix = '\0';
+        *destHost = '\0';
+        *socksUser = '\0';
+        *socksPass = '\0';
+    }
+};
+
+// 路由统计
+struct RouteStats
+{
+    uint64 accepted; // 累计接入的连接数
+    uint64 failed;   // 累计建立失败/出错的隧道数
+    uint64 closed;   // 累计正常关闭的隧道数
+    uint64 active;   // 当前活跃的隧道数
+    uint64 retried;  // 累计换上游重试的次数
+    uint64 paused;   // 累计因并发上限暂停接入的次数
+    uint64 shed;     // 累计因fd耗尽丢弃的连接数
+
+    RouteStats() : accepted(0), failed(0), closed(0), active(0), retried(0), paused(0), shed(0)
+    {}
+};
+
+class Route : public Listener::Handler
+{
+  public:
+    class Handler
+    {
+      public:
+        Handler() {}
+
+        virtual void onAccept(Route *route, int connfd) = 0;
+    };
+
+    Route(EventPoller *poller, const RouteConfig &conf)
+            :mHandler(NULL)
+            ,mListener(poller)
+            ,mConf(conf)
+            ,mNextUpstream(0)
+            ,mStats()
+    {}
+
+    virtual ~Route();
+
+    // listenFd为热升级时继承的监听fd, 为-1时自行绑定监听地址
+    bool initialise(int listenFd = -1);
+    void finalise();
+
+    inline int getListenerFd() const
+    {
+        return mListener.getFd();
+    }
+
+    // 新配置与当前监听参数一致时可原地更新, 否则需换新路由接管监听socket重新listen
+    bool canReconfigure(const RouteConfig &conf) const;
+    // 原地更新配置, 只影响之后接入的隧道
+    void reconfigure(const RouteConfig &conf);
+
+    inline void setEventHandler(Handler *h)
+    {
+        mHandler = h;
+    }
+
+    inline const RouteConfig &getConfig() const
+    {
+        return mConf;
+    }
+
+    inline RouteStats &getStats()
+    {
+        return mStats;
+    }
+
+    // 轮询选取一个上游代理
+    const Upstream &nextUpstream();
+
+    // 按活跃隧道数暂停/恢复接入, 隧道数变化后调用
+    void checkAdmission();
+
+    // Listener::Handler
+    virtual void onAccept(int connfd);
+    virtual void onOverload();
+
+  private:
+    Handler *mHandler;
+    Listener mListener;
+
+    RouteConfig mConf;
+    size_t mNextUpstream;
+
+    RouteStats mStats;
+};
+
+// 监听地址的可读形式: "ip:port"或"unix:path", 也用作热升级时监听fd的名字
+std::string getListenName(const RouteConfig &conf);
+
+/*
+ * 解析"ip:port"格式的地址
+ */
+bool parseHostPort(const char *str, char *host, size_t hostlen, int *port);
+
+/*
+ * 解析路由描述串: "listen_ip:port=dest@[h2://]proxy_ip:port[,[h2://]proxy_ip:port...]"
+ * 监听地址可写为"unix:/path/to/sock"或"unix:@name"(抽象命名空间), 不支持transparent
+ * dest为"dest_host:port"时目标固定, 为"http"时由本地客户端的HTTP代理请求指定,
+ * 为"socks5[:user:pass]"时由本地客户端的SOCKS5请求指定,
+ * 为"transparent"时取被iptables REDIRECT/TPROXY重定向前的原始目标地址
+ * 代理地址带"h2://"前缀时, 所有隧道复用到该代理的HTTP/2连接上
+ * 代理地址可写为"proxy_ip:port>hop_host:port[>...]"的代理链, 依次经过各跳到达目标
+ * 末尾可附加"+key=value"形式的路由选项, 见parseRouteOption()
+ */
+bool parseRouteSpec(const char *spec, RouteConfig &conf);
+
+/*
+ * 解析单个路由选项
+ *   connect_timeout=秒     连接上游代理超时
+ *   handshake_timeout=秒   等待CONNECT响应超时
+ *   retries=次数           超时/连接失败后换上游重试的次数
+ *   idle_timeout=秒        隧道空闲超时, 0为不限
+ *   request_timeout=秒     CONNECT/SOCKS5前端等待客户端发完代理请求的超时
+ *   max_tunnels=个数       并发隧道数上限, 达到后暂停接入, 0为不限
+ *   backlog=个数           监听队列长度
+ *   accept_budget=个数     每次可读事件最多accept的连接数
+ *   defer_accept=秒        TCP_DEFER_ACCEPT, 客户端先发数据才接入, 不适用于服务端先发数据的协议
+ *   keepalive_local=idle[:interval[:count]]  本地客户端连接的TCP保活
+ *   keepalive_proxy=idle[:interval[:count]]  上游代理连接的TCP保活
+ */
+bool parseRouteOption(const std::string &opt, RouteConfig &conf);
+
+/*
+ * 解析路由配置文件: 每行一条路由描述串, 格式同parseRouteSpec()
+ * 空行及以'#'开头的行被忽略
+ */
+bool parseRouteFile(const char *path, std::vector<RouteConfig> &routes);
+
+NAMESPACE_END // namespace proxy
+
+#endif // __ROUTE_H__
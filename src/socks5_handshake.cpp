@@ -0,0 +1,208 @@
+#include "socks5_handshake.h"
+
+NAMESPACE_BEG(proxy)
+
+void Socks5Handshake::reset()
+{
+    mState = State_Greeting;
+    mBufLen = 0;
+    mReplyLen = 0;
+    *mHost = '\0';
+    mPort = 0;
+}
+
+void Socks5Handshake::setCredential(const char *user, const char *pass)
+{
+    mUsername = (user && *user) ? user : NULL;
+    mPassword = pass ? pass : "";
+}
+
+size_t Socks5Handshake::feed(const char *data, size_t datalen)
+{
+    size_t i = 0;
+    mReplyLen = 0;
+
+    while (State_Done != mState && State_Error != mState)
+    {
+        size_t need = _msgLen();
+        assert(need <= sizeof(mBuf) && "Socks5Handshake msg too long");
+
+        if (mBufLen < need) // 当前消息尚不完整
+        {
+            if (i >= datalen)
+                break;
+
+            size_t n = min(need - mBufLen, datalen - i);
+            memcpy(mBuf + mBufLen, data + i, n);
+            mBufLen += n;
+            i += n;
+            continue;
+        }
+
+        if (mBuf[0] != (State_Auth == mState ? SOCKS5_AUTH_VERSION : SOCKS5_VERSION))
+        {
+            mState = State_Error;
+            break;
+        }
+
+        switch (mState)
+        {
+        case State_Greeting:
+            _onGreeting();
+            break;
+        case State_Auth:
+            _onAuth();
+            break;
+        case State_Request:
+            _onRequest();
+            break;
+        default:
+            break;
+        }
+        mBufLen = 0;
+    }
+
+    return i;
+}
+
+int Socks5Handshake::buildReply(uint8 rep, char *buf, size_t buflen)
+{
+    // VER REP RSV ATYP BND.ADDR(0.0.0.0) BND.PORT(0)
+    static const size_t replen = 10;
+    if (buflen < replen)
+        return -1;
+
+    memset(buf, 0, replen);
+    buf[0] = SOCKS5_VERSION;
+    buf[1] = (char)rep;
+    buf[3] = SOCKS5_ATYP_IPV4;
+
+    return (int)replen;
+}
+
+size_t Socks5Handshake::_msgLen() const
+{
+    switch (mState)
+    {
+    case State_Greeting: // VER NMETHODS METHODS
+        if (mBufLen < 2)
+            return 2;
+        return 2 + mBuf[1];
+    case State_Auth: // VER ULEN UNAME PLEN PASSWD
+        if (mBufLen < 2)
+            return 2;
+        if (mBufLen < 3 + (size_t)mBuf[1])
+            return 3 + mBuf[1];
+        return 3 + mBuf[1] + mBuf[2 + mBuf[1]];
+    case State_Request: // VER CMD RSV ATYP DST.ADDR DST.PORT
+        if (mBufLen < 5)
+            return 5;
+        switch (mBuf[3])
+        {
+        case SOCKS5_ATYP_IPV4:
+            return 4 + 4 + 2;
+        case SOCKS5_ATYP_DOMAIN:
+            return 4 + 1 + mBuf[4] + 2;
+        case SOCKS5_ATYP_IPV6:
+            return 4 + 16 + 2;
+        default:
+            return 5;
+        }
+    default:
+        return 0;
+    }
+}
+
+void Socks5Handshake::_onGreeting()
+{
+    uint8 want = mUsername ? SOCKS5_METHOD_USERPASS : SOCKS5_METHOD_NO_AUTH;
+
+    for (size_t i = 0; i < mBuf[1]; ++i)
+    {
+        if (mBuf[2 + i] == want)
+        {
+            _reply(SOCKS5_VERSION, want);
+            mState = mUsername ? State_Auth : State_Request;
+            return;
+        }
+    }
+
+    _reply(SOCKS5_VERSION, SOCKS5_METHOD_UNACCEPTABLE);
+    mState = State_Error;
+}
+
+void Socks5Handshake::_onAuth()
+{
+    size_t ulen = mBuf[1];
+    const char *uname = (const char *)mBuf + 2;
+    size_t plen = mBuf[2 + ulen];
+    const char *passwd = (const char *)mBuf + 3 + ulen;
+
+    if (ulen == strlen(mUsername) && memcmp(uname, mUsername, ulen) == 0 &&
+        plen == strlen(mPassword) && memcmp(passwd, mPassword, plen) == 0)
+    {
+        _reply(SOCKS5_AUTH_VERSION, 0x00);
+        mState = State_Request;
+        return;
+    }
+
+    _reply(SOCKS5_AUTH_VERSION, 0x01);
+    mState = State_Error;
+}
+
+void Socks5Handshake::_onRequest()
+{
+    if (mBuf[1] != SOCKS5_CMD_CONNECT)
+    {
+        mReplyLen += buildReply(SOCKS5_REP_CMD_UNSUPPORTED, mReply + mReplyLen, sizeof(mReply) - mReplyLen);
+        mState = State_Error;
+        return;
+    }
+
+    const uint8 *portptr = NULL;
+    switch (mBuf[3])
+    {
+    case SOCKS5_ATYP_IPV4:
+        inet_ntop(AF_INET, mBuf + 4, mHost, sizeof(mHost));
+        portptr = mBuf + 4 + 4;
+        break;
+    case SOCKS5_ATYP_DOMAIN:
+        if (0 == mBuf[4])
+        {
+            mReplyLen += buildReply(SOCKS5_REP_HOST_UNREACH, mReply + mReplyLen, sizeof(mReply) - mReplyLen);
+            mState = State_Error;
+            return;
+        }
+        memcpy(mHost, mBuf + 5, mBuf[4]);
+        mHost[mBuf[4]] = '\0';
+        portptr = mBuf + 5 + mBuf[4];
+        break;
+    case SOCKS5_ATYP_IPV6:
+        inet_ntop(AF_INET6, mBuf + 4, mHost, sizeof(mHost));
+        portptr = mBuf + 4 + 16;
+        break;
+    default:
+        mReplyLen += buildReply(SOCKS5_REP_ATYP_UNSUPPORTED, mReply + mReplyLen, sizeof(mReply) - mReplyLen);
+        mState = State_Error;
+        return;
+    }
+
+    mPort = (portptr[0] << 8) | portptr[1];
+    if (!isValidPort(mPort))
+    {
+        mReplyLen += buildReply(SOCKS5_REP_HOST_UNREACH, mReply + mReplyLen, sizeof(mReply) - mReplyLen);
+        mState = State_Error;
+        return;
+    }
+
+    mState = State_Done;
+}
+
+void Socks5Handshake::_reply(uint8 b1, uint8 b2)
+{
+    assert(mReplyLen + 2 <= sizeof(mReply) && "Socks5Handshake reply overflow");
+    mReply[mReplyLen++] = (char)b1;
+    mReply[mReplyLen++] = (char)b2;
+}
+
+NAMESPACE_END // namespace proxy
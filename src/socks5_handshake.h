@@ -0,0 +1,131 @@
+#ifndef __SOCKS5_HANDSHAKE_H__
+#define __SOCKS5_HANDSHAKE_H__
+
+#include "proxy_common.h"
+
+#define SOCKS5_VERSION             0x05
+#define SOCKS5_AUTH_VERSION        0x01
+
+#define SOCKS5_METHOD_NO_AUTH      0x00
+#define SOCKS5_METHOD_USERPASS     0x02
+#define SOCKS5_METHOD_UNACCEPTABLE 0xFF
+
+#define SOCKS5_CMD_CONNECT         0x01
+
+#define SOCKS5_ATYP_IPV4           0x01
+#define SOCKS5_ATYP_DOMAIN         0x03
+#define SOCKS5_ATYP_IPV6           0x04
+
+#define SOCKS5_REP_SUCCEEDED       0x00
+#define SOCKS5_REP_GENERAL_FAILURE 0x01
+#define SOCKS5_REP_HOST_UNREACH    0x04
+#define SOCKS5_REP_CMD_UNSUPPORTED 0x07
+#define SOCKS5_REP_ATYP_UNSUPPORTED 0x08
+
+#define SOCKS5_MSG_MAX             520 // 最长的消息为用户名/密码认证(1+1+255+1+255)
+#define SOCKS5_REPLY_MAX           16
+
+NAMESPACE_BEG(proxy)
+
+/*
+ * 本地客户端SOCKS5握手状态机(增量式, 不分配内存)
+ * 支持无认证与用户名/密码认证, 仅支持CONNECT命令
+ */
+class Socks5Handshake
+{
+    enum EState
+    {
+        State_Greeting = 0,
+        State_Auth,
+        State_Request,
+        State_Done,
+        State_Error,
+    };
+
+  public:
+    Socks5Handshake()
+            :mUsername(NULL)
+            ,mPassword(NULL)
+    {
+        reset();
+    }
+
+    void reset();
+
+    /*
+     * 设置认证用的用户名/密码, 为NULL时不要求认证
+     * 仅保存指针, 调用者需保证其生命周期
+     */
+    void setCredential(const char *user, const char *pass);
+
+    /*
+     * 输入数据, 返回本次消耗的字节数
+     * 握手完成后不再消耗数据, 剩余数据属于握手之后的负载
+     * 本次需要回复给客户端的数据可通过getReply()获取
+     */
+    size_t feed(const char *data, size_t datalen);
+
+    inline bool isDone() const
+    {
+        return State_Done == mState;
+    }
+
+    inline bool isError() const
+    {
+        return State_Error == mState;
+    }
+
+    inline const char *getReply() const
+    {
+        return mReply;
+    }
+
+    inline size_t getReplyLen() const
+    {
+        return mReplyLen;
+    }
+
+    inline const char *getHost() const
+    {
+        return mHost;
+    }
+
+    inline int getPort() const
+    {
+        return mPort;
+    }
+
+    /*
+     * 生成CONNECT命令的应答
+     * return 写入的字节数, 失败返回-1
+     */
+    static int buildReply(uint8 rep, char *buf, size_t buflen);
+
+  private:
+    size_t _msgLen() const;
+
+    void _onGreeting();
+    void _onAuth();
+    void _onRequest();
+
+    void _reply(uint8 b1, uint8 b2);
+
+  private:
+    EState mState;
+
+    const char *mUsername;
+    const char *mPassword;
+
+    uint8 mBuf[SOCKS5_MSG_MAX];
+    size_t mBufLen;
+
+    char mReply[SOCKS5_REPLY_MAX];
+    size_t mReplyLen;
+
+    char mHost[ADDR_SIZE];
+    int mPort;
+};
+
+NAMESPACE_END // namespace proxy
+
+#endif // __SOCKS5_HANDSHAKE_H__
@@ -0,0 +1,244 @@
+#include "spill_io.h"
+
+NAMESPACE_BEG(proxy)
+
+SpillIo gSpillIo;
+
+SpillIo::~SpillIo()
+{
+    finalise();
+}
+
+bool SpillIo::initialise(EventPoller *poller)
+{
+    if (mbRunning)
+    {
+        return true;
+    }
+
+    if (pipe(mNotifyPipe) < 0)
+    {
+        ErrorPrint("[SpillIo::initialise] create notify pipe failed! %s", strerror(errno));
+        return false;
+    }
+    setNonblocking(mNotifyPipe[0]);
+    setNonblocking(mNotifyPipe[1]);
+    fcntl(mNotifyPipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(mNotifyPipe[1], F_SETFD, FD_CLOEXEC);
+
+    if (pthread_mutex_init(&mMutex, NULL) != 0 || pthread_cond_init(&mCond, NULL) != 0)
+    {
+        ErrorPrint("[SpillIo::initialise] init mutex failed!");
+        goto err_1;
+    }
+
+    mEventPoller = poller;
+    mbExit = false;
+    if (pthread_create(&mThread, NULL, SpillIo::threadFunc, (void *)this) != 0)
+    {
+        ErrorPrint("[SpillIo::initialise] create thread failed! %s", strerror(errno));
+        goto err_1;
+    }
+    mbRunning = true;
+
+    mEventPoller->registerForRead(mNotifyPipe[0], this);
+    return true;
+
+err_1:
+    close(mNotifyPipe[0]);
+    close(mNotifyPipe[1]);
+    mNotifyPipe[0] = mNotifyPipe[1] = -1;
+    mEventPoller = NULL;
+
+    return false;
+}
+
+void SpillIo::finalise()
+{
+    if (!mbRunning)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&mMutex);
+    mbExit = true;
+    pthread_cond_signal(&mCond);
+    pthread_mutex_unlock(&mMutex);
+
+    pthread_join(mThread, NULL);
+    mbRunning = false;
+
+    // 进程退出中, 提交者可能已不存在, 只释放已放弃的请求
+    while (!mDone.empty())
+    {
+        SpillJob *job = mDone.front();
+        mDone.pop_front();
+        if (NULL == job->handler)
+            complete(job);
+    }
+
+    mEventPoller->deregisterForRead(mNotifyPipe[0]);
+    close(mNotifyPipe[0]);
+    close(mNotifyPipe[1]);
+    mNotifyPipe[0] = mNotifyPipe[1] = -1;
+    mEventPoller = NULL;
+
+    pthread_cond_destroy(&mCond);
+    pthread_mutex_destroy(&mMutex);
+}
+
+bool SpillIo::submit(SpillJob *job)
+{
+    assert(job && "SpillIo::submit() job != NULL");
+
+    ++mJobs;
+    if (!mbRunning)
+    {
+        execute(job);
+        return false;
+    }
+
+    pthread_mutex_lock(&mMutex);
+    mPending.push_back(job);
+    if (mPending.size() > mMaxPending)
+        mMaxPending = mPending.size();
+    pthread_cond_signal(&mCond);
+    pthread_mutex_unlock(&mMutex);
+
+    return true;
+}
+
+void SpillIo::dumpStats() const
+{
+    InfoPrint("[stats] spill io jobs=%llu written=%llu read=%llu prefetched=%llu max_pending=%u",
+              mJobs, mBytesWritten, mBytesRead, mBytesPrefetched, (uint)mMaxPending);
+}
+
+int SpillIo::handleInputNotification(int fd)
+{
+    char buf[64];
+    while (read(fd, buf, sizeof(buf)) > 0)
+    {}
+
+    std::deque<SpillJob *> done;
+    pthread_mutex_lock(&mMutex);
+    done.swap(mDone);
+    pthread_mutex_unlock(&mMutex);
+
+    // 回调中可能提交新的请求或放弃其他请求, 逐个取出再回调
+    while (!done.empty())
+    {
+        SpillJob *job = done.front();
+        done.pop_front();
+
+        if (job->result > 0)
+        {
+            if (SpillJob::Type_Write == job->type)
+                mBytesWritten += job->result;
+            else if (SpillJob::Type_Read == job->type)
+                mBytesRead += job->result;
+        }
+        if (SpillJob::Type_Prefetch == job->type && 0 == job->result)
+            mBytesPrefetched += job->len;
+
+        complete(job);
+    }
+
+    return 0;
+}
+
+void *SpillIo::threadFunc(void *arg)
+{
+    SpillIo *io = (SpillIo *)arg;
+    io->run();
+    return NULL;
+}
+
+void SpillIo::run()
+{
+    pthread_mutex_lock(&mMutex);
+    for (;;)
+    {
+        // 退出前执行完已提交的请求, 保证fd被关闭
+        while (mPending.empty() && !mbExit)
+            pthread_cond_wait(&mCond, &mMutex);
+
+        if (mPending.empty())
+            break;
+
+        SpillJob *job = mPending.front();
+        mPending.pop_front();
+        pthread_mutex_unlock(&mMutex);
+
+        execute(job);
+
+        pthread_mutex_lock(&mMutex);
+        bool wakeup = mDone.empty();
+        mDone.push_back(job);
+        if (wakeup)
+        {
+            char c = 0;
+            if (write(mNotifyPipe[1], &c, 1) < 0)
+            {
+                // 管道满时已有未处理的通知
+            }
+        }
+    }
+    pthread_mutex_unlock(&mMutex);
+}
+
+void SpillIo::execute(SpillJob *job)
+{
+    ssize_t ret = 0;
+    switch (job->type)
+    {
+    case SpillJob::Type_Write:
+        ret = pwrite(job->fd, job->buf, job->len, job->off);
+        break;
+    case SpillJob::Type_Read:
+        ret = pread(job->fd, job->buf, job->len, job->off);
+        break;
+    case SpillJob::Type_Truncate:
+        ret = ftruncate(job->fd, job->off);
+        break;
+    case SpillJob::Type_Punch:
+#ifdef FALLOC_FL_PUNCH_HOLE
+        ret = fallocate(job->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, job->off, job->len);
+#endif
+        break;
+    case SpillJob::Type_Close:
+        ret = close(job->fd);
+        break;
+    case SpillJob::Type_Prefetch:
+#ifdef __linux__
+        ret = readahead(job->fd, job->off, job->len);
+#else
+        ret = posix_fadvise(job->fd, job->off, job->len, POSIX_FADV_WILLNEED);
+        if (ret != 0)
+        {
+            errno = ret;
+            ret = -1;
+        }
+#endif
+        break;
+    }
+
+    job->result = ret < 0 ? -errno : ret;
+}
+
+void SpillIo::complete(SpillJob *job)
+{
+    if (job->handler)
+    {
+        job->handler->onSpillDone(job);
+        return;
+    }
+
+    if (job->pool)
+        job->pool->freeChunk(job->buf);
+    else
+        free(job->buf);
+    delete job;
+}
+
+NAMESPACE_END // namespace proxy
@@ -0,0 +1,140 @@
+#ifndef __SPILL_IO_H__
+#define __SPILL_IO_H__
+
+#include "proxy_common.h"
+#include "event_poller.h"
+#include "chunk_pool.h"
+
+NAMESPACE_BEG(proxy)
+
+class SpillJob;
+
+/*
+ * 溢出文件的I/O线程: 事件循环提交读写请求, 由独立线程执行, 完成后经管道通知回事件循环
+ * 请求按提交顺序逐个执行, 先提交的写一定先于后提交的读/截断完成
+ * 未启动线程时(如工具程序中)submit()同步执行请求
+ */
+class SpillIo : public InputNotificationHandler
+{
+  public:
+    class Handler
+    {
+      public:
+        Handler() {}
+
+        // 在事件循环中回调, job及其buf交还给提交者
+        virtual void onSpillDone(SpillJob *job) = 0;
+    };
+
+    SpillIo()
+            :mEventPoller(NULL)
+            ,mThread()
+            ,mMutex()
+            ,mCond()
+            ,mPending()
+            ,mDone()
+            ,mbRunning(false)
+            ,mbExit(false)
+            ,mJobs(0)
+            ,mBytesWritten(0)
+            ,mBytesRead(0)
+            ,mBytesPrefetched(0)
+            ,mMaxPending(0)
+    {
+        mNotifyPipe[0] = mNotifyPipe[1] = -1;
+    }
+
+    virtual ~SpillIo();
+
+    bool initialise(EventPoller *poller);
+    // 执行完已提交的请求后退出线程, 不再回调
+    void finalise();
+
+    /*
+     * 提交请求
+     * return true 已交给I/O线程, 完成后回调job->handler
+     *        false 已同步执行完毕, 不会回调, 由调用方直接处理结果
+     */
+    bool submit(SpillJob *job);
+
+    void dumpStats() const;
+
+    // InputNotificationHandler
+    virtual int handleInputNotification(int fd);
+
+  private:
+    static void *threadFunc(void *arg);
+    void run();
+
+    static void execute(SpillJob *job);
+    // 交还给提交者, 提交者已放弃时释放
+    static void complete(SpillJob *job);
+
+  private:
+    EventPoller *mEventPoller;
+
+    pthread_t mThread;
+    pthread_mutex_t mMutex;
+    pthread_cond_t mCond;
+
+    std::deque<SpillJob *> mPending;
+    std::deque<SpillJob *> mDone;
+
+    int mNotifyPipe[2];
+    bool mbRunning;
+    bool mbExit;
+
+    uint64 mJobs;
+    uint64 mBytesWritten;
+    uint64 mBytesRead;
+    uint64 mBytesPrefetched;
+    size_t mMaxPending;
+};
+
+/*
+ * 一次溢出文件操作, 执行期间buf归请求所有
+ * 提交者放弃(如Cache被清空)时把handler置为NULL, 完成后由SpillIo释放buf(归还pool或free)
+ */
+class SpillJob
+{
+  public:
+    enum EType
+    {
+        Type_Write,
+        Type_Read,
+        Type_Truncate, // 截断到off
+        Type_Punch,    // 释放[off, off+len)的磁盘空间
+        Type_Close,    // 关闭fd, 排在此前的请求之后
+        Type_Prefetch, // 把[off, off+len)预读进页缓存, 供事件循环sendfile
+    };
+
+    SpillJob(EType type, int fd, off_t off, char *buf, size_t len)
+            :type(type)
+            ,fd(fd)
+            ,off(off)
+            ,buf(buf)
+            ,len(len)
+            ,pool(NULL)
+            ,result(0)
+            ,handler(NULL)
+            ,context(NULL)
+    {}
+
+    EType type;
+    int fd;
+    off_t off;
+    char *buf;
+    size_t len;
+    ChunkPool *pool; // buf所属的池, 为NULL时以free()释放
+
+    ssize_t result; // 读写的字节数, 失败为-errno
+
+    SpillIo::Handler *handler;
+    void *context; // 提交者自用
+};
+
+extern SpillIo gSpillIo;
+
+NAMESPACE_END // namespace proxy
+
+#endif // __SPILL_IO_H__
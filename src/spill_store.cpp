@@ -0,0 +1,77 @@
+#include "spill_store.h"
+
+NAMESPACE_BEG(proxy)
+
+SpillStore gSpillStore;
+
+SpillStore::~SpillStore()
+{
+    if (mFd >= 0)
+    {
+        close(mFd);
+        mFd = -1;
+    }
+}
+
+off_t SpillStore::allocExtent()
+{
+    if (mFd < 0)
+    {
+        mFd = createTempFile(SPILL_FILE_PREFIX);
+        if (mFd < 0)
+            return -1;
+    }
+
+    off_t off;
+    if (!mFreeExtents.empty())
+    {
+        off = mFreeExtents.back();
+        mFreeExtents.pop_back();
+    }
+    else
+    {
+        off = mFileEnd;
+        mFileEnd += SPILL_EXTENT_SIZE;
+    }
+
+    ++mAllocs;
+    if (++mInUse > mPeakInUse)
+        mPeakInUse = mInUse;
+
+    return off;
+}
+
+void SpillStore::freeExtent(off_t off)
+{
+    assert(mInUse > 0 && "SpillStore::freeExtent() mInUse > 0");
+
+    // 全部释放时截断文件, 从头重新分配
+    if (0 == --mInUse)
+    {
+        _submitDetached(SpillJob::Type_Truncate, 0, 0);
+        mFreeExtents.clear();
+        mFileEnd = 0;
+        return;
+    }
+
+    if (mFreeExtents.size() >= SPILL_STORE_KEEP_FREE)
+    {
+        _submitDetached(SpillJob::Type_Punch, off, SPILL_EXTENT_SIZE);
+    }
+    mFreeExtents.push_back(off);
+}
+
+void SpillStore::dumpStats() const
+{
+    InfoPrint("[stats] spill store extents in_use=%u peak=%u free=%u file=%llu allocs=%llu",
+              (uint)mInUse, (uint)mPeakInUse, (uint)mFreeExtents.size(), (uint64)mFileEnd, mAllocs);
+}
+
+void SpillStore::_submitDetached(SpillJob::EType type, off_t off, size_t len)
+{
+    SpillJob *job = new SpillJob(type, mFd, off, NULL, len);
+    if (!gSpillIo.submit(job))
+        delete job;
+}
+
+NAMESPACE_END // namespace proxy
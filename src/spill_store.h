@@ -0,0 +1,64 @@
+#ifndef __SPILL_STORE_H__
+#define __SPILL_STORE_H__
+
+#include "proxy_common.h"
+#include "disk_cache.h"
+#include "spill_io.h"
+
+NAMESPACE_BEG(proxy)
+
+#define SPILL_EXTENT_SIZE     (64*1024) // 分配给隧道的区段大小
+#define SPILL_STORE_KEEP_FREE 64        // 保留磁盘空间的空闲区段数, 再多的释放(punch)
+
+/*
+ * 进程内所有隧道共用的溢出文件, 按定长区段分配给各AsyncDiskCache
+ * 隧道不再各自创建临时文件, 溢出不额外占用fd
+ * 释放的区段挂在空闲链表上复用, 全部释放时截断文件
+ *
+ * 截断/释放磁盘空间都经gSpillIo按提交顺序执行: 区段被释放时其上未完成的写
+ * 一定先于新主人的读写执行, 区段可以立即复用
+ */
+class SpillStore
+{
+  public:
+    SpillStore()
+            :mFd(-1)
+            ,mFileEnd(0)
+            ,mFreeExtents()
+            ,mInUse(0)
+            ,mPeakInUse(0)
+            ,mAllocs(0)
+    {}
+
+    virtual ~SpillStore();
+
+    // 分配一个区段, 返回其在文件中的位置, 失败返回-1
+    off_t allocExtent();
+    void freeExtent(off_t off);
+
+    inline int getFd() const
+    {
+        return mFd;
+    }
+
+    void dumpStats() const;
+
+  private:
+    // 提交无需回调的请求
+    void _submitDetached(SpillJob::EType type, off_t off, size_t len);
+
+  private:
+    int mFd; // 首次分配时创建
+    off_t mFileEnd;
+    std::vector<off_t> mFreeExtents;
+
+    size_t mInUse;
+    size_t mPeakInUse;
+    uint64 mAllocs;
+};
+
+extern SpillStore gSpillStore;
+
+NAMESPACE_END // namespace proxy
+
+#endif // __SPILL_STORE_H__
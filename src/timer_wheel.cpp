@@ -0,0 +1,93 @@
+#include "timer_wheel.h"
+
+NAMESPACE_BEG(proxy)
+
+void Timer::cancel()
+{
+    if (!mWheel)
+        return;
+
+    mPrev->mNext = mNext;
+    mNext->mPrev = mPrev;
+    mPrev = mNext = NULL;
+    mWheel = NULL;
+}
+
+TimerWheel::TimerWheel()
+        :mCurrentTick(0)
+{
+    for (size_t i = 0; i < TIMER_WHEEL_SLOTS; ++i)
+    {
+        mSlots[i].mPrev = mSlots[i].mNext = &mSlots[i];
+    }
+}
+
+void TimerWheel::initialise(uint64 now)
+{
+    mCurrentTick = now / TIMER_WHEEL_TICK;
+}
+
+void TimerWheel::schedule(Timer *timer, uint64 delayMs)
+{
+    timer->cancel();
+
+    uint64 ticks = (delayMs + TIMER_WHEEL_TICK - 1) / TIMER_WHEEL_TICK;
+    if (0 == ticks)
+        ticks = 1;
+
+    timer->mExpireTick = mCurrentTick + ticks;
+    _link(&mSlots[timer->mExpireTick % TIMER_WHEEL_SLOTS], timer);
+}
+
+void TimerWheel::advance(uint64 now)
+{
+    uint64 target = now / TIMER_WHEEL_TICK;
+    if (target <= mCurrentTick)
+        return;
+
+    // 跨度超过一圈时每个槽只需处理一次
+    uint64 first = mCurrentTick + 1;
+    uint64 steps = min(target - mCurrentTick, (uint64)TIMER_WHEEL_SLOTS);
+    mCurrentTick = target;
+
+    for (uint64 i = 0; i < steps; ++i)
+    {
+        Timer *head = &mSlots[(first + i) % TIMER_WHEEL_SLOTS];
+        if (head->mNext == head)
+            continue;
+
+        // 先把整个槽摘下, 回调中调度的定时器不会在本轮被触发
+        Timer pending;
+        pending.mNext = head->mNext;
+        pending.mPrev = head->mPrev;
+        pending.mNext->mPrev = &pending;
+        pending.mPrev->mNext = &pending;
+        head->mPrev = head->mNext = head;
+
+        while (pending.mNext != &pending)
+        {
+            Timer *timer = pending.mNext;
+            timer->cancel();
+
+            if (timer->mExpireTick > mCurrentTick) // 尚未到期的后续轮次
+            {
+                _link(head, timer);
+            }
+            else if (timer->mHandler)
+            {
+                timer->mHandler->onTimeout(timer);
+            }
+        }
+    }
+}
+
+void TimerWheel::_link(Timer *head, Timer *timer)
+{
+    timer->mPrev = head->mPrev;
+    timer->mNext = head;
+    head->mPrev->mNext = timer;
+    head->mPrev = timer;
+    timer->mWheel = this;
+}
+
+NAMESPACE_END // namespace proxy
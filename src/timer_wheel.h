@@ -0,0 +1,97 @@
+#ifndef __TIMER_WHEEL_H__
+#define __TIMER_WHEEL_H__
+
+#include "proxy_common.h"
+
+#define TIMER_WHEEL_SLOTS 64
+#define TIMER_WHEEL_TICK  1000 // 时间轮精度(ms), 与事件循环每帧最长等待时间一致
+
+NAMESPACE_BEG(proxy)
+
+class TimerWheel;
+
+/*
+ * 时间轮上的定时器, 由使用者内嵌持有
+ * 以侵入式双向链表挂在槽上, 调度/取消均为O(1)且不分配内存
+ */
+class Timer
+{
+    friend class TimerWheel;
+
+  public:
+    class Handler
+    {
+      public:
+        Handler() {}
+
+        virtual void onTimeout(Timer *timer) = 0;
+    };
+
+    Timer()
+            :mHandler(NULL)
+            ,mWheel(NULL)
+            ,mPrev(NULL)
+            ,mNext(NULL)
+            ,mExpireTick(0)
+    {}
+
+    ~Timer()
+    {
+        cancel();
+    }
+
+    inline void setHandler(Handler *h)
+    {
+        mHandler = h;
+    }
+
+    inline bool isActive() const
+    {
+        return mWheel != NULL;
+    }
+
+    void cancel();
+
+  private:
+    Handler *mHandler;
+    TimerWheel *mWheel;
+
+    Timer *mPrev;
+    Timer *mNext;
+    uint64 mExpireTick;
+};
+
+/*
+ * 单层哈希时间轮, 超过一圈的定时器按到期tick留在槽中等待后续轮次
+ * 定时器最多可能提前一个tick触发, 仅适用于秒级的超时
+ */
+class TimerWheel
+{
+  public:
+    TimerWheel();
+
+    void initialise(uint64 now);
+
+    // delayMs之后触发, 已在轮上的定时器将被重新调度
+    void schedule(Timer *timer, uint64 delayMs);
+
+    // 推进到now, 触发所有到期的定时器
+    void advance(uint64 now);
+
+    // 粗粒度的当前时间(tick), 供数据通路记录活跃时间, 不产生系统调用
+    inline uint64 getCurrentTick() const
+    {
+        return mCurrentTick;
+    }
+
+  private:
+    void _link(Timer *head, Timer *timer);
+
+  private:
+    uint64 mCurrentTick;
+    Timer mSlots[TIMER_WHEEL_SLOTS]; // 各槽链表的哨兵
+};
+
+NAMESPACE_END // namespace proxy
+
+#endif // __TIMER_WHEEL_H__
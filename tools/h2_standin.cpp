@@ -0,0 +1,1222 @@
+#include "proxy_common.h"
+#include "select_poller.h"
+#include "listener.h"
+#include "connection.h"
+#include "h2_session.h"
+#include "hpack.h"
+
+#include <netdb.h>
+
+using namespace proxy;
+
+/*
+ * 测试h2://上游用的最小HTTP/2 CONNECT代理(h2c, prior knowledge)
+ *
+ * 每个CONNECT流连接:authority指定的目标后双向转发, -e时直接把DATA回显给客户端
+ * 响应的:status依次使用静态表索引, 字面值, 霍夫曼编码, 字面头部名并拆成CONTINUATION,
+ * 覆盖H2Session对各种响应头块的解码
+ * 发送遵守对端通告的流量控制窗口, 收到的DATA立即用WINDOW_UPDATE确认
+ *
+ * 编译: 先在根目录make生成lib/下的库, 再make -C tools
+ * 用法: h2_standin.out [-b ip] [-e] [-w window] [-m max_streams] [-g streams] port
+ *   -b 监听地址, 默认127.0.0.1
+ *   -e 回显模式, 不连接目标
+ *   -w 通告的SETTINGS_INITIAL_WINDOW_SIZE, 默认65535
+ *   -m 通告的SETTINGS_MAX_CONCURRENT_STREAMS, 默认100
+ *   -g 每个连接接受该数量的流之后发送GOAWAY, 已接受的流继续转发
+ *       h2_standin.out -t
+ *   -t 自检HPACK响应解码(hpackDecodeResponse/hpackDecodeStatus)后退出
+ */
+
+#define STANDIN_DEFAULT_STREAMS  100
+#define STANDIN_LOOP_INTERVAL    0.5
+#define STANDIN_HPACK_SERVER     54 // 静态表中的"server"
+#define STANDIN_SERVER_NAME      "h2-standin"
+
+enum EFrameType
+{
+    Frame_Data         = 0x0,
+    Frame_Headers      = 0x1,
+    Frame_Priority     = 0x2,
+    Frame_RstStream    = 0x3,
+    Frame_Settings     = 0x4,
+    Frame_PushPromise  = 0x5,
+    Frame_Ping         = 0x6,
+    Frame_Goaway       = 0x7,
+    Frame_WindowUpdate = 0x8,
+    Frame_Continuation = 0x9,
+};
+
+enum EFrameFlag
+{
+    Flag_EndStream  = 0x1,
+    Flag_Ack        = 0x1,
+    Flag_EndHeaders = 0x4,
+    Flag_Padded     = 0x8,
+    Flag_Priority   = 0x20,
+};
+
+enum ESettings
+{
+    Settings_HeaderTableSize      = 0x1,
+    Settings_MaxConcurrentStreams = 0x3,
+    Settings_InitialWindowSize    = 0x4,
+    Settings_MaxFrameSize         = 0x5,
+};
+
+enum EErrorCode
+{
+    Error_NoError       = 0x0,
+    Error_Protocol      = 0x1,
+    Error_FrameSize     = 0x6,
+    Error_RefusedStream = 0x7,
+    Error_Cancel        = 0x8,
+};
+
+// 响应头块中:status的编码方式, 按接受的流依次轮换
+enum EStatusEncoding
+{
+    Encoding_Indexed = 0,    // 静态表索引, 不在表中的状态码退化为字面值
+    Encoding_Literal,        // 字面值, 头部名引用静态表
+    Encoding_Huffman,        // 霍夫曼编码的值, 前面带一个无关头部
+    Encoding_LiteralName,    // 字面头部名+霍夫曼编码的值, 前置动态表大小更新, 头块拆到CONTINUATION
+    Encoding_Count,
+};
+
+static const char *gEncodingNames[Encoding_Count] = { "indexed", "literal", "huffman", "literal-name" };
+
+struct StandinOptions
+{
+    bool echo;
+    uint32 window;
+    uint32 maxStreams;
+    uint32 goawayAfter;
+};
+
+struct StandinStats
+{
+    uint64 sessions;
+    uint64 streams;
+    uint64 refused;
+    uint64 failed;
+    uint64 bytesUp;   // 客户端 -> 目标
+    uint64 bytesDown; // 目标 -> 客户端
+    uint64 encodings[Encoding_Count];
+};
+
+static StandinOptions gOptions;
+static StandinStats gStats;
+static volatile bool gbStop = false;
+
+static inline uint32 readUint32(const uint8 *p)
+{
+    return ((uint32)p[0] << 24) | ((uint32)p[1] << 16) | ((uint32)p[2] << 8) | (uint32)p[3];
+}
+
+static inline void writeUint32(uint8 *p, uint32 v)
+{
+    p[0] = (uint8)(v >> 24);
+    p[1] = (uint8)(v >> 16);
+    p[2] = (uint8)(v >> 8);
+    p[3] = (uint8)v;
+}
+
+/*
+ * 霍夫曼编码一串数字, 带长度前缀
+ * '0'~'2'为5位码00000~00010, '3'~'9'为6位码011001~011111, 末尾用1填充到整字节
+ */
+static size_t hpackEncodeHuffmanDigits(uint8 *buf, const char *digits)
+{
+    uint8 str[16];
+    size_t n = 0;
+    uint32 acc = 0;
+    int bits = 0;
+
+    for (const char *c = digits; *c && n < sizeof(str) - 1; ++c)
+    {
+        int d = *c - '0';
+        if (d <= 2)
+        {
+            acc = (acc << 5) | (uint32)d;
+            bits += 5;
+        }
+        else
+        {
+            acc = (acc << 6) | (uint32)(0x19 + d - 3);
+            bits += 6;
+        }
+
+        while (bits >= 8)
+        {
+            str[n++] = (uint8)(acc >> (bits - 8));
+            bits -= 8;
+            acc &= (1u << bits) - 1;
+        }
+    }
+    if (bits > 0)
+    {
+        str[n++] = (uint8)((acc << (8 - bits)) | ((1u << (8 - bits)) - 1));
+    }
+
+    size_t len = hpackEncodeInt(buf, 0x80, 7, (uint32)n);
+    memcpy(buf + len, str, n);
+    return len + n;
+}
+
+static size_t hpackEncodeStatus(uint8 *buf, int status, int encoding)
+{
+    static const int kStaticStatus[] = { 200, 204, 206, 304, 400, 404, 500 };
+    char value[8];
+    size_t n = 0;
+
+    snprintf(value, sizeof(value), "%03d", status);
+
+    switch (encoding)
+    {
+    case Encoding_Indexed:
+        for (size_t i = 0; i < sizeof(kStaticStatus)/sizeof(kStaticStatus[0]); ++i)
+        {
+            if (kStaticStatus[i] == status)
+                return hpackEncodeInt(buf, 0x80, 7, (uint32)(HPACK_STATIC_STATUS_FIRST + i));
+        }
+        return hpackEncodeLiteral(buf, HPACK_STATIC_STATUS_FIRST, value);
+
+    case Encoding_Literal:
+        return hpackEncodeLiteral(buf, HPACK_STATIC_STATUS_FIRST, value);
+
+    case Encoding_Huffman:
+        n += hpackEncodeLiteral(buf + n, STANDIN_HPACK_SERVER, STANDIN_SERVER_NAME);
+        n += hpackEncodeInt(buf + n, 0x00, 4, HPACK_STATIC_STATUS_FIRST);
+        n += hpackEncodeHuffmanDigits(buf + n, value);
+        return n;
+
+    default:
+        n += hpackEncodeInt(buf + n, 0x20, 5, 0);
+        n += hpackEncodeInt(buf + n, 0x10, 4, 0);
+        n += hpackEncodeInt(buf + n, 0x00, 7, 7);
+        memcpy(buf + n, ":status", 7);
+        n += 7;
+        n += hpackEncodeHuffmanDigits(buf + n, value);
+        return n;
+    }
+}
+
+class StandinSession;
+
+//--------------------------------------------------------------------------
+// 一个CONNECT流及其到目标的连接
+class StandinStream : public Connection::Handler
+{
+  public:
+    StandinStream(StandinSession *session, EventPoller *poller, uint32 id, int64 sendWindow)
+            :mSession(session)
+            ,mId(id)
+            ,mSendWindow(sendWindow)
+            ,mPending()
+            ,mbResponded(false)
+            ,mbUpstreamEnd(false)
+            ,mConn(poller)
+    {}
+
+    virtual ~StandinStream()
+    {
+        mConn.setEventHandler(NULL);
+        mConn.shutdown();
+    }
+
+    bool open(const char *authority);
+    void onClientData(const uint8 *data, size_t len);
+    void onClientEnd();
+
+    // Connection::Handler
+    virtual void onConnected(Connection *pConn);
+    virtual void onRecv(Connection *pConn, const void *data, size_t datalen);
+    virtual void onDisconnected(Connection *pConn);
+    virtual void onError(Connection *pConn);
+
+  public:
+    StandinSession *mSession;
+    uint32 mId;
+    int64 mSendWindow;
+    std::string mPending;  // 等待窗口的下行数据
+    bool mbResponded;
+    bool mbUpstreamEnd;    // 目标已关闭, 发完mPending后结束流
+    Connection mConn;
+};
+
+//--------------------------------------------------------------------------
+// 一条客户端HTTP/2连接
+class StandinSession : public Connection::Handler
+{
+  public:
+    StandinSession(EventPoller *poller)
+            :mPoller(poller)
+            ,mConn(poller)
+            ,mRecvBuf()
+            ,mbPreface(false)
+            ,mbGoaway(false)
+            ,mbClosed(false)
+            ,mStreams()
+            ,mHeaderBlock()
+            ,mHeaderStreamId(0)
+            ,mHeaderFlags(0)
+            ,mLastStreamId(0)
+            ,mAccepted(0)
+            ,mConnSendWindow(H2_DEFAULT_WINDOW)
+            ,mPeerInitialWindow(H2_DEFAULT_WINDOW)
+            ,mPeerMaxFrameSize(H2_DEFAULT_FRAME_SIZE)
+    {}
+
+    virtual ~StandinSession();
+
+    bool accept(int fd);
+    inline bool isClosed() const
+    {
+        return mbClosed;
+    }
+
+    void respond(uint32 id, int status, bool endStream);
+    void flushStream(StandinStream *s);
+    void finishStream(uint32 id, uint32 rstError);
+
+    // Connection::Handler
+    virtual void onRecv(Connection *pConn, const void *data, size_t datalen);
+    virtual void onDisconnected(Connection *pConn);
+    virtual void onError(Connection *pConn);
+
+  private:
+    typedef std::map<uint32, StandinStream *> StreamMap;
+
+    bool _onFrame(uint8 type, uint8 flags, uint32 id, const uint8 *payload, size_t len);
+    bool _onData(uint8 flags, uint32 id, const uint8 *payload, size_t len);
+    bool _onHeaders(uint8 flags, uint32 id, const uint8 *payload, size_t len);
+    bool _onSettings(uint8 flags, const uint8 *payload, size_t len);
+    bool _onWindowUpdate(uint32 id, const uint8 *payload, size_t len);
+    void _onRequest(uint32 id, bool endStream);
+    void _flushAll();
+    void _sendFrame(uint8 type, uint8 flags, uint32 id, const void *payload, size_t len);
+    void _sendWindowUpdate(uint32 id, uint32 increment);
+    void _sendGoaway(uint32 err);
+    void _close();
+
+  private:
+    EventPoller *mPoller;
+    Connection mConn;
+    std::string mRecvBuf;
+    bool mbPreface;
+    bool mbGoaway;
+    bool mbClosed;
+
+    StreamMap mStreams;
+    std::string mHeaderBlock;
+    uint32 mHeaderStreamId;
+    uint8 mHeaderFlags;
+    uint32 mLastStreamId;
+    uint32 mAccepted;
+
+    int64 mConnSendWindow;
+    uint32 mPeerInitialWindow;
+    uint32 mPeerMaxFrameSize;
+};
+
+// 回调中不能直接删除自身, 关闭后的对象在事件循环的间隙统一释放
+static std::vector<StandinSession *> gDeadSessions;
+static std::vector<StandinStream *> gDeadStreams;
+
+//--------------------------------------------------------------------------
+bool StandinStream::open(const char *authority)
+{
+    if (gOptions.echo)
+    {
+        mbResponded = true;
+        mSession->respond(mId, 200, false);
+        return true;
+    }
+
+    std::string host(authority);
+    std::string::size_type colon = host.rfind(':');
+    if (colon == std::string::npos || colon == 0)
+    {
+        ErrorPrint("[StandinStream::open] bad authority(%s)", authority);
+        return false;
+    }
+    std::string port = host.substr(colon + 1);
+    host = host.substr(0, colon);
+    if (host.size() > 2 && '[' == host[0] && ']' == host[host.size() - 1])
+        host = host.substr(1, host.size() - 2);
+
+    // 测试工具, 直接同步解析
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || NULL == res)
+    {
+        ErrorPrint("[StandinStream::open] resolve %s failed", authority);
+        return false;
+    }
+
+    mConn.setEventHandler(this);
+    bool ok = mConn.connect(res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+
+    if (!ok)
+        ErrorPrint("[StandinStream::open] connect %s failed: %s", authority, strerror(errno));
+    return ok;
+}
+
+void StandinStream::onClientData(const uint8 *data, size_t len)
+{
+    gStats.bytesUp += len;
+
+    if (gOptions.echo)
+    {
+        mPending.append((const char *)data, len);
+        mSession->flushStream(this);
+    }
+    else
+    {
+        mConn.send(data, len);
+    }
+}
+
+void StandinStream::onClientEnd()
+{
+    // 客户端不再发送, 隧道即将结束, 目标连接不做半关闭, 直接断开
+    mbUpstreamEnd = true;
+    mConn.setEventHandler(NULL);
+    mConn.shutdown();
+    mSession->flushStream(this);
+}
+
+void StandinStream::onConnected(Connection *pConn)
+{
+    mbResponded = true;
+    mSession->respond(mId, 200, false);
+}
+
+void StandinStream::onRecv(Connection *pConn, const void *data, size_t datalen)
+{
+    mPending.append((const char *)data, datalen);
+    mSession->flushStream(this);
+}
+
+void StandinStream::onDisconnected(Connection *pConn)
+{
+    mbUpstreamEnd = true;
+    mSession->flushStream(this);
+}
+
+void StandinStream::onError(Connection *pConn)
+{
+    if (!mbResponded)
+    {
+        ++gStats.failed;
+        mSession->respond(mId, 502, true);
+        mSession->finishStream(mId, 0);
+    }
+    else
+    {
+        mSession->finishStream(mId, Error_Cancel);
+    }
+}
+
+//--------------------------------------------------------------------------
+StandinSession::~StandinSession()
+{
+    _close();
+}
+
+bool StandinSession::accept(int fd)
+{
+    mConn.setEventHandler(this);
+    if (!mConn.acceptConnection(fd, true))
+        return false;
+
+    // SETTINGS: HEADER_TABLE_SIZE=0, MAX_CONCURRENT_STREAMS, INITIAL_WINDOW_SIZE
+    uint8 settings[18];
+    settings[0] = 0;
+    settings[1] = Settings_HeaderTableSize;
+    writeUint32(settings + 2, 0);
+    settings[6] = 0;
+    settings[7] = Settings_MaxConcurrentStreams;
+    writeUint32(settings + 8, gOptions.maxStreams);
+    settings[12] = 0;
+    settings[13] = Settings_InitialWindowSize;
+    writeUint32(settings + 14, gOptions.window);
+    _sendFrame(Frame_Settings, 0, 0, settings, sizeof(settings));
+
+    ++gStats.sessions;
+    return true;
+}
+
+void StandinSession::respond(uint32 id, int status, bool endStream)
+{
+    uint8 block[128];
+    int encoding = (int)(gStats.streams % Encoding_Count);
+    size_t n = hpackEncodeStatus(block, status, encoding);
+    uint8 flags = endStream ? Flag_EndStream : 0;
+
+    ++gStats.encodings[encoding];
+    if (Encoding_LiteralName == encoding)
+    {
+        size_t half = n / 2;
+        _sendFrame(Frame_Headers, flags, id, block, half);
+        _sendFrame(Frame_Continuation, Flag_EndHeaders, id, block + half, n - half);
+    }
+    else
+    {
+        _sendFrame(Frame_Headers, flags | Flag_EndHeaders, id, block, n);
+    }
+    ++gStats.streams;
+}
+
+void StandinSession::flushStream(StandinStream *s)
+{
+    if (mbClosed || !s->mbResponded)
+        return;
+
+    size_t off = 0;
+    while (off < s->mPending.size() && s->mSendWindow > 0 && mConnSendWindow > 0)
+    {
+        size_t n = s->mPending.size() - off;
+        n = min(n, (size_t)mPeerMaxFrameSize);
+        n = min(n, (size_t)s->mSendWindow);
+        n = min(n, (size_t)mConnSendWindow);
+
+        _sendFrame(Frame_Data, 0, s->mId, s->mPending.data() + off, n);
+        s->mSendWindow -= n;
+        mConnSendWindow -= n;
+        gStats.bytesDown += n;
+        off += n;
+    }
+    s->mPending.erase(0, off);
+
+    if (s->mbUpstreamEnd && s->mPending.empty())
+    {
+        _sendFrame(Frame_Data, Flag_EndStream, s->mId, NULL, 0);
+        finishStream(s->mId, 0);
+    }
+}
+
+void StandinSession::finishStream(uint32 id, uint32 rstError)
+{
+    StreamMap::iterator it = mStreams.find(id);
+    if (it == mStreams.end())
+        return;
+
+    if (rstError != 0)
+    {
+        uint8 payload[4];
+        writeUint32(payload, rstError);
+        _sendFrame(Frame_RstStream, 0, id, payload, sizeof(payload));
+    }
+
+    it->second->mConn.setEventHandler(NULL);
+    it->second->mConn.shutdown();
+    gDeadStreams.push_back(it->second);
+    mStreams.erase(it);
+
+    if (mbGoaway && mStreams.empty())
+        _close();
+}
+
+void StandinSession::onRecv(Connection *pConn, const void *data, size_t datalen)
+{
+    mRecvBuf.append((const char *)data, datalen);
+
+    size_t off = 0;
+    if (!mbPreface)
+    {
+        size_t prefaceLen = sizeof(H2_PREFACE) - 1;
+        if (mRecvBuf.size() < prefaceLen)
+            return;
+        if (memcmp(mRecvBuf.data(), H2_PREFACE, prefaceLen) != 0)
+        {
+            ErrorPrint("[StandinSession::onRecv] bad connection preface");
+            _close();
+            return;
+        }
+        mbPreface = true;
+        off = prefaceLen;
+    }
+
+    while (!mbClosed && mRecvBuf.size() - off >= H2_FRAME_HEADER_SIZE)
+    {
+        const uint8 *hdr = (const uint8 *)mRecvBuf.data() + off;
+        size_t len = ((size_t)hdr[0] << 16) | ((size_t)hdr[1] << 8) | hdr[2];
+        if (len > H2_DEFAULT_FRAME_SIZE)
+        {
+            ErrorPrint("[StandinSession::onRecv] frame too large: %u", (uint32)len);
+            _sendGoaway(Error_FrameSize);
+            _close();
+            return;
+        }
+        if (mRecvBuf.size() - off < H2_FRAME_HEADER_SIZE + len)
+            break;
+
+        uint32 id = readUint32(hdr + 5) & H2_MAX_STREAM_ID;
+        if (!_onFrame(hdr[3], hdr[4], id, hdr + H2_FRAME_HEADER_SIZE, len))
+        {
+            _sendGoaway(Error_Protocol);
+            _close();
+            return;
+        }
+        off += H2_FRAME_HEADER_SIZE + len;
+    }
+
+    if (!mbClosed)
+        mRecvBuf.erase(0, off);
+}
+
+void StandinSession::onDisconnected(Connection *pConn)
+{
+    _close();
+}
+
+void StandinSession::onError(Connection *pConn)
+{
+    _close();
+}
+
+bool StandinSession::_onFrame(uint8 type, uint8 flags, uint32 id, const uint8 *payload, size_t len)
+{
+    // 头块未结束时只能收到同一个流的CONTINUATION
+    if (mHeaderStreamId != 0 && (type != Frame_Continuation || id != mHeaderStreamId))
+        return false;
+
+    switch (type)
+    {
+    case Frame_Data:
+        return _onData(flags, id, payload, len);
+
+    case Frame_Headers:
+        return _onHeaders(flags, id, payload, len);
+
+    case Frame_Continuation:
+        if (0 == mHeaderStreamId)
+            return false;
+        mHeaderBlock.append((const char *)payload, len);
+        if (flags & Flag_EndHeaders)
+        {
+            uint32 hid = mHeaderStreamId;
+            mHeaderStreamId = 0;
+            _onRequest(hid, (mHeaderFlags & Flag_EndStream) != 0);
+        }
+        return true;
+
+    case Frame_Settings:
+        return _onSettings(flags, payload, len);
+
+    case Frame_WindowUpdate:
+        return _onWindowUpdate(id, payload, len);
+
+    case Frame_Ping:
+        if (len != 8)
+            return false;
+        if (!(flags & Flag_Ack))
+            _sendFrame(Frame_Ping, Flag_Ack, 0, payload, len);
+        return true;
+
+    case Frame_RstStream:
+        if (mStreams.find(id) != mStreams.end())
+            finishStream(id, 0);
+        return true;
+
+    case Frame_Goaway:
+        InfoPrint("[StandinSession] client sent GOAWAY");
+        _close();
+        return true;
+
+    case Frame_PushPromise:
+        return false;
+
+    default: // PRIORITY及未知类型忽略
+        return true;
+    }
+}
+
+bool StandinSession::_onData(uint8 flags, uint32 id, const uint8 *payload, size_t len)
+{
+    if (0 == id)
+        return false;
+
+    // 填充也计入流量控制
+    size_t flowLen = len;
+    if (flowLen > 0)
+        _sendWindowUpdate(0, (uint32)flowLen);
+
+    if (flags & Flag_Padded)
+    {
+        if (0 == len || (size_t)payload[0] + 1 > len)
+            return false;
+        len -= payload[0] + 1;
+        ++payload;
+    }
+
+    StreamMap::iterator it = mStreams.find(id);
+    if (it == mStreams.end())
+        return true; // 已结束的流, 只确认连接级窗口
+
+    StandinStream *s = it->second;
+    if (!(flags & Flag_EndStream) && flowLen > 0)
+        _sendWindowUpdate(id, (uint32)flowLen);
+
+    if (len > 0)
+        s->onClientData(payload, len);
+    if ((flags & Flag_EndStream) && mStreams.find(id) != mStreams.end())
+        s->onClientEnd();
+
+    return true;
+}
+
+bool StandinSession::_onHeaders(uint8 flags, uint32 id, const uint8 *payload, size_t len)
+{
+    if (0 == id || !(id & 1))
+        return false;
+
+    if (flags & Flag_Padded)
+    {
+        if (0 == len || (size_t)payload[0] + 1 > len)
+            return false;
+        len -= payload[0] + 1;
+        ++payload;
+    }
+    if (flags & Flag_Priority)
+    {
+        if (len < 5)
+            return false;
+        payload += 5;
+        len -= 5;
+    }
+
+    mHeaderBlock.assign((const char *)payload, len);
+    mHeaderFlags = flags;
+    if (flags & Flag_EndHeaders)
+    {
+        _onRequest(id, (flags & Flag_EndStream) != 0);
+    }
+    else
+    {
+        mHeaderStreamId = id;
+    }
+
+    return true;
+}
+
+bool StandinSession::_onSettings(uint8 flags, const uint8 *payload, size_t len)
+{
+    if (flags & Flag_Ack)
+        return true;
+    if (len % 6 != 0)
+        return false;
+
+    for (size_t i = 0; i < len; i += 6)
+    {
+        uint16 key = (uint16)((payload[i] << 8) | payload[i + 1]);
+        uint32 value = readUint32(payload + i + 2);
+
+        if (Settings_InitialWindowSize == key)
+        {
+            if (value > H2_MAX_WINDOW)
+                return false;
+
+            int64 delta = (int64)value - (int64)mPeerInitialWindow;
+            mPeerInitialWindow = value;
+            for (StreamMap::iterator it = mStreams.begin(); it != mStreams.end(); ++it)
+            {
+                it->second->mSendWindow += delta;
+            }
+        }
+        else if (Settings_MaxFrameSize == key)
+        {
+            if (value < H2_DEFAULT_FRAME_SIZE || value > 0xffffff)
+                return false;
+            mPeerMaxFrameSize = value;
+        }
+    }
+
+    _sendFrame(Frame_Settings, Flag_Ack, 0, NULL, 0);
+    _flushAll();
+    return true;
+}
+
+bool StandinSession::_onWindowUpdate(uint32 id, const uint8 *payload, size_t len)
+{
+    if (len != 4)
+        return false;
+
+    uint32 increment = readUint32(payload) & H2_MAX_WINDOW;
+    if (0 == id)
+    {
+        mConnSendWindow += increment;
+        _flushAll();
+        return true;
+    }
+
+    StreamMap::iterator it = mStreams.find(id);
+    if (it != mStreams.end())
+    {
+        it->second->mSendWindow += increment;
+        flushStream(it->second);
+    }
+
+    return true;
+}
+
+void StandinSession::_onRequest(uint32 id, bool endStream)
+{
+    const uint8 *p = (const uint8 *)mHeaderBlock.data();
+    const uint8 *end = p + mHeaderBlock.size();
+    std::string method, authority;
+
+    if (id <= mLastStreamId)
+    {
+        ErrorPrint("[StandinSession::_onRequest] stream id %u not increasing", id);
+        _sendGoaway(Error_Protocol);
+        _close();
+        return;
+    }
+    mLastStreamId = id;
+
+    // 请求头只解析:method和:authority, 名字引用静态表或为字面值, 值不支持霍夫曼编码
+    while (p < end)
+    {
+        uint8 b = *p;
+        uint32 index = 0;
+
+        if (b & 0x80)
+        {
+            if (!hpackDecodeInt(p, end, 7, index) || 0 == index || index > HPACK_STATIC_TABLE_SIZE)
+                goto bad_request;
+            if (HPACK_STATIC_METHOD == index)
+                method = "GET";
+            continue;
+        }
+        if ((b & 0xe0) == 0x20)
+        {
+            if (!hpackDecodeInt(p, end, 5, index))
+                goto bad_request;
+            continue;
+        }
+
+        const uint8 *str = NULL;
+        uint32 slen = 0;
+        bool huffman = false;
+        std::string name;
+
+        if (!hpackDecodeInt(p, end, (b & 0xc0) == 0x40 ? 6 : 4, index) || index > HPACK_STATIC_TABLE_SIZE)
+            goto bad_request;
+        if (0 == index)
+        {
+            if (!hpackDecodeString(p, end, str, slen, huffman) || huffman)
+                goto bad_request;
+            name.assign((const char *)str, slen);
+        }
+        if (!hpackDecodeString(p, end, str, slen, huffman) || huffman)
+            goto bad_request;
+
+        if (HPACK_STATIC_METHOD == index || 3 == index || name == ":method")
+            method.assign((const char *)str, slen);
+        else if (HPACK_STATIC_AUTHORITY == index || name == ":authority")
+            authority.assign((const char *)str, slen);
+    }
+
+    if (mbGoaway || mStreams.size() >= gOptions.maxStreams)
+    {
+        uint8 payload[4];
+        writeUint32(payload, Error_RefusedStream);
+        _sendFrame(Frame_RstStream, 0, id, payload, sizeof(payload));
+        ++gStats.refused;
+        return;
+    }
+
+    if (method != "CONNECT" || authority.empty())
+    {
+        ErrorPrint("[StandinSession::_onRequest] stream %u: unsupported request method=%s authority=%s",
+                   id, method.c_str(), authority.c_str());
+        respond(id, method != "CONNECT" ? 405 : 400, true);
+        return;
+    }
+
+    {
+        StandinStream *s = new StandinStream(this, mPoller, id, mPeerInitialWindow);
+        mStreams[id] = s;
+        DebugPrint("stream %u CONNECT %s", id, authority.c_str());
+
+        if (!s->open(authority.c_str()))
+        {
+            ++gStats.failed;
+            respond(id, 502, true);
+            finishStream(id, 0);
+            return;
+        }
+        if (endStream && mStreams.find(id) != mStreams.end())
+            s->onClientEnd();
+    }
+
+    // 达到-g指定的数量后通知客户端不再接受新的流, 等已接受的流结束后断开
+    if (gOptions.goawayAfter > 0 && ++mAccepted >= gOptions.goawayAfter && !mbGoaway)
+    {
+        InfoPrint("[StandinSession] GOAWAY after %u streams, last stream %u", mAccepted, id);
+        mbGoaway = true;
+        _sendGoaway(Error_NoError);
+        if (mStreams.empty())
+            _close();
+    }
+    return;
+
+bad_request:
+    ErrorPrint("[StandinSession::_onRequest] stream %u: undecodable header block", id);
+    respond(id, 400, true);
+}
+
+void StandinSession::_flushAll()
+{
+    // flushStream可能结束流并从mStreams中删除, 先取出id
+    std::vector<uint32> ids;
+    for (StreamMap::iterator it = mStreams.begin(); it != mStreams.end(); ++it)
+    {
+        ids.push_back(it->first);
+    }
+
+    for (size_t i = 0; i < ids.size() && !mbClosed; ++i)
+    {
+        StreamMap::iterator it = mStreams.find(ids[i]);
+        if (it != mStreams.end())
+            flushStream(it->second);
+    }
+}
+
+void StandinSession::_sendFrame(uint8 type, uint8 flags, uint32 id, const void *payload, size_t len)
+{
+    if (mbClosed)
+        return;
+
+    uint8 hdr[H2_FRAME_HEADER_SIZE];
+    hdr[0] = (uint8)(len >> 16);
+    hdr[1] = (uint8)(len >> 8);
+    hdr[2] = (uint8)len;
+    hdr[3] = type;
+    hdr[4] = flags;
+    writeUint32(hdr + 5, id & H2_MAX_STREAM_ID);
+
+    mConn.send(hdr, sizeof(hdr));
+    if (len > 0)
+        mConn.send(payload, len);
+}
+
+void StandinSession::_sendWindowUpdate(uint32 id, uint32 increment)
+{
+    uint8 payload[4];
+    writeUint32(payload, increment & H2_MAX_WINDOW);
+    _sendFrame(Frame_WindowUpdate, 0, id, payload, sizeof(payload));
+}
+
+void StandinSession::_sendGoaway(uint32 err)
+{
+    uint8 payload[8];
+    writeUint32(payload, mLastStreamId);
+    writeUint32(payload + 4, err);
+    _sendFrame(Frame_Goaway, 0, 0, payload, sizeof(payload));
+}
+
+void StandinSession::_close()
+{
+    if (mbClosed)
+        return;
+
+    mbClosed = true;
+    for (StreamMap::iterator it = mStreams.begin(); it != mStreams.end(); ++it)
+    {
+        it->second->mConn.setEventHandler(NULL);
+        it->second->mConn.shutdown();
+        gDeadStreams.push_back(it->second);
+    }
+    mStreams.clear();
+
+    mConn.setEventHandler(NULL);
+    mConn.shutdown();
+    gDeadSessions.push_back(this);
+}
+
+//--------------------------------------------------------------------------
+class StandinServer : public Listener::Handler
+{
+  public:
+    StandinServer(EventPoller *poller)
+            :mPoller(poller)
+    {}
+
+    virtual void onAccept(int connfd)
+    {
+        StandinSession *session = new StandinSession(mPoller);
+        if (!session->accept(connfd))
+        {
+            ErrorPrint("[StandinServer::onAccept] accept fd %d failed", connfd);
+            delete session;
+        }
+    }
+
+  private:
+    EventPoller *mPoller;
+};
+
+static void reclaim()
+{
+    for (size_t i = 0; i < gDeadStreams.size(); ++i)
+    {
+        delete gDeadStreams[i];
+    }
+    gDeadStreams.clear();
+
+    // 析构中_close()已执行过, 不会再次加入列表
+    for (size_t i = 0; i < gDeadSessions.size(); ++i)
+    {
+        delete gDeadSessions[i];
+    }
+    gDeadSessions.clear();
+}
+
+static void onSignal(int sig)
+{
+    gbStop = true;
+}
+
+//--------------------------------------------------------------------------
+// HPACK响应解码自检
+
+struct HpackCase
+{
+    const char *name;
+    const char *block;  // 十六进制
+    int status;         // 期望的hpackDecodeResponse返回值
+};
+
+static const HpackCase gHpackCases[] = {
+    { "indexed 200",                "88",                         200 },
+    { "indexed 500",                "8e",                         500 },
+    { "indexed, no :status",        "82",                         0   },
+    { "empty block",                "",                           0   },
+    { "literal 200",                "0803323030",                 200 },
+    { "literal 502",                "0803353032",                 502 },
+    { "literal incremental 404",    "4803343034",                 404 },
+    { "literal never indexed 407",  "1803343037",                 407 },
+    { "truncated trailing header",  "080332303071",               -1  },
+    { "literal name :status 418",   "00073a737461747573033431 38", 418 },
+    { "literal name other",         "0006737461747573033230 30",  0   },
+    { "huffman 200",                "08821001",                   200 },
+    { "huffman 502",                "08826c02",                   502 },
+    { "huffman 404",                "0883680d7f",                 404 },
+    { "huffman 999",                "0883 ffff ff",               -1  },
+    { "table size update, 204",     "2089",                       204 },
+    { "other header, huffman 200",  "0f270a68322d7374616e64696e 08821001", 200 },
+    { "literal too short",          "08023230",                   -1  },
+    { "literal not digits",         "0803327830",                 -1  },
+    { "huffman padding too long",   "088310 01ff",                -1  },
+    { "huffman padding not ones",   "08821000",                   -1  },
+    { "huffman non-digit",          "0881 1f",                    -1  },
+    { "huffman too short",          "088110",                     -1  },
+    { "indexed 0",                  "80",                         -1  },
+    { "indexed out of table",       "bf00",                       -1  },
+    { "string past end",            "080532",                     -1  },
+    { "integer overflow",           "0fffffffffff7f",             -1  },
+};
+
+static size_t parseHex(const char *hex, uint8 *buf, size_t cap)
+{
+    size_t n = 0;
+    int hi = -1;
+
+    for (const char *c = hex; *c && n < cap; ++c)
+    {
+        if (!isxdigit((unsigned char)*c))
+            continue;
+
+        int v = isdigit((unsigned char)*c) ? *c - '0' : (tolower((unsigned char)*c) - 'a' + 10);
+        if (hi < 0)
+        {
+            hi = v;
+        }
+        else
+        {
+            buf[n++] = (uint8)((hi << 4) | v);
+            hi = -1;
+        }
+    }
+
+    return n;
+}
+
+static int runHpackChecks()
+{
+    uint8 block[64];
+    int failed = 0;
+    int total = 0;
+
+    for (size_t i = 0; i < sizeof(gHpackCases)/sizeof(gHpackCases[0]); ++i)
+    {
+        const HpackCase &c = gHpackCases[i];
+        size_t n = parseHex(c.block, block, sizeof(block));
+        int status = hpackDecodeResponse(block, n);
+
+        ++total;
+        if (status != c.status)
+        {
+            ++failed;
+            printf("FAIL %-28s got %d, expect %d\n", c.name, status, c.status);
+        }
+    }
+
+    // hpackDecodeStatus直接解码值
+    {
+        uint8 str[8];
+        size_t n = parseHex("1001", str, sizeof(str));
+        ++total;
+        if (hpackDecodeStatus(str, (uint32)n, true) != 200)
+        {
+            ++failed;
+            printf("FAIL %-28s\n", "status huffman 200");
+        }
+        ++total;
+        if (hpackDecodeStatus((const uint8 *)"301", 3, false) != 301)
+        {
+            ++failed;
+            printf("FAIL %-28s\n", "status literal 301");
+        }
+        ++total;
+        if (hpackDecodeStatus((const uint8 *)"3010", 4, false) != -1)
+        {
+            ++failed;
+            printf("FAIL %-28s\n", "status literal too long");
+        }
+    }
+
+    // 本工具的编码器与解码器往返, 覆盖全部数字和每种编码方式
+    for (int status = 100; status < 1000; ++status)
+    {
+        for (int encoding = 0; encoding < Encoding_Count; ++encoding)
+        {
+            size_t n = hpackEncodeStatus(block, status, encoding);
+            int got = hpackDecodeResponse(block, n);
+
+            ++total;
+            if (got != status)
+            {
+                ++failed;
+                printf("FAIL round trip %d %-12s got %d\n", status, gEncodingNames[encoding], got);
+            }
+        }
+    }
+
+    // RFC 7541 C.1.2: 1337用5位前缀编码为1f 9a 0a
+    {
+        uint8 buf[8];
+        size_t n = hpackEncodeInt(buf, 0x00, 5, 1337);
+        const uint8 *p = buf;
+        uint32 v = 0;
+
+        ++total;
+        if (n != 3 || buf[0] != 0x1f || buf[1] != 0x9a || buf[2] != 0x0a ||
+            !hpackDecodeInt(p, buf + n, 5, v) || v != 1337 || p != buf + n)
+        {
+            ++failed;
+            printf("FAIL %-28s\n", "integer 1337");
+        }
+    }
+
+    printf("hpack: %d checks, %d failed\n", total, failed);
+    return failed > 0 ? 1 : 0;
+}
+
+//--------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    const char *bindIp = "127.0.0.1";
+
+    gOptions.echo = false;
+    gOptions.window = H2_DEFAULT_WINDOW;
+    gOptions.maxStreams = STANDIN_DEFAULT_STREAMS;
+    gOptions.goawayAfter = 0;
+    memset(&gStats, 0, sizeof(gStats));
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:ew:m:g:t")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            bindIp = optarg;
+            break;
+        case 'e':
+            gOptions.echo = true;
+            break;
+        case 'w':
+            gOptions.window = (uint32)strtoul(optarg, NULL, 10);
+            break;
+        case 'm':
+            gOptions.maxStreams = (uint32)strtoul(optarg, NULL, 10);
+            break;
+        case 'g':
+            gOptions.goawayAfter = (uint32)strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            return runHpackChecks();
+        default:
+            goto usage;
+        }
+    }
+    if (optind != argc - 1 || gOptions.window > H2_MAX_WINDOW || 0 == gOptions.maxStreams)
+        goto usage;
+
+    {
+        log_initialise(AllLog);
+        log_reg_console();
+
+        signal(SIGPIPE, SIG_IGN);
+        signal(SIGINT, onSignal);
+        signal(SIGTERM, onSignal);
+
+        SelectPoller selectPoller;
+        EventPoller &poller = selectPoller;
+        StandinServer server(&poller);
+        Listener listener(&poller);
+        listener.setEventHandler(&server);
+        if (!listener.initialise(bindIp, atoi(argv[optind])))
+        {
+            fprintf(stderr, "listen on %s:%s failed.\n", bindIp, argv[optind]);
+            return 1;
+        }
+
+        InfoPrint("h2 stand-in listening on %s:%s, %s mode, window %u, max streams %u",
+                  bindIp, argv[optind], gOptions.echo ? "echo" : "connect", gOptions.window, gOptions.maxStreams);
+
+        while (!gbStop)
+        {
+            poller.processPendingEvents(STANDIN_LOOP_INTERVAL);
+            reclaim();
+        }
+
+        listener.finalise();
+        reclaim();
+
+        printf("sessions=%llu streams=%llu refused=%llu failed=%llu up=%llu down=%llu",
+               (unsigned long long)gStats.sessions, (unsigned long long)gStats.streams,
+               (unsigned long long)gStats.refused, (unsigned long long)gStats.failed,
+               (unsigned long long)gStats.bytesUp, (unsigned long long)gStats.bytesDown);
+        for (int i = 0; i < Encoding_Count; ++i)
+        {
+            printf(" %s=%llu", gEncodingNames[i], (unsigned long long)gStats.encodings[i]);
+        }
+        printf("\n");
+
+        log_finalise();
+    }
+    return 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-b ip] [-e] [-w window] [-m max_streams] [-g streams] port\n"
+                    "       %s -t\n", argv[0], argv[0]);
+    return 1;
+}